@@ -2,18 +2,26 @@
 
 #extension GL_ARB_shader_draw_parameters : enable
 
+// VertexStream::Position
 layout(location = 0) in vec3 position;
-layout(location = 1) in vec3 normal;
-layout(location = 2) in vec2 uv;
 
 layout(binding = 1) readonly buffer TransformData
 {
    mat4 aTransformData[];
 };
 
+// Offset and scale per draw, identity for the float vertex layout
+layout(binding = 3) readonly buffer DequantizationData
+{
+   vec4 aDequantization[];
+};
+
 uniform mat4 uVP;
 
 void main() {
-    mat4 modelMatrix = aTransformData[gl_DrawIDARB];
-    gl_Position = uVP * modelMatrix * vec4(position, 1.0f);
+    // Instanced commands cover consecutive draws
+    int drawIndex = gl_BaseInstanceARB + gl_InstanceID;
+    mat4 modelMatrix = aTransformData[drawIndex];
+    vec3 localPos = aDequantization[drawIndex * 2].xyz + position * aDequantization[drawIndex * 2 + 1].xyz;
+    gl_Position = uVP * modelMatrix * vec4(localPos, 1.0f);
 }
\ No newline at end of file
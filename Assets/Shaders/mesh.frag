@@ -1,6 +1,9 @@
 #version 450
+#extension GL_ARB_bindless_texture : require
 
 layout(location = 0) out vec4 fragColor;
+// Octahedral normal, roughness, metallic
+layout(location = 1) out vec4 fragMaterial;
 
 in vec3 vNormal;
 in vec3 vWorldPos;
@@ -32,10 +35,50 @@ layout(binding = 2) readonly buffer MaterialData {
    Material materials[];
 };
 
+// Resident texture handles indexed by the material map slots, see TextureCache
+layout(binding = 4) readonly buffer TextureHandles {
+   uvec2 aTextureHandles[];
+};
+
+// Slot 0 and textures that are still streaming in return the fallback
+vec4 sampleMap(uint slot, vec4 fallback) {
+   uvec2 handle = aTextureHandles[slot];
+   if(slot == 0 || handle == uvec2(0)) return fallback;
+   return texture(sampler2D(handle), vUV);
+}
+
+// Tangent frame from screen space derivatives, the vertex format carries no tangents
+vec3 perturbNormal(uint slot, vec3 N) {
+   vec4 sam = sampleMap(slot, vec4(0.5f, 0.5f, 1.0f, 1.0f));
+   vec3 tangentNormal = sam.xyz * 2.0f - 1.0f;
+
+   vec3 dp1 = dFdx(vWorldPos);
+   vec3 dp2 = dFdy(vWorldPos);
+   vec2 duv1 = dFdx(vUV);
+   vec2 duv2 = dFdy(vUV);
+
+   vec3 dp2perp = cross(dp2, N);
+   vec3 dp1perp = cross(N, dp1);
+   vec3 T = dp2perp * duv1.x + dp1perp * duv2.x;
+   vec3 B = dp2perp * duv1.y + dp1perp * duv2.y;
+   float invmax = inversesqrt(max(dot(T, T), dot(B, B)));
+   if(isinf(invmax) || isnan(invmax)) return N;
+   return normalize(mat3(T * invmax, B * invmax, N) * tangentNormal);
+}
+
 uniform sampler3D uVolumeTexture;
+uniform sampler3D uOccupancyTexture;
 uniform vec3 uVoxelDims;
-uniform vec3 uCameraPosition;
 uniform vec3 uLightPosition;
+// Diffuse indirect is traced by the tiled compute pass
+uniform int uTiledConeTrace;
+// 0 - Radiance, 1 - Ambient Occlusion
+uniform int uGIMode;
+uniform vec3 uAmbientColor;
+// 0 - None, 1 - Hard (DDA), 2 - Soft (Cone)
+uniform int uShadowMode;
+uniform int uShadowMaxSteps;
+uniform float uShadowConeAperture;
 
 const float SCALING = uVoxelDims.y / uVoxelDims.y;
 const float CONE_OFFSET = uVoxelDims.y * sqrt(3.0f) * SCALING;
@@ -80,7 +123,111 @@ vec3 coneTrace(vec3 direction, float aperture) {
    return max(Lv.rgb, 0.0);
 }
 
+// Only accumulates opacity from the single channel occupancy volume
+float occlusionTrace(vec3 direction, float aperture) {
+   vec3 origin = ToVoxelSpace(vWorldPos);
+   origin += CONE_OFFSET * direction;
+
+   float dist = STEP_SIZE;
+   const float coneCoefficient = 2.0f * tan(aperture *	0.5f);
+   float occlusion = 0.0f;
+   const float maxDistance = distance(origin, vec3(1.0f));
+
+   while(dist < maxDistance && occlusion < 1.0f) {
+      float diameter = dist * coneCoefficient;
+      float mip = log2(diameter * INV_VOXEL_DIMS);
+
+	  vec3 position	= origin + dist * direction;
+      if(!IsInsideCube(position) || mip > 5.0f) break;
+
+      float sam = textureLod(uOccupancyTexture, position * 0.5 + 0.5, mip).r;
+      occlusion += (1.0f - occlusion) * sam;
+      dist += diameter * STEP_SIZE * 0.5f;
+   }
+   return 1.0f - occlusion;
+}
+
+// Exact walk over the finest occupancy cells between the surface and the light
+float hardShadow(vec3 lightPos) {
+   float dims = uVoxelDims.x;
+   // Grid space, pushed two cells off the surface to skip its own voxels
+   vec3 origin = (ToVoxelSpace(vWorldPos) * 0.5f + 0.5f) * dims + normal * 2.0f;
+   vec3 target = (ToVoxelSpace(lightPos) * 0.5f + 0.5f) * dims;
+
+   vec3 rd = target - origin;
+   float tEnd = length(rd);
+   rd /= tEnd;
+
+   ivec3 cell = ivec3(floor(origin));
+   ivec3 cellStep = ivec3(sign(rd));
+   vec3 invRd = 1.0f / max(abs(rd), vec3(1e-6));
+   vec3 tDelta = invRd;
+   vec3 tMax = (vec3(cellStep) * (vec3(cell) - origin) + (vec3(cellStep) * 0.5f + 0.5f)) * invRd;
+
+   // Stop one cell short of the light so the voxelized emitter does not
+   // shadow itself
+   float tStop = tEnd - 1.0f;
+   float t = 0.0f;
+   for(int i = 0; i < uShadowMaxSteps && t < tStop; ++i) {
+      if(any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell, ivec3(dims)))) break;
+      if(texelFetch(uOccupancyTexture, cell, 0).r > 0.0f) return 0.0f;
+
+      if(tMax.x < tMax.y && tMax.x < tMax.z) {
+         t = tMax.x; tMax.x += tDelta.x; cell.x += cellStep.x;
+      } else if(tMax.y < tMax.z) {
+         t = tMax.y; tMax.y += tDelta.y; cell.y += cellStep.y;
+      } else {
+         t = tMax.z; tMax.z += tDelta.z; cell.z += cellStep.z;
+      }
+   }
+   return 1.0f;
+}
+
+// Narrow opacity cone towards the light
+float softShadow(vec3 lightPos) {
+   vec3 origin = ToVoxelSpace(vWorldPos) + normal * CONE_OFFSET;
+   vec3 target = ToVoxelSpace(lightPos);
+   vec3 direction = target - origin;
+   float maxDistance = length(direction);
+   direction /= maxDistance;
+
+   float dist = STEP_SIZE;
+   const float coneCoefficient = 2.0f * tan(uShadowConeAperture * 0.5f);
+   float occlusion = 0.0f;
+
+   for(int i = 0; i < uShadowMaxSteps && occlusion < 1.0f; ++i) {
+      float diameter = max(dist * coneCoefficient, STEP_SIZE);
+      // Stop one cone diameter short of the light, the emitter itself is voxelized
+      if(dist + diameter > maxDistance) break;
+      float mip = log2(diameter * INV_VOXEL_DIMS);
+
+	  vec3 position	= origin + dist * direction;
+      if(!IsInsideCube(position) || mip > 5.0f) break;
+
+      float sam = textureLod(uOccupancyTexture, position * 0.5 + 0.5, mip).r;
+      occlusion += (1.0f - occlusion) * sam;
+      dist += diameter * 0.5f;
+   }
+   return 1.0f - occlusion;
+}
+
 #define PI 3.141592
+vec3 calculateAmbientOcclusion() {
+    vec3 N = normal;
+    vec3 T = cross(N, vec3(0.0f, 1.0f, 0.0f));
+    vec3 B = cross(T, N);
+    float ao = 0.0f;
+
+    float aperture = PI / 3.0f;
+    ao += occlusionTrace(N, aperture);
+    ao += occlusionTrace(0.7071f * N + 0.7071f * T, aperture);
+    ao += occlusionTrace(0.7071f * N + 0.7071f * (0.309f * T + 0.951f * B), aperture);
+    ao += occlusionTrace(0.7071f * N + 0.7071f * (-0.809f * T + 0.588f * B), aperture);
+    ao += occlusionTrace(0.7071f * N - 0.7071f * (-0.809f * T - 0.588f * B), aperture);
+    ao += occlusionTrace(0.7071f * N - 0.7071f * (0.309f * T - 0.951f * B), aperture);
+    return uAmbientColor * (ao / 6.0f);
+}
+
 vec3 calculateDiffuseIndirect() {
     vec3 N = normal;
     vec3 T = cross(N, vec3(0.0f, 1.0f, 0.0f));
@@ -104,15 +251,26 @@ vec3 calculateDiffuseIndirect() {
     return Lo / 6.0f;
 }
 
-vec3 calculateSpecularReflection(vec3 viewDir, float roughness) {
-    vec3 R = reflect(viewDir, normal);
-	float aperture = roughness * PI * 0.5f * 0.1f;
-    vec3 radiance = coneTrace(R, aperture);
-    return max(radiance, 0.0f);
+vec2 encodeOctahedral(vec3 n) {
+   n /= abs(n.x) + abs(n.y) + abs(n.z);
+   vec2 e = n.xy;
+   if(n.z < 0.0f)
+      e = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+   return e;
 }
 
 void main() {
    Material material = materials[vMaterialIndex];
+   if(material.normalMap != 0)
+      normal = perturbNormal(material.normalMap, normal);
+
+   vec3 albedo = material.albedo.rgb * sampleMap(material.albedoMap, vec4(1.0f)).rgb;
+   vec3 emissive = material.emissive.rgb * sampleMap(material.emissiveMap, vec4(1.0f)).rgb;
+   // glTF packs roughness in green and metallic in blue
+   vec4 metallicRoughness = sampleMap(material.metallicMap, vec4(1.0f));
+   float roughness = material.roughness * metallicRoughness.g;
+   float metallic = material.metallic * metallicRoughness.b;
+   float ao = sampleMap(material.ambientOcclusionMap, vec4(1.0f)).r;
 
    vec3 lightDir = uLightPosition - vWorldPos;
    float lightDist = length(lightDir);
@@ -120,16 +278,21 @@ void main() {
 
    float attenuation = 1.0f / (lightDist * lightDist);
    float diffuse = max(dot(normal, lightDir), 0.0f) * attenuation;
-   vec3 col = diffuse * material.albedo.rgb;
-   col += material.emissive.rgb * 10.0f;
-   col += calculateDiffuseIndirect().rgb * 0.3f;
-
-   vec3 viewDir = normalize(vWorldPos - uCameraPosition);
-
-   if(material.metallic > 0.001f) 
-      col += calculateSpecularReflection(viewDir, material.roughness) * material.metallic;
+   if(diffuse > 0.0f) {
+      if(uShadowMode == 1)
+         diffuse *= hardShadow(uLightPosition);
+      else if(uShadowMode == 2)
+         diffuse *= softShadow(uLightPosition);
+   }
+   vec3 col = diffuse * albedo;
+   col += emissive * 10.0f;
+   if(uTiledConeTrace == 0) {
+      if(uGIMode == 1)
+         col += calculateAmbientOcclusion() * 0.3f * ao;
+      else
+         col += calculateDiffuseIndirect().rgb * 0.3f * ao;
+   }
 
-   col /= (1.0f + col);
-   col = pow(col, vec3(0.4545));
    fragColor = vec4(col, 1.0f);
+   fragMaterial = vec4(encodeOctahedral(normal), roughness, metallic);
 }
@@ -0,0 +1,11 @@
+#version 450
+
+in vec3 gWorldPos;
+
+uniform vec3 uLightPosition;
+uniform float uFarPlane;
+
+void main() {
+   // Linear distance so the voxelizer can compare against it directly
+   gl_FragDepth = length(gWorldPos - uLightPosition) / uFarPlane;
+}
@@ -0,0 +1,25 @@
+#version 450
+
+#extension GL_ARB_shader_draw_parameters : enable
+
+// VertexStream::Position
+layout(location = 0) in vec3 position;
+
+layout(binding = 1) readonly buffer TransformData
+{
+   mat4 aTransformData[];
+};
+
+// Offset and scale per draw, identity for the float vertex layout
+layout(binding = 3) readonly buffer DequantizationData
+{
+   vec4 aDequantization[];
+};
+
+void main() {
+    // Instanced commands cover consecutive draws
+    int drawIndex = gl_BaseInstanceARB + gl_InstanceID;
+    mat4 modelMatrix = aTransformData[drawIndex];
+    vec3 localPos = aDequantization[drawIndex * 2].xyz + position * aDequantization[drawIndex * 2 + 1].xyz;
+    gl_Position = modelMatrix * vec4(localPos, 1.0f);
+}
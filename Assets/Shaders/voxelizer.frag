@@ -1,4 +1,5 @@
 #version 450
+#extension GL_ARB_bindless_texture : require
 
 in vec3 gNormal;
 in vec3 gWorldPos;
@@ -6,6 +7,14 @@ in vec2 gUV;
 in flat int gMaterialIndex;
 in vec3 gLightDirection;
 
+#ifdef CONSERVATIVE
+in flat vec3 gTriangle0;
+in flat vec3 gTriangle1;
+in flat vec3 gTriangle2;
+in flat vec4 gTriangleAABB;
+in flat int gDominantAxis;
+#endif
+
 struct Material {
 	vec4 albedo;
 	vec4 emissive;
@@ -27,12 +36,57 @@ struct Material {
 };
 
 uniform vec2 uVoxelDims;
+// Linear light distance, see point-shadow.frag
+uniform samplerCube uShadowMap;
+uniform float uShadowFarPlane;
 
 layout(rgba8, binding = 0) uniform image3D uVoxelTexture;
+layout(r8, binding = 1) uniform image3D uOccupancyTexture;
 layout(binding = 2) readonly buffer MaterialData {
    Material materials[];
 };
 
+layout(binding = 4) readonly buffer TextureHandles {
+   uvec2 aTextureHandles[];
+};
+
+// Derivatives are taken in voxel space, so the implicit lod matches the voxel footprint
+vec4 sampleMap(uint slot, vec4 fallback) {
+   uvec2 handle = aTextureHandles[slot];
+   if(slot == 0 || handle == uvec2(0)) return fallback;
+   return texture(sampler2D(handle), gUV);
+}
+
+#ifdef CONSERVATIVE
+// Separating axis test of Akenine-Moller, same as triangle-cull.comp
+bool TriangleBoxOverlap(vec3 q[3], vec3 center, vec3 halfSize) {
+   vec3 v0 = q[0] - center;
+   vec3 v1 = q[1] - center;
+   vec3 v2 = q[2] - center;
+   if(any(greaterThan(min(min(v0, v1), v2), halfSize)) || any(lessThan(max(max(v0, v1), v2), -halfSize)))
+      return false;
+
+   vec3 edges[3] = vec3[3](v1 - v0, v2 - v1, v0 - v2);
+   vec3 normal = cross(edges[0], edges[1]);
+   if(abs(dot(normal, v0)) > dot(halfSize, abs(normal)))
+      return false;
+
+   for(int i = 0; i < 3; ++i) {
+      for(int axisIndex = 0; axisIndex < 3; ++axisIndex) {
+         vec3 unitAxis = vec3(0.0f);
+         unitAxis[axisIndex] = 1.0f;
+         vec3 axis = cross(unitAxis, edges[i]);
+         float p0 = dot(v0, axis);
+         float p1 = dot(v1, axis);
+         float p2 = dot(v2, axis);
+         float radius = dot(halfSize, abs(axis));
+         if(min(min(p0, p1), p2) > radius || max(max(p0, p1), p2) < -radius)
+            return false;
+      }
+   }
+   return true;
+}
+#endif
 
 const float E = 0.001;
 bool IsInsideCube(vec3 position) {
@@ -41,6 +95,13 @@ bool IsInsideCube(vec3 position) {
 }
 
 void main() {
+#ifdef CONSERVATIVE
+   // Expanded corners of sliver triangles reach far past the triangle
+   vec2 clipPosition = gl_FragCoord.xy / uVoxelDims.x * 2.0f - 1.0f;
+   if(any(lessThan(clipPosition, gTriangleAABB.xy)) || any(greaterThan(clipPosition, gTriangleAABB.zw)))
+      discard;
+#endif
+
    vec3 n = normalize(gNormal);
    Material material = materials[gMaterialIndex];
 
@@ -48,12 +109,36 @@ void main() {
    vec3 lightDir = gLightDirection / lightDist;
 
    float attenuation = 1.0f / (lightDist * lightDist);
-   float diffuse = max(dot(n, lightDir), 0.1f) * attenuation;
-   vec3 col = diffuse * material.albedo.rgb;
-   col += material.emissive.rgb;
+   float closestDist = texture(uShadowMap, -lightDir).r * uShadowFarPlane;
+   float bias = uVoxelDims.y * 2.0f;
+   float visibility = lightDist - bias > closestDist ? 0.0f : 1.0f;
+
+   float diffuse = max(dot(n, lightDir) * visibility, 0.1f) * attenuation;
+   vec3 albedo = material.albedo.rgb * sampleMap(material.albedoMap, vec4(1.0f)).rgb;
+   vec3 emissive = material.emissive.rgb * sampleMap(material.emissiveMap, vec4(1.0f)).rgb;
+   vec3 col = diffuse * albedo;
+   col += emissive;
    
+#ifdef CONSERVATIVE
+   // Along the projection axis the plane stays within one voxel of the pixel center
+   vec3 triangle[3] = vec3[3](gTriangle0, gTriangle1, gTriangle2);
+   vec3 center = gWorldPos * uVoxelDims.x;
+   vec3 axis = vec3(0.0f);
+   axis[gDominantAxis] = 1.0f;
+   for(int i = -1; i <= 1; ++i) {
+     ivec3 voxelCoord = ivec3(floor(center + axis * float(i)));
+     if(any(lessThan(voxelCoord, ivec3(0))) || any(greaterThanEqual(voxelCoord, ivec3(uVoxelDims.x))))
+       continue;
+     if(TriangleBoxOverlap(triangle, vec3(voxelCoord) + 0.5f, vec3(0.5f))) {
+       imageStore(uVoxelTexture, voxelCoord, vec4(col, 1.0f));
+       imageStore(uOccupancyTexture, voxelCoord, vec4(1.0f));
+     }
+   }
+#else
    if(IsInsideCube(gWorldPos)) {
      ivec3 voxelCoord = ivec3(gWorldPos * uVoxelDims.x);
      imageStore(uVoxelTexture, voxelCoord, vec4(col, 1.0f));
+     imageStore(uOccupancyTexture, voxelCoord, vec4(1.0f));
    }
+#endif
 }
@@ -11,19 +11,44 @@ layout(binding = 1) readonly buffer TransformData
    mat4 aTransformData[];
 };
 
+// Inverse transpose of each transform, computed on the CPU when it changes
+layout(binding = 5) readonly buffer NormalMatrixData
+{
+   mat3 aNormalMatrices[];
+};
+
+// Offset and scale per draw, identity for the float vertex layout
+layout(binding = 3) readonly buffer DequantizationData
+{
+   vec4 aDequantization[];
+};
+
+uniform int uQuantizedVertices;
+
+vec3 decodeOctahedral(vec2 e) {
+   vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+   if(n.z < 0.0f)
+      n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+   return normalize(n);
+}
+
 out vec3 vWorldPos;
 out vec3 vNormal;
 out vec2 vUV;
 out flat int vMaterialIndex;
 
 void main() {
-    mat4 modelMatrix = aTransformData[gl_DrawIDARB];
-    mat3 normalTransform = mat3(transpose(inverse(modelMatrix)));
-    vec4 worldPos = modelMatrix * vec4(position, 1.0f);
+    // Instanced commands cover consecutive draws
+    int drawIndex = gl_BaseInstanceARB + gl_InstanceID;
+    mat4 modelMatrix = aTransformData[drawIndex];
+    mat3 normalTransform = aNormalMatrices[drawIndex];
+    vec3 localPos = aDequantization[drawIndex * 2].xyz + position * aDequantization[drawIndex * 2 + 1].xyz;
+    vec4 worldPos = modelMatrix * vec4(localPos, 1.0f);
 
     vWorldPos = worldPos.xyz;
-    vNormal = normalize(normalTransform * normal);
+    vec3 localNormal = uQuantizedVertices != 0 ? decodeOctahedral(normal.xy) : normal;
+    vNormal = normalize(normalTransform * localNormal);
     vUV = uv;
-    vMaterialIndex = gl_DrawIDARB;
+    vMaterialIndex = drawIndex;
     gl_Position = worldPos;
 }
\ No newline at end of file
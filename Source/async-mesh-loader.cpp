@@ -0,0 +1,192 @@
+#include "async-mesh-loader.h"
+
+#include "gl-utils.h"
+#include "scene-geometry.h"
+#include "texture-cache.h"
+#include "imgui-service.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstring>
+
+static bool IsSignaled(GLsync fence)
+{
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+void AsyncMeshLoader::Initialize(uint32_t stagingSize, uint32_t uploadBudget)
+{
+	mStagingSize = stagingSize;
+	mUploadBudget = uploadBudget;
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	mStagingBuffer.init(nullptr, stagingSize, flags | GL_CLIENT_STORAGE_BIT);
+	mStagingData = (uint8_t*)glMapNamedBufferRange(mStagingBuffer.handle, 0, stagingSize, flags);
+	if (mStagingData == nullptr)
+		logger::Error("Failed to map mesh staging buffer");
+}
+
+void AsyncMeshLoader::LoadMesh(const std::string& filename, OnLoaded onLoaded, const MeshLoadOptions& options)
+{
+	mRequests.push_back(std::make_unique<Request>());
+	Request* request = mRequests.back().get();
+	request->filename = filename;
+	request->onLoaded = std::move(onLoaded);
+	request->options = options;
+
+	JobSystem::Execute(request->context, [request]() {
+		bool parsed = ParseMesh(request->filename, &request->meshGroup, &request->meshData, request->options);
+		// Empty groups would need zero sized buffer storage
+		request->parsed = parsed && !request->meshData.vertices.empty() && !request->meshData.indices.empty();
+	});
+}
+
+void AsyncMeshLoader::RetireStaging()
+{
+	while (!mStagingFences.empty() && IsSignaled(mStagingFences.front().fence)) {
+		glDeleteSync(mStagingFences.front().fence);
+		mStagingTail = mStagingFences.front().end;
+		mStagingFences.pop_front();
+	}
+}
+
+uint64_t AsyncMeshLoader::AcquireStaging(uint64_t size, uint64_t* offset)
+{
+	uint64_t used = mStagingHead - mStagingTail;
+	uint64_t free = mStagingSize - used;
+	uint64_t position = mStagingHead % mStagingSize;
+	uint64_t contiguous = mStagingSize - position;
+
+	// Skip the tail end of the ring rather than splitting a copy
+	if (contiguous < size && free > contiguous) {
+		mStagingHead += contiguous;
+		free -= contiguous;
+		position = 0;
+		contiguous = mStagingSize;
+	}
+
+	uint64_t granted = std::min(size, std::min(free, contiguous));
+	*offset = position;
+	mStagingHead += granted;
+	return granted;
+}
+
+bool AsyncMeshLoader::CopyToBuffer(const uint8_t* data, uint64_t size, uint64_t* bytesCopied, GLuint dstBuffer, uint64_t dstOffset, uint64_t* budget)
+{
+	while (*bytesCopied < size) {
+		uint64_t remaining = std::min(size - *bytesCopied, *budget);
+		if (remaining == 0) return false;
+
+		uint64_t offset;
+		uint64_t granted = AcquireStaging(remaining, &offset);
+		if (granted == 0) return false;
+
+		std::memcpy(mStagingData + offset, data + *bytesCopied, granted);
+		glCopyNamedBufferSubData(mStagingBuffer.handle, dstBuffer, offset, dstOffset + *bytesCopied, granted);
+		*bytesCopied += granted;
+		*budget -= granted;
+	}
+	return true;
+}
+
+void AsyncMeshLoader::Publish(Scene* scene, Request* request, std::vector<uint32_t>& publishedGroups)
+{
+	MeshGroup* meshGroup = &request->meshGroup;
+	if (request->onLoaded)
+		request->onLoaded(scene, meshGroup);
+	scene->textures->ResolveMaterials(meshGroup);
+	scene->geometry->AddDraws(meshGroup);
+
+	scene->meshGroup.push_back(std::move(request->meshGroup));
+	publishedGroups.push_back((uint32_t)scene->meshGroup.size() - 1);
+	mGroupsPublished++;
+	logger::Debug("Mesh group resident: " + request->filename);
+}
+
+void AsyncMeshLoader::Update(Scene* scene, std::vector<uint32_t>& publishedGroups)
+{
+	RetireStaging();
+
+	uint64_t budget = mUploadBudget;
+	bool copied = false;
+	for (auto& request : mRequests) {
+		if (request->state == RequestState::Parsing) {
+			if (JobSystem::IsBusy(request->context)) continue;
+			if (!request->parsed) continue;
+
+			scene->geometry->Allocate(&request->meshGroup, (uint32_t)request->meshData.vertices.size(), (uint32_t)request->meshData.indices.size());
+			request->state = RequestState::Uploading;
+		}
+
+		if (request->state == RequestState::Uploading) {
+			// Uploads stay in request order so groups land in the order they were asked for
+			if (budget == 0) break;
+
+			// Pool buffers move when a later request grows them, the handles are looked up every frame
+			uint64_t budgetBefore = budget;
+			const MeshData& meshData = request->meshData;
+			const MeshGroup& meshGroup = request->meshGroup;
+			uint64_t vertexOffset = (uint64_t)meshGroup.baseVertex * GetVertexSize(meshGroup.pool->vertexFormat);
+			uint64_t positionOffset = (uint64_t)meshGroup.baseVertex * GetPositionSize(meshGroup.pool->vertexFormat);
+			uint64_t indexOffset = (uint64_t)meshGroup.firstIndex * GetIndexSize(meshGroup.pool->indexType);
+			bool done = CopyToBuffer(meshData.vertices.data(), meshData.vertices.size(),
+				&request->vertexBytesCopied, meshGroup.pool->vertexBuffer.buffer.handle, vertexOffset, &budget);
+			done = done && CopyToBuffer(meshData.positions.data(), meshData.positions.size(),
+				&request->positionBytesCopied, meshGroup.pool->positionBuffer.buffer.handle, positionOffset, &budget);
+			done = done && CopyToBuffer(meshData.indices.data(), meshData.indices.size(),
+				&request->indexBytesCopied, meshGroup.pool->indexBuffer.buffer.handle, indexOffset, &budget);
+			copied |= budget != budgetBefore;
+
+			if (!done) break;
+
+			request->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			request->meshData = MeshData();
+			request->state = RequestState::WaitingForGPU;
+		}
+	}
+	mBytesUploadedLastFrame = mUploadBudget - budget;
+
+	if (copied)
+		mStagingFences.push_back(StagingFence{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), mStagingHead });
+
+	// Failed parses are dropped, resident groups are published in request order
+	while (!mRequests.empty()) {
+		Request* request = mRequests.front().get();
+		if (request->state == RequestState::Parsing && !JobSystem::IsBusy(request->context) && !request->parsed) {
+			logger::Warn("Failed to load mesh: " + request->filename);
+			mRequests.pop_front();
+			continue;
+		}
+		if (request->state != RequestState::WaitingForGPU || !IsSignaled(request->fence)) break;
+
+		glDeleteSync(request->fence);
+		Publish(scene, request, publishedGroups);
+		mRequests.pop_front();
+	}
+}
+
+void AsyncMeshLoader::AddUI()
+{
+	if (IsIdle()) return;
+	ImGui::Text("Loading: %d mesh groups pending", (int)mRequests.size());
+	ImGui::Text("Streamed last frame: %.2f MB", mBytesUploadedLastFrame / (1024.0f * 1024.0f));
+}
+
+void AsyncMeshLoader::Destroy()
+{
+	for (auto& request : mRequests) {
+		// Allocations of unpublished groups are released with the scene geometry
+		JobSystem::Wait(request->context);
+		if (request->fence)
+			glDeleteSync(request->fence);
+	}
+	mRequests.clear();
+
+	for (auto& stagingFence : mStagingFences)
+		glDeleteSync(stagingFence.fence);
+	mStagingFences.clear();
+
+	glUnmapNamedBuffer(mStagingBuffer.handle);
+	mStagingBuffer.destroy();
+}
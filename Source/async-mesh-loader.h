@@ -0,0 +1,86 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+
+#include "mesh.h"
+#include "job-system.h"
+
+/*
+* Loads mesh groups in the background. Parsing runs on the JobSystem, vertex
+* and index data reach their SceneGeometry allocation through a persistent
+* mapped staging ring that is recycled with fences, and each group is only
+* published to the Scene once its copies have completed on the GPU. Update is called once per frame on the
+* GL thread and spends at most mUploadBudget bytes of copies per call.
+*/
+class AsyncMeshLoader {
+
+public:
+	// Runs on the GL thread right before the group is published, its CPU arrays can still be edited
+	using OnLoaded = std::function<void(Scene*, MeshGroup*)>;
+
+	void Initialize(uint32_t stagingSize = 64 * 1024 * 1024, uint32_t uploadBudget = 16 * 1024 * 1024);
+
+	void LoadMesh(const std::string& filename, OnLoaded onLoaded = nullptr, const MeshLoadOptions& options = {});
+
+	// Appends the index of every group published to scene->meshGroup this frame
+	void Update(Scene* scene, std::vector<uint32_t>& publishedGroups);
+
+	bool IsIdle() { return mRequests.empty(); }
+
+	void AddUI();
+
+	void Destroy();
+
+private:
+	enum class RequestState {
+		Parsing,
+		Uploading,
+		WaitingForGPU,
+	};
+
+	struct Request {
+		std::string filename;
+		OnLoaded onLoaded;
+		MeshLoadOptions options;
+		RequestState state = RequestState::Parsing;
+		JobSystem::Context context;
+		bool parsed = false;
+
+		MeshGroup meshGroup;
+		MeshData meshData;
+		uint64_t vertexBytesCopied = 0;
+		uint64_t positionBytesCopied = 0;
+		uint64_t indexBytesCopied = 0;
+		GLsync fence = nullptr;
+	};
+
+	struct StagingFence {
+		GLsync fence;
+		// Ring position everything before which is free once the fence signals
+		uint64_t end;
+	};
+
+	void RetireStaging();
+	// Grants up to size contiguous bytes of the ring, 0 if it is full
+	uint64_t AcquireStaging(uint64_t size, uint64_t* offset);
+	// Returns false if the budget or the ring ran out before all data was copied
+	bool CopyToBuffer(const uint8_t* data, uint64_t size, uint64_t* bytesCopied, GLuint dstBuffer, uint64_t dstOffset, uint64_t* budget);
+	void Publish(Scene* scene, Request* request, std::vector<uint32_t>& publishedGroups);
+
+	std::deque<std::unique_ptr<Request>> mRequests;
+
+	GLBuffer mStagingBuffer;
+	uint8_t* mStagingData = nullptr;
+	uint64_t mStagingSize = 0;
+	// Monotonic ring positions, modulo mStagingSize gives the offset
+	uint64_t mStagingHead = 0;
+	uint64_t mStagingTail = 0;
+	std::deque<StagingFence> mStagingFences;
+
+	uint64_t mUploadBudget = 0;
+	uint64_t mBytesUploadedLastFrame = 0;
+	uint32_t mGroupsPublished = 0;
+};
@@ -0,0 +1,417 @@
+#include "cluster-culler.h"
+
+#include "gl-utils.h"
+#include "camera.h"
+#include "imgui-service.h"
+#include "gpu-query.h"
+#include "scene-geometry.h"
+
+#include <algorithm>
+#include <string>
+
+void ClusterCuller::Initialize(uint32_t width, uint32_t height)
+{
+	for (int i = 0; i < 4; ++i) {
+		std::vector<std::string> defines;
+		if (i & 1) defines.push_back("CONE_CULLING");
+		if (i & 2) defines.push_back("OCCLUSION_CULLING");
+		mCullPrograms[i] = std::make_unique<GLComputeProgram>();
+		mCullPrograms[i]->init(GLShader{ "Assets/Shaders/cluster-cull.comp", defines });
+	}
+
+	mLodSelectProgram = std::make_unique<GLComputeProgram>();
+	mLodSelectProgram->init(GLShader{ "Assets/Shaders/lod-select.comp" });
+
+	for (int i = 0; i < 4; ++i) {
+		std::vector<std::string> defines;
+		if (i & 1) defines.push_back("QUANTIZED_POSITIONS");
+		if (i & 2) defines.push_back("INDEX_16");
+		mTriangleCullPrograms[i] = std::make_unique<GLComputeProgram>();
+		mTriangleCullPrograms[i]->init(GLShader{ "Assets/Shaders/triangle-cull.comp", defines });
+	}
+
+	mDepthDownsampleProgram = std::make_unique<GLComputeProgram>();
+	mDepthDownsampleProgram->init(GLShader{ "Assets/Shaders/hiz-downsample.comp", { "FROM_DEPTH" } });
+	mDownsampleProgram = std::make_unique<GLComputeProgram>();
+	mDownsampleProgram->init(GLShader{ "Assets/Shaders/hiz-downsample.comp" });
+
+	mViewportHeight = height;
+	mHiZWidth = std::max(width / 2, 1u);
+	mHiZHeight = std::max(height / 2, 1u);
+	mHiZMipLevels = 1;
+	while ((std::max(mHiZWidth, mHiZHeight) >> mHiZMipLevels) > 0)
+		mHiZMipLevels++;
+
+	TextureCreateInfo createInfo{ mHiZWidth, mHiZHeight, 1, GL_RED, GL_R32F, GL_TEXTURE_2D, GL_FLOAT };
+	createInfo.mipLevels = mHiZMipLevels;
+	createInfo.minFilterType = GL_NEAREST_MIPMAP_NEAREST;
+	createInfo.magFilterType = GL_NEAREST;
+	mHiZTexture = std::make_unique<GLTexture>();
+	mHiZTexture->init(&createInfo);
+
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	uint32_t statsSize = sizeof(uint32_t) * ((uint32_t)CullView::Count * 2 + 2);
+	mStatsBuffer.init(nullptr, statsSize, flags | GL_DYNAMIC_STORAGE_BIT);
+	mStats = (uint32_t*)glMapNamedBufferRange(mStatsBuffer.handle, 0, statsSize, flags);
+}
+
+ClusterCuller::ViewBuffers* ClusterCuller::GetViewBuffers(CullView view, uint32_t poolIndex, uint32_t meshletCount, uint32_t drawCount)
+{
+	std::vector<ViewBuffers>& buffers = mViewBuffers[(int)view];
+	if (poolIndex >= buffers.size())
+		buffers.resize(poolIndex + 1);
+
+	ViewBuffers* viewBuffers = &buffers[poolIndex];
+	if (viewBuffers->capacity < meshletCount) {
+		if (viewBuffers->capacity > 0) {
+			viewBuffers->commandBuffer.destroy();
+			viewBuffers->countBuffer.destroy();
+		}
+		viewBuffers->commandBuffer.init(nullptr, meshletCount * sizeof(DrawElementsIndirectCommand), 0);
+		viewBuffers->countBuffer.init(nullptr, sizeof(uint32_t), 0);
+		viewBuffers->capacity = meshletCount;
+	}
+	if (viewBuffers->lodCapacity < drawCount) {
+		if (viewBuffers->lodCapacity > 0) {
+			viewBuffers->lodCommandBuffer.destroy();
+			viewBuffers->selectedLodBuffer.destroy();
+			viewBuffers->compactCommandBuffer.destroy();
+			viewBuffers->compactCountBuffer.destroy();
+		}
+		viewBuffers->lodCommandBuffer.init(nullptr, drawCount * sizeof(DrawElementsIndirectCommand), 0);
+		viewBuffers->selectedLodBuffer.init(nullptr, drawCount * sizeof(uint32_t), 0);
+		viewBuffers->compactCommandBuffer.init(nullptr, drawCount * sizeof(DrawElementsIndirectCommand), 0);
+		viewBuffers->compactCountBuffer.init(nullptr, sizeof(uint32_t), 0);
+		viewBuffers->lodCapacity = drawCount;
+	}
+	return viewBuffers;
+}
+
+ClusterCuller::ViewBuffers* ClusterCuller::FindViewBuffers(CullView view, uint32_t poolIndex, uint32_t drawCount)
+{
+	std::vector<ViewBuffers>& buffers = mViewBuffers[(int)view];
+	if (!mViewValid[(int)view] || poolIndex >= buffers.size() || buffers[poolIndex].lodCapacity < drawCount)
+		return nullptr;
+	return &buffers[poolIndex];
+}
+
+void ClusterCuller::SelectLods(CullView view, Scene* scene, const glm::vec4* frustumPlanes, glm::vec3 cameraPosition, float projectionScale, float threshold, bool cullDraws)
+{
+	int viewIndex = (int)view;
+	uint32_t statsIndex = (uint32_t)CullView::Count + viewIndex;
+	glClearNamedBufferSubData(mStatsBuffer.handle, GL_R32UI, statsIndex * sizeof(uint32_t), sizeof(uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+	mLodSelectProgram->bind();
+	mLodSelectProgram->setVec4("uFrustumPlanes", (float*)frustumPlanes, 6);
+	mLodSelectProgram->setInt("uDrawCulling", cullDraws);
+	mLodSelectProgram->setInt("uStatsIndex", (int)statsIndex);
+	mLodSelectProgram->setVec3("uCameraPosition", &cameraPosition[0]);
+	mLodSelectProgram->setFloat("uProjectionScale", projectionScale);
+	mLodSelectProgram->setFloat("uLodThreshold", threshold);
+	// Meshlet culling still reads the selection, LOD 0 everywhere when disabled
+	mLodSelectProgram->setInt("uMaxLod", lodSelection ? MAX_LOD_COUNT - 1 : 0);
+
+	mLodSelectProgram->setBuffer(7, mStatsBuffer.handle);
+
+	mTotalDraws[viewIndex] = 0;
+	SceneGeometry* geometry = scene->geometry;
+	for (uint32_t poolIndex = 0; poolIndex < geometry->GetPoolCount(); ++poolIndex) {
+		GeometryPool* pool = geometry->GetPool(poolIndex);
+		uint32_t drawCount = pool->drawCount;
+		if (drawCount == 0) continue;
+
+		ViewBuffers* buffers = GetViewBuffers(view, poolIndex, pool->meshletCount, drawCount);
+		glClearNamedBufferData(buffers->compactCountBuffer.handle, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+		mLodSelectProgram->setInt("uDrawCount", (int)drawCount);
+		mLodSelectProgram->setBuffer(0, pool->lodBuffer.buffer.handle);
+		mLodSelectProgram->setBuffer(1, pool->transformBuffer.buffer.handle);
+		mLodSelectProgram->setBuffer(2, buffers->lodCommandBuffer.handle);
+		mLodSelectProgram->setBuffer(3, buffers->selectedLodBuffer.handle);
+		mLodSelectProgram->setBuffer(4, pool->boundsBuffer.buffer.handle);
+		mLodSelectProgram->setBuffer(5, buffers->compactCommandBuffer.handle);
+		mLodSelectProgram->setBuffer(6, buffers->compactCountBuffer.handle);
+		mLodSelectProgram->dispatch((drawCount + 63) / 64, 1, 1);
+		mTotalDraws[viewIndex] += drawCount;
+	}
+	mLodSelectProgram->unbind();
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void ClusterCuller::Cull(CullView view, Scene* scene, const glm::vec4* frustumPlanes, glm::vec3 cameraPosition, bool cone, bool occlusion)
+{
+	int viewIndex = (int)view;
+	uint32_t statsOffset = viewIndex * sizeof(uint32_t);
+	glClearNamedBufferSubData(mStatsBuffer.handle, GL_R32UI, statsOffset, sizeof(uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+	GLComputeProgram* program = mCullPrograms[(cone ? 1 : 0) | (occlusion ? 2 : 0)].get();
+	program->bind();
+	program->setVec4("uFrustumPlanes", (float*)frustumPlanes, 6);
+	program->setVec3("uCameraPosition", &cameraPosition[0]);
+	program->setInt("uView", viewIndex);
+	program->setBuffer(4, mStatsBuffer.handle);
+	if (occlusion) {
+		glm::vec2 hiZSize{ (float)mHiZWidth, (float)mHiZHeight };
+		program->setTexture("uHiZTexture", 0, mHiZTexture->handle);
+		program->setMat4("uHiZViewProjection", &mHiZViewProjection[0][0]);
+		program->setVec2("uHiZSize", &hiZSize[0]);
+	}
+
+	mTotalMeshlets[viewIndex] = 0;
+	SceneGeometry* geometry = scene->geometry;
+	for (uint32_t poolIndex = 0; poolIndex < geometry->GetPoolCount(); ++poolIndex) {
+		GeometryPool* pool = geometry->GetPool(poolIndex);
+		uint32_t meshletCount = pool->meshletCount;
+		if (meshletCount == 0) continue;
+
+		ViewBuffers* buffers = GetViewBuffers(view, poolIndex, meshletCount, pool->drawCount);
+		glClearNamedBufferData(buffers->countBuffer.handle, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+		program->setInt("uMeshletCount", (int)meshletCount);
+		program->setBuffer(0, pool->meshletBuffer.buffer.handle);
+		program->setBuffer(1, pool->transformBuffer.buffer.handle);
+		program->setBuffer(2, buffers->commandBuffer.handle);
+		program->setBuffer(3, buffers->countBuffer.handle);
+		program->setBuffer(5, buffers->selectedLodBuffer.handle);
+		program->dispatch((meshletCount + 63) / 64, 1, 1);
+		mTotalMeshlets[viewIndex] += meshletCount;
+	}
+	program->unbind();
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void ClusterCuller::CullTriangles(CullView view, Scene* scene, float halfExtent, GLComputeProgram* const* programs)
+{
+	int viewIndex = (int)view;
+	uint32_t triangleStatsIndex = (uint32_t)CullView::Count * 2;
+	glClearNamedBufferSubData(mStatsBuffer.handle, GL_R32UI, viewIndex * sizeof(uint32_t), sizeof(uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glClearNamedBufferSubData(mStatsBuffer.handle, GL_R32UI, triangleStatsIndex * sizeof(uint32_t), 2 * sizeof(uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+	mTotalMeshlets[viewIndex] = 0;
+	SceneGeometry* geometry = scene->geometry;
+	for (uint32_t poolIndex = 0; poolIndex < geometry->GetPoolCount(); ++poolIndex) {
+		GeometryPool* pool = geometry->GetPool(poolIndex);
+		uint32_t meshletCount = pool->meshletCount;
+		if (meshletCount == 0) continue;
+
+		// Every meshlet of every LOD and instance fits, whatever the selection
+		uint32_t indexCount = pool->meshletIndexCount;
+		ViewBuffers* buffers = GetViewBuffers(view, poolIndex, meshletCount, pool->drawCount);
+		if (buffers->triangleIndexCapacity < indexCount) {
+			if (buffers->triangleIndexCapacity > 0) {
+				buffers->triangleIndexBuffer.destroy();
+				buffers->triangleIndexCountBuffer.destroy();
+			}
+			buffers->triangleIndexBuffer.init(nullptr, indexCount * sizeof(uint32_t), 0);
+			buffers->triangleIndexCountBuffer.init(nullptr, sizeof(uint32_t), 0);
+			buffers->triangleIndexCapacity = indexCount;
+		}
+		glClearNamedBufferData(buffers->countBuffer.handle, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		glClearNamedBufferData(buffers->triangleIndexCountBuffer.handle, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+		bool quantized = pool->vertexFormat == VertexFormat::Quantized;
+		bool shortIndices = pool->indexType == GL_UNSIGNED_SHORT;
+		GLComputeProgram* program = programs[(quantized ? 1 : 0) | (shortIndices ? 2 : 0)];
+		program->bind();
+		program->setFloat("uHalfExtent", halfExtent);
+		program->setInt("uMeshletCount", (int)meshletCount);
+		program->setInt("uView", viewIndex);
+		program->setInt("uTriangleStatsIndex", (int)triangleStatsIndex);
+		program->setBuffer(0, pool->meshletBuffer.buffer.handle);
+		program->setBuffer(1, pool->transformBuffer.buffer.handle);
+		program->setBuffer(2, buffers->commandBuffer.handle);
+		program->setBuffer(3, buffers->countBuffer.handle);
+		program->setBuffer(4, mStatsBuffer.handle);
+		program->setBuffer(5, buffers->selectedLodBuffer.handle);
+		program->setBuffer(6, pool->indexBuffer.buffer.handle);
+		program->setBuffer(7, pool->positionBuffer.buffer.handle);
+		program->setBuffer(8, pool->dequantizationBuffer.buffer.handle);
+		program->setBuffer(9, buffers->triangleIndexBuffer.handle);
+		program->setBuffer(10, buffers->triangleIndexCountBuffer.handle);
+		// Only read by the voxelizing variants
+		program->setBuffer(11, pool->vertexBuffer.buffer.handle);
+		program->setBuffer(12, pool->materialBuffer.buffer.handle);
+		// One workgroup per meshlet, folded into y past the dispatch limit
+		uint32_t groupsX = std::min(meshletCount, 65535u);
+		program->dispatch(groupsX, (meshletCount + groupsX - 1) / groupsX, 1);
+		program->unbind();
+		mTotalMeshlets[viewIndex] += meshletCount;
+	}
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void ClusterCuller::CullCamera(Scene* scene)
+{
+	mViewValid[(int)CullView::Camera] = enabled || lodSelection || drawCulling;
+	if (!mViewValid[(int)CullView::Camera]) return;
+
+	GpuProfiler::Begin("Cluster Culling (Camera)");
+	Camera* camera = scene->camera;
+	// Pixels per world unit at distance 1
+	float projectionScale = camera->GetProjectionMatrix()[1][1] * mViewportHeight * 0.5f;
+	SelectLods(CullView::Camera, scene, camera->frustumPlanes.data(), camera->GetPosition(), projectionScale, lodThreshold, drawCulling);
+	mViewStreams[(int)CullView::Camera] = drawCulling ? ViewStream::CompactDraws : ViewStream::Lods;
+	if (enabled) {
+		bool occlusion = occlusionCulling && mHiZValid;
+		Cull(CullView::Camera, scene, camera->frustumPlanes.data(), camera->GetPosition(), coneCulling, occlusion);
+		mViewStreams[(int)CullView::Camera] = ViewStream::Meshlets;
+	}
+	// Only ever test against the pyramid of the frame right before
+	mHiZValid = false;
+	GpuProfiler::End();
+}
+
+void ClusterCuller::CullVoxelVolume(Scene* scene, float halfExtent, float voxelSize, GLComputeProgram* const* triangleVoxelizers)
+{
+	// Everything outside the volume is wasted raster work, the view is culled even with the camera toggles off
+	bool cullTriangles = voxelTriangleCulling || triangleVoxelizers != nullptr;
+	mViewValid[(int)CullView::VoxelVolume] = enabled || lodSelection || voxelDrawCulling || cullTriangles;
+	if (!mViewValid[(int)CullView::VoxelVolume]) return;
+
+	glm::vec4 planes[6] = {
+		{ 1.0f, 0.0f, 0.0f, halfExtent }, { -1.0f, 0.0f, 0.0f, halfExtent },
+		{ 0.0f, 1.0f, 0.0f, halfExtent }, { 0.0f, -1.0f, 0.0f, halfExtent },
+		{ 0.0f, 0.0f, 1.0f, halfExtent }, { 0.0f, 0.0f, -1.0f, halfExtent },
+	};
+	GpuProfiler::Begin("Cluster Culling (Voxel Volume)");
+	SelectLods(CullView::VoxelVolume, scene, planes, glm::vec3(0.0f), 0.0f, voxelSize * 0.5f, voxelDrawCulling);
+	ViewStream& stream = mViewStreams[(int)CullView::VoxelVolume];
+	stream = voxelDrawCulling ? ViewStream::CompactDraws : ViewStream::Lods;
+	if (cullTriangles) {
+		GLComputeProgram* cullPrograms[4];
+		for (int i = 0; i < 4; ++i)
+			cullPrograms[i] = mTriangleCullPrograms[i].get();
+		CullTriangles(CullView::VoxelVolume, scene, halfExtent, triangleVoxelizers != nullptr ? triangleVoxelizers : cullPrograms);
+		stream = ViewStream::Triangles;
+	}
+	else if (enabled) {
+		Cull(CullView::VoxelVolume, scene, planes, glm::vec3(0.0f), false, false);
+		stream = ViewStream::Meshlets;
+	}
+	GpuProfiler::End();
+}
+
+void ClusterCuller::Draw(CullView view, Scene* scene, GLProgram* program, VertexStream stream)
+{
+	ViewStream viewStream = mViewStreams[(int)view];
+	SceneGeometry* geometry = scene->geometry;
+	for (uint32_t poolIndex = 0; poolIndex < geometry->GetPoolCount(); ++poolIndex) {
+		GeometryPool* pool = geometry->GetPool(poolIndex);
+		ViewBuffers* buffers = FindViewBuffers(view, poolIndex, pool->drawCount);
+		bool meshletsCulled = buffers != nullptr && buffers->capacity >= pool->meshletCount;
+		if (buffers == nullptr)
+			pool->DrawIndirect(program, pool->drawIndirectBuffer.buffer.handle, 0, pool->drawCount, stream);
+		else if (viewStream == ViewStream::Triangles && meshletsCulled && buffers->triangleIndexCapacity > 0)
+			pool->DrawIndirectCountIndices(program, buffers->triangleIndexBuffer.handle, buffers->commandBuffer.handle, buffers->countBuffer.handle, pool->meshletCount, stream);
+		else if (viewStream == ViewStream::Meshlets && meshletsCulled)
+			pool->DrawIndirectCount(program, buffers->commandBuffer.handle, buffers->countBuffer.handle, pool->meshletCount, stream);
+		else if (viewStream == ViewStream::CompactDraws)
+			pool->DrawIndirectCount(program, buffers->compactCommandBuffer.handle, buffers->compactCountBuffer.handle, pool->drawCount, stream);
+		else
+			pool->DrawIndirect(program, buffers->lodCommandBuffer.handle, 0, pool->drawCount, stream);
+	}
+}
+
+void ClusterCuller::DrawGroup(CullView view, Scene* scene, uint32_t groupIndex, GLProgram* program, VertexStream stream)
+{
+	MeshGroup& meshGroup = scene->meshGroup[groupIndex];
+	ViewBuffers* buffers = FindViewBuffers(view, meshGroup.pool->index, meshGroup.pool->drawCount);
+	if (buffers == nullptr)
+		meshGroup.Draw(program, stream);
+	else
+		meshGroup.DrawIndirect(program, buffers->lodCommandBuffer.handle, stream);
+}
+
+void ClusterCuller::BuildHiZ(Camera* camera, uint32_t depthTexture)
+{
+	if (!enabled || !occlusionCulling) return;
+
+	GpuProfiler::Begin("Hi-Z Pyramid");
+	mDepthDownsampleProgram->bind();
+	mDepthDownsampleProgram->setTexture("uDepthTexture", 0, depthTexture);
+	mDepthDownsampleProgram->setTexture(1, mHiZTexture->handle, GL_WRITE_ONLY, GL_R32F, false, 0);
+	mDepthDownsampleProgram->dispatch((mHiZWidth + 7) / 8, (mHiZHeight + 7) / 8, 1);
+	mDepthDownsampleProgram->unbind();
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	mDownsampleProgram->bind();
+	for (int mip = 1; mip < mHiZMipLevels; ++mip) {
+		uint32_t width = std::max(mHiZWidth >> mip, 1u);
+		uint32_t height = std::max(mHiZHeight >> mip, 1u);
+		mDownsampleProgram->setTexture(0, mHiZTexture->handle, GL_READ_ONLY, GL_R32F, false, mip - 1);
+		mDownsampleProgram->setTexture(1, mHiZTexture->handle, GL_WRITE_ONLY, GL_R32F, false, mip);
+		mDownsampleProgram->dispatch((width + 7) / 8, (height + 7) / 8, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	mDownsampleProgram->unbind();
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	GpuProfiler::End();
+
+	mHiZViewProjection = camera->GetViewProjectionMatrix();
+	mHiZValid = true;
+}
+
+void ClusterCuller::AddUI()
+{
+	uint32_t drawStats = (uint32_t)CullView::Count;
+	ImGui::Checkbox("Draw Culling", &drawCulling);
+	if (drawCulling && mStats != nullptr)
+		ImGui::Text("Camera Draws: %d / %d", mStats[drawStats + (int)CullView::Camera], mTotalDraws[(int)CullView::Camera]);
+	ImGui::Checkbox("Voxelizer Draw Culling", &voxelDrawCulling);
+	if (voxelDrawCulling && mStats != nullptr)
+		ImGui::Text("Voxelizer Draws: %d / %d", mStats[drawStats + (int)CullView::VoxelVolume], mTotalDraws[(int)CullView::VoxelVolume]);
+	ImGui::Checkbox("Voxelizer Triangle Culling", &voxelTriangleCulling);
+	// The compute voxelizer only runs on full regenerations, its counts stay from the last one
+	bool computeVoxelized = mStats != nullptr && mStats[drawStats * 2 + 1] > 0;
+	if ((voxelTriangleCulling || computeVoxelized) && mStats != nullptr) {
+		ImGui::Text("Voxelizer Meshlets: %d / %d", mStats[(int)CullView::VoxelVolume], mTotalMeshlets[(int)CullView::VoxelVolume]);
+		ImGui::Text("Voxelizer Triangles: %d", mStats[drawStats * 2]);
+		if (computeVoxelized)
+			ImGui::Text("Voxelized In Compute: %d", mStats[drawStats * 2 + 1]);
+	}
+	ImGui::Checkbox("LOD Selection", &lodSelection);
+	if (lodSelection)
+		ImGui::SliderFloat("LOD Threshold (px)", &lodThreshold, 0.25f, 8.0f);
+	ImGui::Checkbox("Cluster Culling", &enabled);
+	if (enabled) {
+		ImGui::Checkbox("Cone Culling", &coneCulling);
+		ImGui::Checkbox("Occlusion Culling", &occlusionCulling);
+		if (mStats != nullptr) {
+			ImGui::Text("Camera Meshlets: %d / %d", mStats[(int)CullView::Camera], mTotalMeshlets[(int)CullView::Camera]);
+			if (!voxelTriangleCulling)
+				ImGui::Text("Voxelizer Meshlets: %d / %d", mStats[(int)CullView::VoxelVolume], mTotalMeshlets[(int)CullView::VoxelVolume]);
+		}
+	}
+}
+
+void ClusterCuller::Destroy()
+{
+	for (auto& program : mCullPrograms)
+		program->destroy();
+	mLodSelectProgram->destroy();
+	for (auto& program : mTriangleCullPrograms)
+		program->destroy();
+	mDepthDownsampleProgram->destroy();
+	mDownsampleProgram->destroy();
+	mHiZTexture->destroy();
+	for (auto& views : mViewBuffers) {
+		for (auto& buffers : views) {
+			if (buffers.capacity > 0) {
+				buffers.commandBuffer.destroy();
+				buffers.countBuffer.destroy();
+			}
+			if (buffers.lodCapacity > 0) {
+				buffers.lodCommandBuffer.destroy();
+				buffers.selectedLodBuffer.destroy();
+				buffers.compactCommandBuffer.destroy();
+				buffers.compactCountBuffer.destroy();
+			}
+			if (buffers.triangleIndexCapacity > 0) {
+				buffers.triangleIndexBuffer.destroy();
+				buffers.triangleIndexCountBuffer.destroy();
+			}
+		}
+	}
+	glUnmapNamedBuffer(mStatsBuffer.handle);
+	mStatsBuffer.destroy();
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+#include "mesh.h"
+
+class GLProgram;
+class GLComputeProgram;
+
+enum class CullView {
+	// Frustum, normal cones and optionally Hi-Z, shared by the prepass and the main pass
+	Camera = 0,
+	// Voxel volume bounds only, back faces still inject light
+	VoxelVolume = 1,
+	Count,
+};
+
+/*
+* GPU draw culling, LOD selection and meshlet culling. Every view first tests
+* the world AABB of each draw against its planes and picks one LOD per visible
+* draw into its own copy of the pool's draw commands, visible draws are also
+* compacted with a GPU side count. Meshlet culling then compacts the surviving
+* meshlets of the selected LODs into an indirect command stream and draw
+* count. Passes consume either stream with one glMultiDrawElementsIndirectCount
+* per SceneGeometry pool. Occlusion
+* culling tests against a max depth pyramid of the previous frame's prepass,
+* so geometry that is disoccluded by a fast camera turn can appear one frame late.
+* The voxel volume view has its own draw culling and can replace meshlet
+* culling with triangle culling, which compacts the triangles inside the
+* volume into a separate 32 bit index buffer.
+*/
+class ClusterCuller {
+
+public:
+	void Initialize(uint32_t width, uint32_t height);
+
+	void CullCamera(Scene* scene);
+
+	// halfExtent of the voxel volume, which is centered on the origin. LODs are
+	// picked so their error stays under half a voxel. triangleVoxelizers replace
+	// the triangle culling variants, same indexing, and forces triangle culling on
+	void CullVoxelVolume(Scene* scene, float halfExtent, float voxelSize, GLComputeProgram* const* triangleVoxelizers = nullptr);
+
+	// Draws every pool. Draws the compacted visible draws without meshlet culling
+	// when it is disabled, falls back to SceneGeometry::Draw when nothing ran
+	void Draw(CullView view, Scene* scene, GLProgram* program, VertexStream stream = VertexStream::Full);
+
+	// Selected LODs of one group, without meshlet culling. Culled draws are empty commands
+	void DrawGroup(CullView view, Scene* scene, uint32_t groupIndex, GLProgram* program, VertexStream stream = VertexStream::Full);
+
+	// Max reduces the prepass depth into the pyramid CullCamera tests against next frame
+	void BuildHiZ(Camera* camera, uint32_t depthTexture);
+
+	void AddUI();
+
+	void Destroy();
+
+	bool enabled = true;
+	bool coneCulling = true;
+	bool occlusionCulling = false;
+	bool lodSelection = true;
+	// AABB against the view planes, before LOD selection
+	bool drawCulling = true;
+	// Screen space error of the camera view in pixels
+	float lodThreshold = 1.0f;
+	// Independent of the camera toggles above
+	bool voxelDrawCulling = true;
+	bool voxelTriangleCulling = false;
+
+private:
+	// Stream the last cull of a view produced, Draw consumes the same one
+	enum class ViewStream {
+		Lods,
+		CompactDraws,
+		Meshlets,
+		Triangles,
+	};
+
+	struct ViewBuffers {
+		GLBuffer commandBuffer;
+		GLBuffer countBuffer;
+		uint32_t capacity = 0;
+		// One command and selected LOD per draw
+		GLBuffer lodCommandBuffer;
+		GLBuffer selectedLodBuffer;
+		// Commands of the draws that survived draw culling
+		GLBuffer compactCommandBuffer;
+		GLBuffer compactCountBuffer;
+		uint32_t lodCapacity = 0;
+		// Triangle culling output, commands go to commandBuffer
+		GLBuffer triangleIndexBuffer;
+		GLBuffer triangleIndexCountBuffer;
+		uint32_t triangleIndexCapacity = 0;
+	};
+
+	// projectionScale of 0 treats lodThreshold as a world space error
+	void SelectLods(CullView view, Scene* scene, const glm::vec4* frustumPlanes, glm::vec3 cameraPosition, float projectionScale, float threshold, bool cullDraws);
+
+	void Cull(CullView view, Scene* scene, const glm::vec4* frustumPlanes, glm::vec3 cameraPosition, bool cone, bool occlusion);
+
+	// Meshlets of the selected LODs, one command per meshlet with triangles left inside the cube
+	void CullTriangles(CullView view, Scene* scene, float halfExtent, GLComputeProgram* const* programs);
+
+	ViewBuffers* GetViewBuffers(CullView view, uint32_t poolIndex, uint32_t meshletCount, uint32_t drawCount);
+
+	// Null if the view was not culled or the pool grew since
+	ViewBuffers* FindViewBuffers(CullView view, uint32_t poolIndex, uint32_t drawCount);
+
+	// Hi-Z mip 0 is half the depth buffer resolution
+	uint32_t mHiZWidth, mHiZHeight;
+	uint32_t mViewportHeight;
+	int mHiZMipLevels;
+	bool mHiZValid = false;
+	glm::mat4 mHiZViewProjection;
+
+	std::vector<ViewBuffers> mViewBuffers[(int)CullView::Count];
+	uint32_t mTotalMeshlets[(int)CullView::Count] = {};
+	uint32_t mTotalDraws[(int)CullView::Count] = {};
+	// Cleared when neither LOD selection nor culling ran for a view
+	bool mViewValid[(int)CullView::Count] = {};
+	ViewStream mViewStreams[(int)CullView::Count] = {};
+
+	// Visible meshlets per view, visible draws per view, the triangles left by
+	// triangle culling and the ones voxelized in compute, the shaders count
+	// straight into the mapping
+	GLBuffer mStatsBuffer;
+	uint32_t* mStats = nullptr;
+
+	// Indexed by cone | occlusion << 1
+	std::unique_ptr<GLComputeProgram> mCullPrograms[4];
+	std::unique_ptr<GLComputeProgram> mLodSelectProgram;
+	// Indexed by quantized positions | 16 bit indices << 1
+	std::unique_ptr<GLComputeProgram> mTriangleCullPrograms[4];
+	std::unique_ptr<GLComputeProgram> mDepthDownsampleProgram, mDownsampleProgram;
+	std::unique_ptr<GLTexture> mHiZTexture;
+};
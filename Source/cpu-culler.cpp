@@ -0,0 +1,295 @@
+#include "cpu-culler.h"
+
+#include "imgui-service.h"
+#include "job-system.h"
+#include "logger.h"
+#include "scene-geometry.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <immintrin.h>
+#include <string>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC emits AVX2 intrinsics without /arch:AVX2
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// Boxes per queued job when a pool is split across workers
+static const uint32_t CULL_BATCH_SIZE = 4096;
+static const uint32_t BENCHMARK_BOX_COUNT = 1 << 20;
+
+static bool HasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	bool osSavesAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return osSavesAVX && (info[1] & (1 << 5));
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+void CpuCuller::BoundsSoA::Resize(uint32_t boxCount)
+{
+	count = boxCount;
+	uint32_t padded = (boxCount + 7) & ~7u;
+	for (auto* values : { &minX, &minY, &minZ, &maxX, &maxY, &maxZ })
+		values->assign(padded, 0.0f);
+}
+
+void CpuCuller::BoundsSoA::Set(uint32_t index, const AABB& aabb)
+{
+	minX[index] = aabb.min.x;
+	minY[index] = aabb.min.y;
+	minZ[index] = aabb.min.z;
+	maxX[index] = aabb.max.x;
+	maxY[index] = aabb.max.y;
+	maxZ[index] = aabb.max.z;
+}
+
+// The p-vertex of a plane only depends on the signs of its normal, so each
+// plane picks the min or max array once for all lanes
+struct PlaneSelect {
+	const float* x;
+	const float* y;
+	const float* z;
+};
+
+// arrays holds minX, minY, minZ, maxX, maxY, maxZ
+static PlaneSelect SelectPVertex(const glm::vec4& plane, const float* const* arrays)
+{
+	return PlaneSelect{ plane.x > 0.0f ? arrays[3] : arrays[0], plane.y > 0.0f ? arrays[4] : arrays[1], plane.z > 0.0f ? arrays[5] : arrays[2] };
+}
+
+static void TestSSE(const float* const* arrays, const glm::vec4* planes, uint32_t first, uint32_t count, uint8_t* visible)
+{
+	PlaneSelect select[6];
+	for (int i = 0; i < 6; ++i)
+		select[i] = SelectPVertex(planes[i], arrays);
+
+	const __m128 zero = _mm_setzero_ps();
+	for (uint32_t box = first; box < first + count; box += 4) {
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int i = 0; i < 6; ++i) {
+			__m128 distance = _mm_mul_ps(_mm_set1_ps(planes[i].x), _mm_loadu_ps(select[i].x + box));
+			distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(planes[i].y), _mm_loadu_ps(select[i].y + box)));
+			distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(planes[i].z), _mm_loadu_ps(select[i].z + box)));
+			distance = _mm_add_ps(distance, _mm_set1_ps(planes[i].w));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+		}
+		int mask = _mm_movemask_ps(inside);
+		for (uint32_t lane = 0; lane < 4 && box + lane < first + count; ++lane)
+			visible[box + lane] = (mask >> lane) & 1;
+	}
+}
+
+AVX2_TARGET static void TestAVX2(const float* const* arrays, const glm::vec4* planes, uint32_t first, uint32_t count, uint8_t* visible)
+{
+	PlaneSelect select[6];
+	for (int i = 0; i < 6; ++i)
+		select[i] = SelectPVertex(planes[i], arrays);
+
+	const __m256 zero = _mm256_setzero_ps();
+	for (uint32_t box = first; box < first + count; box += 8) {
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int i = 0; i < 6; ++i) {
+			__m256 distance = _mm256_mul_ps(_mm256_set1_ps(planes[i].x), _mm256_loadu_ps(select[i].x + box));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(planes[i].y), _mm256_loadu_ps(select[i].y + box)));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(planes[i].z), _mm256_loadu_ps(select[i].z + box)));
+			distance = _mm256_add_ps(distance, _mm256_set1_ps(planes[i].w));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+		}
+		int mask = _mm256_movemask_ps(inside);
+		for (uint32_t lane = 0; lane < 8 && box + lane < first + count; ++lane)
+			visible[box + lane] = (mask >> lane) & 1;
+	}
+}
+
+void CpuCuller::Initialize()
+{
+	mHasAVX2 = HasAVX2();
+	logger::Debug(std::string("CPU culling with ") + (mHasAVX2 ? "AVX2" : "SSE"));
+}
+
+void CpuCuller::Test(const BoundsSoA& bounds, const glm::vec4* planes, uint32_t first, uint32_t count, uint8_t* visible, bool allowAVX2)
+{
+	// Batches start on a multiple of 8, the padding keeps the last loads in bounds
+	const float* arrays[6] = { bounds.minX.data(), bounds.minY.data(), bounds.minZ.data(), bounds.maxX.data(), bounds.maxY.data(), bounds.maxZ.data() };
+	if (allowAVX2 && mHasAVX2)
+		TestAVX2(arrays, planes, first, count, visible);
+	else
+		TestSSE(arrays, planes, first, count, visible);
+}
+
+void CpuCuller::TestParallel(const BoundsSoA& bounds, const glm::vec4* planes, uint8_t* visible)
+{
+	if (bounds.count <= CULL_BATCH_SIZE) {
+		Test(bounds, planes, 0, bounds.count, visible, true);
+		return;
+	}
+
+	JobSystem::Context context;
+	uint32_t batchCount = (bounds.count + CULL_BATCH_SIZE - 1) / CULL_BATCH_SIZE;
+	JobSystem::Dispatch(context, batchCount, 1, [&](uint32_t batch) {
+		uint32_t first = batch * CULL_BATCH_SIZE;
+		Test(bounds, planes, first, std::min(CULL_BATCH_SIZE, bounds.count - first), visible, true);
+	});
+	JobSystem::Wait(context);
+}
+
+void CpuCuller::Cull(Scene* scene, const glm::vec4* frustumPlanes)
+{
+	Utils::Timer timer;
+	for (int i = 0; i < 6; ++i)
+		mPlanes[i] = frustumPlanes[i];
+
+	SceneGeometry* geometry = scene->geometry;
+	mPools.resize(geometry->GetPoolCount());
+	for (uint32_t poolIndex = 0; poolIndex < mPools.size(); ++poolIndex) {
+		PoolState& state = mPools[poolIndex];
+		uint32_t drawCount = geometry->GetPool(poolIndex)->drawCount;
+		state.bounds.Resize(drawCount);
+		state.commands.resize(drawCount);
+		state.visible.resize(drawCount);
+	}
+
+	// Transforms can change every frame, the world bounds are rebuilt with them
+	for (auto& meshGroup : scene->meshGroup) {
+		PoolState& state = mPools[meshGroup.pool->index];
+		for (uint32_t drawIndex = 0; drawIndex < meshGroup.drawCommands.size(); ++drawIndex) {
+			uint32_t poolDraw = meshGroup.firstDraw + drawIndex;
+			// Groups without bounds are never culled, same as lod-select.comp
+			if (drawIndex < meshGroup.aabbs.size())
+				state.bounds.Set(poolDraw, TransformAABB(meshGroup.aabbs[drawIndex], meshGroup.transforms[drawIndex]));
+			else
+				state.bounds.Set(poolDraw, AABB{ glm::vec3(-1e30f), glm::vec3(1e30f) });
+
+			state.commands[poolDraw] = meshGroup.getPoolCommand(drawIndex);
+		}
+	}
+
+	mVisibleDraws = 0;
+	mTotalDraws = 0;
+	for (auto& state : mPools) {
+		uint32_t drawCount = state.bounds.count;
+		TestParallel(state.bounds, mPlanes, state.visible.data());
+
+		state.visibleCommands.clear();
+		for (uint32_t drawIndex = 0; drawIndex < drawCount; ++drawIndex) {
+			if (state.visible[drawIndex])
+				state.visibleCommands.push_back(state.commands[drawIndex]);
+		}
+
+		if (state.capacity < drawCount) {
+			if (state.capacity > 0)
+				state.commandBuffer.destroy();
+			state.commandBuffer.init(nullptr, drawCount * sizeof(DrawElementsIndirectCommand), GL_DYNAMIC_STORAGE_BIT);
+			state.capacity = drawCount;
+		}
+		if (!state.visibleCommands.empty()) {
+			glNamedBufferSubData(state.commandBuffer.handle, 0, state.visibleCommands.size() * sizeof(DrawElementsIndirectCommand),
+				state.visibleCommands.data());
+		}
+		mVisibleDraws += (uint32_t)state.visibleCommands.size();
+		mTotalDraws += drawCount;
+	}
+	mCullTime = timer.Lap();
+}
+
+void CpuCuller::Draw(Scene* scene, GLProgram* program, VertexStream stream)
+{
+	SceneGeometry* geometry = scene->geometry;
+	for (uint32_t poolIndex = 0; poolIndex < geometry->GetPoolCount(); ++poolIndex) {
+		GeometryPool* pool = geometry->GetPool(poolIndex);
+		// Pools that appeared after the last Cull are drawn unculled
+		if (poolIndex >= mPools.size() || mPools[poolIndex].bounds.count != pool->drawCount)
+			pool->DrawIndirect(program, pool->drawIndirectBuffer.buffer.handle, 0, pool->drawCount, stream);
+		else
+			pool->DrawIndirect(program, mPools[poolIndex].commandBuffer.handle, 0, (uint32_t)mPools[poolIndex].visibleCommands.size(), stream);
+	}
+}
+
+void CpuCuller::RunBenchmark()
+{
+	// Scene boxes repeated to a fixed count so the rates do not depend on the scene size
+	BoundsSoA bounds;
+	bounds.Resize(BENCHMARK_BOX_COUNT);
+	uint32_t sourceCount = 0;
+	for (auto& state : mPools) {
+		for (uint32_t i = 0; i < state.bounds.count && sourceCount < BENCHMARK_BOX_COUNT; ++i, ++sourceCount) {
+			AABB aabb{ glm::vec3(state.bounds.minX[i], state.bounds.minY[i], state.bounds.minZ[i]),
+				glm::vec3(state.bounds.maxX[i], state.bounds.maxY[i], state.bounds.maxZ[i]) };
+			bounds.Set(sourceCount, aabb);
+		}
+	}
+	if (sourceCount == 0) {
+		logger::Warn("CPU culling benchmark needs a culled scene");
+		return;
+	}
+	for (uint32_t i = sourceCount; i < BENCHMARK_BOX_COUNT; ++i) {
+		uint32_t source = i % sourceCount;
+		bounds.Set(i, AABB{ glm::vec3(bounds.minX[source], bounds.minY[source], bounds.minZ[source]),
+			glm::vec3(bounds.maxX[source], bounds.maxY[source], bounds.maxZ[source]) });
+	}
+
+	std::vector<uint8_t> visible(BENCHMARK_BOX_COUNT);
+	auto rate = [](float milliseconds) { return BENCHMARK_BOX_COUNT / (milliseconds * 1000.0f); };
+
+	Utils::Timer timer;
+	uint32_t scalarVisible = 0;
+	for (uint32_t i = 0; i < BENCHMARK_BOX_COUNT; ++i) {
+		glm::vec3 min(bounds.minX[i], bounds.minY[i], bounds.minZ[i]);
+		glm::vec3 max(bounds.maxX[i], bounds.maxY[i], bounds.maxZ[i]);
+		scalarVisible += Utils::FrustumBoxIntersection(min, max, mPlanes) ? 1 : 0;
+	}
+	mScalarRate = rate(timer.Lap());
+
+	Test(bounds, mPlanes, 0, BENCHMARK_BOX_COUNT, visible.data(), false);
+	mSSERate = rate(timer.Lap());
+
+	uint32_t simdVisible = 0;
+	for (uint8_t v : visible)
+		simdVisible += v;
+	if (simdVisible != scalarVisible)
+		logger::Warn("CPU culling mismatch: scalar " + std::to_string(scalarVisible) + ", SIMD " + std::to_string(simdVisible));
+
+	timer.Lap();
+	Test(bounds, mPlanes, 0, BENCHMARK_BOX_COUNT, visible.data(), true);
+	mAVX2Rate = mHasAVX2 ? rate(timer.Lap()) : 0.0f;
+
+	timer.Lap();
+	TestParallel(bounds, mPlanes, visible.data());
+	mThreadedRate = rate(timer.Lap());
+
+	logger::Debug("CPU culling, million boxes/s: scalar " + std::to_string(mScalarRate) + ", SSE " + std::to_string(mSSERate) +
+		", AVX2 " + std::to_string(mAVX2Rate) + ", threaded " + std::to_string(mThreadedRate) +
+		" (" + std::to_string(JobSystem::GetThreadCount() + 1) + " threads)");
+}
+
+void CpuCuller::AddUI()
+{
+	ImGui::Checkbox("CPU Draw Culling", &enabled);
+	if (!enabled) return;
+
+	ImGui::Text("CPU Draws: %d / %d, %.3f ms (%s)", mVisibleDraws, mTotalDraws, mCullTime, mHasAVX2 ? "AVX2" : "SSE");
+	if (ImGui::Button("Benchmark CPU Culling"))
+		RunBenchmark();
+	if (mScalarRate > 0.0f) {
+		ImGui::Text("Million boxes/s: scalar %.1f, SSE %.1f, AVX2 %.1f, threaded %.1f",
+			mScalarRate, mSSERate, mAVX2Rate, mThreadedRate);
+	}
+}
+
+void CpuCuller::Destroy()
+{
+	for (auto& state : mPools) {
+		if (state.capacity > 0)
+			state.commandBuffer.destroy();
+	}
+	mPools.clear();
+}
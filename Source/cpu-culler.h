@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "mesh.h"
+
+/*
+* CPU reference for the draw culling in lod-select.comp, for drivers where
+* glMultiDrawElementsIndirectCount is slow. World AABBs of every pool draw are
+* kept in SoA arrays and tested against the frustum 8 boxes at a time with
+* AVX2, 4 with SSE when the CPU lacks it. Large pools are split across the
+* JobSystem. Visible draws are compacted into a per pool command buffer that
+* is drawn with a plain glMultiDrawElementsIndirect. LOD selection stays on
+* the GPU path, this one always draws LOD 0.
+*/
+class CpuCuller {
+
+public:
+	void Initialize();
+
+	// Refreshes the world bounds and compacts the draws inside the planes
+	void Cull(Scene* scene, const glm::vec4* frustumPlanes);
+
+	void Draw(Scene* scene, GLProgram* program, VertexStream stream = VertexStream::Full);
+
+	// Boxes per second of the scalar Utils::FrustumBoxIntersection, SSE, AVX2 and
+	// the threaded AVX2 path, over the current bounds tiled to a fixed size
+	void RunBenchmark();
+
+	void AddUI();
+
+	void Destroy();
+
+	bool enabled = false;
+
+private:
+	// Padded to a multiple of 8, padding boxes are never reported
+	struct BoundsSoA {
+		std::vector<float> minX, minY, minZ;
+		std::vector<float> maxX, maxY, maxZ;
+		uint32_t count = 0;
+
+		void Resize(uint32_t boxCount);
+		void Set(uint32_t index, const AABB& aabb);
+	};
+
+	struct PoolState {
+		BoundsSoA bounds;
+		// One instanceCount 1 command per pool draw, rebased onto the pool
+		std::vector<DrawElementsIndirectCommand> commands;
+		std::vector<uint8_t> visible;
+		std::vector<DrawElementsIndirectCommand> visibleCommands;
+		GLBuffer commandBuffer;
+		uint32_t capacity = 0;
+	};
+
+	// visible[i] = 1 for every box of [first, first + count) inside the planes
+	void Test(const BoundsSoA& bounds, const glm::vec4* planes, uint32_t first, uint32_t count, uint8_t* visible, bool allowAVX2);
+	void TestParallel(const BoundsSoA& bounds, const glm::vec4* planes, uint8_t* visible);
+
+	std::vector<PoolState> mPools;
+	glm::vec4 mPlanes[6];
+	bool mHasAVX2 = false;
+
+	uint32_t mVisibleDraws = 0;
+	uint32_t mTotalDraws = 0;
+	float mCullTime = 0.0f;
+
+	// Millions of boxes per second
+	float mScalarRate = 0.0f;
+	float mSSERate = 0.0f;
+	float mAVX2Rate = 0.0f;
+	float mThreadedRate = 0.0f;
+};
@@ -2,6 +2,8 @@
 
 #include "gl-utils.h"
 #include "camera.h"
+#include "cluster-culler.h"
+#include "cpu-culler.h"
 #include "gpu-query.h"
 
 void DepthPrePass::Initialize(uint32_t width, uint32_t height) 
@@ -21,7 +23,7 @@ void DepthPrePass::Initialize(uint32_t width, uint32_t height)
 	glGenQueries(1, &mTimerQuery);
 }
 
-void DepthPrePass::Render(Scene* scene)
+void DepthPrePass::Render(Scene* scene, ClusterCuller* clusterCuller, CpuCuller* cpuCuller)
 {
 	glDepthMask(GL_TRUE);
 	glEnable(GL_DEPTH_TEST);
@@ -36,8 +38,11 @@ void DepthPrePass::Render(Scene* scene)
 	mShader->bind();
 	glm::mat4 VP = scene->camera->GetViewProjectionMatrix();
 	mShader->setMat4("uVP", &VP[0][0]);
-	for (auto& meshGroup : scene->meshGroup)
-		meshGroup.Draw(mShader.get());
+	// Depth only, fetches the packed position stream
+	if (cpuCuller && cpuCuller->enabled)
+		cpuCuller->Draw(scene, mShader.get(), VertexStream::Position);
+	else
+		clusterCuller->Draw(CullView::Camera, scene, mShader.get(), VertexStream::Position);
 	mShader->unbind();
 	mFramebuffer->unbind();
 	GpuProfiler::End();
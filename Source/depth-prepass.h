@@ -8,13 +8,16 @@
 struct GLFramebuffer;
 class GLProgram;
 class Camera;
+class ClusterCuller;
+class CpuCuller;
 
 class DepthPrePass {
 
 public:
 	void Initialize(uint32_t width, uint32_t height);
 
-	void Render(Scene* scene);
+	// Draws the camera stream of clusterCuller, or the CPU culled draws when cpuCuller is enabled
+	void Render(Scene* scene, ClusterCuller* clusterCuller, CpuCuller* cpuCuller = nullptr);
 
 	unsigned int GetDepthAttachment();
 
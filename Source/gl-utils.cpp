@@ -51,6 +51,17 @@ static std::optional<std::string> ReadShaderFile(const char* filename)
 	};
 }
 
+static std::string InjectDefines(std::string shaderCode, const std::vector<std::string>& defines)
+{
+	std::string defineBlock;
+	for (auto& define : defines)
+		defineBlock += "#define " + define + "\n";
+
+	std::size_t versionEnd = shaderCode.find('\n', shaderCode.find("#version"));
+	shaderCode.insert(versionEnd + 1, defineBlock);
+	return shaderCode;
+}
+
 /*****************************************************************************************************************************************/
 
 GLShader::GLShader(const char* filename) :
@@ -58,6 +69,11 @@ GLShader::GLShader(const char* filename) :
 {
 }
 
+GLShader::GLShader(const char* filename, const std::vector<std::string>& defines) :
+	GLShader(GetShaderTypeFromFile(filename), InjectDefines(ReadShaderFile(filename).value(), defines).c_str())
+{
+}
+
 GLShader::GLShader(GLenum type, const char* shaderCode) :
 	type_(type),
 	handle_(glCreateShader(type_))
@@ -128,6 +144,13 @@ void GLProgram::setTexture(const std::string& name, int binding, unsigned int te
 		glBindTexture(GL_TEXTURE_2D, textureId);
 }
 
+void GLProgram::setTextureCube(const std::string& name, int binding, unsigned int textureId)
+{
+	setInt(name, binding);
+	glActiveTexture(GL_TEXTURE0 + binding);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
+}
+
 void GLProgram::setUAVTexture(int binding, uint32_t textureId, GLenum access, GLenum format, bool layered, int mipLevel)
 {
 	glBindImageTexture(binding, textureId, mipLevel, layered ? GL_TRUE : GL_FALSE, 0, access, format);
@@ -158,9 +181,9 @@ void GLProgram::setVec4(const std::string& name, float* val)
 	glUniform4fv(glGetUniformLocation(handle_, name.c_str()), 1, val);
 }
 
-void GLProgram::setMat4(const std::string& name, float* data)
+void GLProgram::setMat4(const std::string& name, float* data, int count)
 {
-	glUniformMatrix4fv(glGetUniformLocation(handle_, name.c_str()), 1, GL_FALSE, data);
+	glUniformMatrix4fv(glGetUniformLocation(handle_, name.c_str()), count, GL_FALSE, data);
 }
 
 void GLProgram::setBuffer(int binding, uint32_t bufferId)
@@ -184,6 +207,23 @@ void GLComputeProgram::setTexture(int binding, uint32_t textureId, GLenum access
 	glBindImageTexture(binding, textureId, mipLevel, layered ? GL_TRUE : GL_FALSE, 0, access, format);
 }
 
+void GLComputeProgram::setTexture(const std::string& name, int binding, unsigned int textureId, bool layered)
+{
+	setInt(name, binding);
+	glActiveTexture(GL_TEXTURE0 + binding);
+	if (layered)
+		glBindTexture(GL_TEXTURE_3D, textureId);
+	else
+		glBindTexture(GL_TEXTURE_2D, textureId);
+}
+
+void GLComputeProgram::setTextureCube(const std::string& name, int binding, unsigned int textureId)
+{
+	setInt(name, binding);
+	glActiveTexture(GL_TEXTURE0 + binding);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
+}
+
 void GLComputeProgram::setBuffer(int binding, uint32_t bufferId)
 {
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, bufferId);
@@ -219,11 +259,23 @@ void GLComputeProgram::setVec4(const std::string& name, float* val, int count)
 	glUniform4fv(glGetUniformLocation(handle_, name.c_str()), count, val);
 }
 
+void GLComputeProgram::setMat4(const std::string& name, float* data)
+{
+	glUniformMatrix4fv(glGetUniformLocation(handle_, name.c_str()), 1, GL_FALSE, data);
+}
+
 void GLComputeProgram::dispatch(uint32_t workGroupX, uint32_t workGroupY, uint32_t workGroupZ) const
 {
 	glDispatchCompute(workGroupX, workGroupY, workGroupZ);
 }
 
+void GLComputeProgram::dispatchIndirect(uint32_t bufferId, uint32_t offset) const
+{
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, bufferId);
+	glDispatchComputeIndirect((GLintptr)offset);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+}
+
 void GLBuffer::init(void* data, uint32_t size, GLbitfield flags)
 {
 	glCreateBuffers(1, &handle);
@@ -233,6 +285,7 @@ void GLBuffer::init(void* data, uint32_t size, GLbitfield flags)
 void GLFramebuffer::initializeColorAttachment(const std::vector<Attachment>& attachments)
 {
 	this->attachments.resize(attachments.size());
+	std::vector<GLenum> drawBuffers(attachments.size());
 	for (auto& attachment : attachments) {
 		GLTexture texture;
 		texture.init(attachment.attachmentInfo);
@@ -241,7 +294,9 @@ void GLFramebuffer::initializeColorAttachment(const std::vector<Attachment>& att
 			GL_COLOR_ATTACHMENT0 + attachment.index,
 			attachment.attachmentInfo->target,
 			texture.handle, 0);
+		drawBuffers[attachment.index] = GL_COLOR_ATTACHMENT0 + attachment.index;
 	}
+	glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
 }
 
 void GLFramebuffer::initializeDepthAttachment(TextureCreateInfo* depthAttachmentInfo)
@@ -315,7 +370,7 @@ void GLTexture::init(TextureCreateInfo* createInfo, void* data)
 	glGenTextures(1, &handle);
 	glBindTexture(target, handle);
 
-	if (target == GL_TEXTURE_2D) {
+	if (target == GL_TEXTURE_2D || target == GL_TEXTURE_CUBE_MAP) {
 		glTexStorage2D(target, createInfo->mipLevels, createInfo->internalFormat, width, height);
 /*
 		glTexImage2D(target,
@@ -17,6 +17,12 @@ struct DrawElementsIndirectCommand {
 	GLuint baseInstance_;
 };
 
+struct DispatchIndirectCommand {
+	GLuint numGroupsX;
+	GLuint numGroupsY;
+	GLuint numGroupsZ;
+};
+
 extern float gOGLVersion;
 
 /*************************************************************************************************************************************************/
@@ -28,6 +34,9 @@ public:
 
 	explicit GLShader(const char* filename);
 
+	// Injects each define right after the #version directive
+	GLShader(const char* filename, const std::vector<std::string>& defines);
+
 	GLShader(GLenum type, const char* shaderCode);
 
 	inline GLenum getType() { return type_; }
@@ -61,6 +70,8 @@ public:
 
 	void setTexture(const std::string& name, int binding, unsigned int textureId, bool layered = false);
 
+	void setTextureCube(const std::string& name, int binding, unsigned int textureId);
+
 	void setUAVTexture(int binding, uint32_t textureId, GLenum access, GLenum format, bool layered = false, int mipLevel = 0);
 
 	void setBuffer(int binding, uint32_t bufferId);
@@ -75,7 +86,7 @@ public:
 
 	void setVec4(const std::string& name, float* val);
 
-	void setMat4(const std::string& name, float* data);
+	void setMat4(const std::string& name, float* data, int count = 1);
 
 	GLint getAttribLocation(const std::string& name) {
 		return glGetAttribLocation(handle_, name.c_str());
@@ -98,6 +109,10 @@ public:
 
 	void setTexture(int binding, uint32_t textureId, GLenum access, GLenum format, bool layered = false, int mipLevel = 0);
 
+	void setTexture(const std::string& name, int binding, unsigned int textureId, bool layered = false);
+
+	void setTextureCube(const std::string& name, int binding, unsigned int textureId);
+
 	void setBuffer(int binding, uint32_t bufferId);
 
 	void setAtomicCounterBuffer(int binding, uint32_t bufferId);
@@ -112,8 +127,12 @@ public:
 
 	void setVec4(const std::string& name, float* val, int count = 1);
 
+	void setMat4(const std::string& name, float* data);
+
 	void dispatch(uint32_t workGroupX, uint32_t workGroupY, uint32_t workGroupZ) const;
 
+	void dispatchIndirect(uint32_t bufferId, uint32_t offset) const;
+
 	void bind() const { glUseProgram(handle_); }
 
 	void unbind() const { glUseProgram(0); }
@@ -7,7 +7,7 @@
 #include <map>
 
 namespace GpuProfiler {
-	static const uint32_t QUERY_COUNT = 64;
+	static const uint32_t QUERY_COUNT = 128;
 	GLuint queries[QUERY_COUNT];
 
 	struct QueryRange {
@@ -0,0 +1,132 @@
+#include "job-system.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace JobSystem {
+	struct Job {
+		std::function<void()> task;
+		Context* context;
+	};
+
+	static std::vector<std::thread> gWorkers;
+	static std::deque<Job> gQueue;
+	static std::mutex gQueueMutex;
+	static std::condition_variable gWakeCondition;
+	static bool gShutdown = false;
+
+	// Oldest queued job of context
+	static bool PopJob(const Context& context, Job* job)
+	{
+		std::lock_guard<std::mutex> lock(gQueueMutex);
+		auto it = std::find_if(gQueue.begin(), gQueue.end(), [&context](const Job& queued) { return queued.context == &context; });
+		if (it == gQueue.end()) return false;
+		*job = std::move(*it);
+		gQueue.erase(it);
+		return true;
+	}
+
+	static void RunJob(Job& job)
+	{
+		job.task();
+		job.context->counter.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	static void WorkerLoop()
+	{
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(gQueueMutex);
+				gWakeCondition.wait(lock, [] { return gShutdown || !gQueue.empty(); });
+				if (gShutdown && gQueue.empty()) return;
+				job = std::move(gQueue.front());
+				gQueue.pop_front();
+			}
+			RunJob(job);
+		}
+	}
+
+	void Initialize(uint32_t threadCount)
+	{
+		if (threadCount == 0) {
+			// hardware_concurrency is allowed to return 0 when it is unknown
+			uint32_t hardwareThreads = std::thread::hardware_concurrency();
+			threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+		}
+
+		gShutdown = false;
+		for (uint32_t i = 0; i < threadCount; ++i)
+			gWorkers.emplace_back(WorkerLoop);
+
+		logger::Debug("Initialized JobSystem with " + std::to_string(threadCount) + " workers ...");
+	}
+
+	uint32_t GetThreadCount()
+	{
+		return (uint32_t)gWorkers.size();
+	}
+
+	void Execute(Context& context, std::function<void()> job)
+	{
+		context.counter.fetch_add(1, std::memory_order_relaxed);
+		{
+			std::lock_guard<std::mutex> lock(gQueueMutex);
+			gQueue.push_back(Job{ std::move(job), &context });
+		}
+		gWakeCondition.notify_one();
+	}
+
+	void Dispatch(Context& context, uint32_t jobCount, uint32_t groupSize, std::function<void(uint32_t)> job)
+	{
+		if (jobCount == 0 || groupSize == 0) return;
+
+		uint32_t groupCount = (jobCount + groupSize - 1) / groupSize;
+		context.counter.fetch_add(groupCount, std::memory_order_relaxed);
+		{
+			std::lock_guard<std::mutex> lock(gQueueMutex);
+			for (uint32_t group = 0; group < groupCount; ++group) {
+				uint32_t begin = group * groupSize;
+				uint32_t end = std::min(begin + groupSize, jobCount);
+				gQueue.push_back(Job{ [job, begin, end]() {
+					for (uint32_t i = begin; i < end; ++i)
+						job(i);
+				}, &context });
+			}
+		}
+		gWakeCondition.notify_all();
+	}
+
+	bool IsBusy(const Context& context)
+	{
+		return context.counter.load(std::memory_order_acquire) > 0;
+	}
+
+	void Wait(const Context& context)
+	{
+		while (IsBusy(context)) {
+			Job job;
+			if (PopJob(context, &job))
+				RunJob(job);
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	void Shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(gQueueMutex);
+			gShutdown = true;
+		}
+		gWakeCondition.notify_all();
+		for (auto& worker : gWorkers)
+			worker.join();
+		gWorkers.clear();
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+/*
+* Fixed pool of worker threads pulling from one shared queue. A Context
+* counts the jobs still in flight so a caller can wait on its own batch.
+*/
+namespace JobSystem {
+	struct Context {
+		std::atomic<uint32_t> counter{ 0 };
+	};
+
+	// threadCount = 0 uses hardware concurrency - 1
+	void Initialize(uint32_t threadCount = 0);
+
+	uint32_t GetThreadCount();
+
+	void Execute(Context& context, std::function<void()> job);
+
+	// Runs job(index) for index in [0, jobCount), groupSize indices per queued job
+	void Dispatch(Context& context, uint32_t jobCount, uint32_t groupSize, std::function<void(uint32_t)> job);
+
+	bool IsBusy(const Context& context);
+
+	// The calling thread helps with the queued jobs of context while waiting, never
+	// with other batches, so a per frame wait does not pick up e.g. a whole file parse
+	void Wait(const Context& context);
+
+	void Shutdown();
+}
@@ -6,11 +6,21 @@
 #include "mesh.h"
 #include "debug-draw.h"
 #include "gpu-query.h"
+#include "job-system.h"
 
 #include "voxel-raytracing/voxelizer.h"
+#include "voxel-raytracing/tiled-cone-trace.h"
+#include "voxel-raytracing/specular-pass.h"
 #include <iostream>
 
 #include "depth-prepass.h"
+#include "point-shadow-map.h"
+#include "async-mesh-loader.h"
+#include "cluster-culler.h"
+#include "cpu-culler.h"
+#include "scene-geometry.h"
+#include "scene-bvh.h"
+#include "texture-cache.h"
 
 struct WindowProps {
 	GLFWwindow* window;
@@ -34,6 +44,8 @@ WindowProps gWindowProps = {
 
 uint32_t gFBOWidth = 1920;
 uint32_t gFBOHeight = 1080;
+// Scene meshes use the 16 byte quantized vertex layout, reordered indices and LODs
+MeshLoadOptions gMeshLoadOptions = { true, true, true };
 
 static void on_window_resize(GLFWwindow* window, int width, int height) {
 	gWindowProps.width = std::max(width, 2);
@@ -130,31 +142,41 @@ bool AddGameObjectUI(Scene* scene) {
 	return needUpdate;
 }
 */
-void InitializeCornellBoxScene(Scene* scene) {
+void InitializeCornellBoxScene(Scene* scene, AsyncMeshLoader* loader) {
 	scene->lightPosition = glm::vec3(0.0f, 1.0f, -.5f);
 	scene->camera->SetPosition(glm::vec3(0.0f, 1.0f, 2.0f));
-	scene->meshGroup.push_back(MeshGroup{});
-	MeshGroup& cornellBox = scene->meshGroup.back();
-	LoadMesh("C:/Users/Dell/OneDrive/Documents/3D-Assets/Models/cornell-box/cornell-dragon2.gltf", &cornellBox);
-
-	for (uint32_t i = 0; i < cornellBox.names.size(); ++i) {
-		if (cornellBox.names[i] == "light") {
-			scene->lightPosition = glm::vec3(cornellBox.transforms[i] * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-			break;
-		}
-		else if (cornellBox.names[i] == "dragon") {
-			cornellBox.materials[i].metallic = 0.5f;
-			cornellBox.materials[i].roughness = 0.1f;
+	loader->LoadMesh("C:/Users/Dell/OneDrive/Documents/3D-Assets/Models/cornell-box/cornell-dragon2.gltf", [](Scene* scene, MeshGroup* cornellBox) {
+		for (uint32_t i = 0; i < cornellBox->names.size(); ++i) {
+			if (cornellBox->names[i] == "light") {
+				scene->lightPosition = glm::vec3(cornellBox->transforms[i] * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+				break;
+			}
+			else if (cornellBox->names[i] == "dragon") {
+				cornellBox->materials[i].metallic = 0.5f;
+				cornellBox->materials[i].roughness = 0.1f;
+			}
 		}
-	}
+	}, gMeshLoadOptions);
 }
 
-void InitializeSponzaScene(Scene* scene) {
+void InitializeSponzaScene(Scene* scene, AsyncMeshLoader* loader) {
 	scene->lightPosition = glm::vec3(0.0f, 10.0f, -.5f);
 	scene->camera->SetPosition(glm::vec3(0.0f, 1.0f, 2.0f));
-	scene->meshGroup.push_back(MeshGroup{});
-	MeshGroup& sponza = scene->meshGroup.back();
-	LoadMesh("C:/Users/Dell/OneDrive/Documents/3D-Assets/Models/sponza/sponza.gltf", &sponza);
+	loader->LoadMesh("C:/Users/Dell/OneDrive/Documents/3D-Assets/Models/sponza/sponza.gltf", nullptr, gMeshLoadOptions);
+}
+
+// Buggy reuses meshes from many nodes, every instance becomes its own draw sharing one
+// index range. Covers buffers sized per meshlet rather than per index, e.g. voxelizer triangle culling
+void InitializeInstancedScene(Scene* scene, AsyncMeshLoader* loader) {
+	InitializeCornellBoxScene(scene, loader);
+	loader->LoadMesh("C:/Users/Dell/OneDrive/Documents/3D-Assets/Models/buggy/Buggy.gltf", [](Scene* scene, MeshGroup* buggy) {
+		// Runs before AddDraws, the pool totals do not include the buggy yet
+		uint32_t meshletIndices = 0;
+		for (const Meshlet& meshlet : buggy->meshlets)
+			meshletIndices += meshlet.indexCount;
+		logger::Debug("Instanced scene: " + std::to_string(buggy->drawCommands.size()) + " draws, " +
+			std::to_string(meshletIndices) + " meshlet indices");
+	}, gMeshLoadOptions);
 }
 
 int main() {
@@ -198,33 +220,74 @@ int main() {
 	DebugDraw::Initialize();
 	ImGuiService::Initialize(window);
 	GpuProfiler::Initialize();
+	JobSystem::Initialize();
 
 	float startTime = (float)glfwGetTime();
 	float dt = 1.0f / 60.0f;
 
 	gCamera.SetAspect(float(gWindowProps.width) / float(gWindowProps.height));
 	gCamera.SetNearPlane(0.1f);
+	SceneGeometry sceneGeometry;
+	TextureCache textureCache;
+	textureCache.Initialize();
 	Scene scene;
 	scene.camera = &gCamera;
+	scene.geometry = &sceneGeometry;
+	scene.textures = &textureCache;
 
-	InitializeCornellBoxScene(&scene);
+	AsyncMeshLoader meshLoader;
+	meshLoader.Initialize();
+	InitializeCornellBoxScene(&scene, &meshLoader);
 
 	Voxelizer voxelizer;
 	voxelizer.Init(64, 0.1f);
 
-	TextureCreateInfo colorAttachment = { gFBOWidth, gFBOHeight };
+	PointShadowMap pointShadowMap;
+	pointShadowMap.Initialize(512);
+
+	TextureCreateInfo colorAttachment = { gFBOWidth, gFBOHeight, 1, GL_RGBA, GL_RGBA16F, GL_TEXTURE_2D, GL_FLOAT };
+	TextureCreateInfo materialAttachment = { gFBOWidth, gFBOHeight, 1, GL_RGBA, GL_RGBA16F, GL_TEXTURE_2D, GL_FLOAT };
 	TextureCreateInfo depthAttachment;
 	InitializeDepthTexture(&depthAttachment, gFBOWidth, gFBOHeight);
 
 	DepthPrePass depthPrePass;
 	depthPrePass.Initialize(gFBOWidth, gFBOHeight);
 
+	ClusterCuller clusterCuller;
+	clusterCuller.Initialize(gFBOWidth, gFBOHeight);
+
+	CpuCuller cpuCuller;
+	cpuCuller.Initialize();
+
 	GLFramebuffer mainFBO;
-	mainFBO.init({ Attachment{ 0, &colorAttachment } }, depthPrePass.GetDepthAttachment());
+	mainFBO.init({ Attachment{ 0, &colorAttachment }, Attachment{ 1, &materialAttachment } }, depthPrePass.GetDepthAttachment());
 
 	GLProgram mainProgram;
 	mainProgram.init(GLShader("Assets/Shaders/mesh.vert"), GLShader("Assets/Shaders/mesh.frag"));
 
+	TiledConeTrace tiledConeTrace;
+	tiledConeTrace.Initialize(gFBOWidth, gFBOHeight);
+
+	SpecularPass specularPass;
+	specularPass.Initialize(gFBOWidth, gFBOHeight);
+
+	// HDR color, indirect diffuse and tonemapping are resolved into the final texture
+	TextureCreateInfo outputTextureCreateInfo = { gFBOWidth, gFBOHeight };
+	GLTexture outputTexture;
+	outputTexture.init(&outputTextureCreateInfo);
+
+	GLComputeProgram resolveProgram;
+	resolveProgram.init(GLShader("Assets/Shaders/resolve.comp"));
+
+	SceneBVH sceneBVH;
+	// Ctrl + click in the viewport picks the nearest draw bounds under the cursor
+	bool hasPick = false;
+	RayHit pick = {};
+	std::vector<RayHit> pickHits;
+	bool wasEditing = false;
+	// Voxels keep the fallback material colors until the textures that arrived are injected
+	bool texturesArrived = false;
+
 	bool wireframeMode = false;
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
@@ -238,12 +301,61 @@ int main() {
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
 		GpuProfiler::Begin("Total Time GPU");
-		// Voxelizer Pass
-		voxelizer.Generate(&scene);
+		// Streamed groups are voxelized incrementally as they land, existing voxels keep
+		// their light injection until one full regeneration once streaming has settled
+		bool wasLoading = !meshLoader.IsIdle();
+		std::vector<uint32_t> publishedGroups;
+		meshLoader.Update(&scene, publishedGroups);
+		texturesArrived |= textureCache.Update();
+		for (uint32_t groupIndex : publishedGroups)
+			voxelizer.VoxelizeMeshGroup(groupIndex);
+		if (!publishedGroups.empty())
+			pointShadowMap.Invalidate();
+
+		// Edited nodes only upload the draws below them and revoxelize the region they
+		// moved through, lighting elsewhere is refreshed by one full regeneration once edits stop.
+		// Dynamic groups of hybrid volumes are voxelized every frame and never touch the static layer
+		bool isEditing = false;
+		for (auto& meshGroup : scene.meshGroup) {
+			meshGroup.updateHierarchy();
+			if (meshGroup.isDynamic && voxelizer.hybridVolumes)
+				continue;
+			for (const AABB& bounds : meshGroup.changedBounds)
+				voxelizer.InvalidateBounds(bounds);
+			if (!meshGroup.changedBounds.empty() && !meshGroup.isDynamic)
+				pointShadowMap.Invalidate();
+			isEditing |= !meshGroup.changedBounds.empty();
+		}
+		sceneBVH.Update(&scene);
+		if (wasEditing && !isEditing)
+			voxelizer.mRegenerateVoxelData = true;
+		wasEditing = isEditing;
+
+		// Light injection visibility, static casters are only redrawn when the light moves,
+		// dynamic casters re-inject every frame. Hybrid volumes light the static layer with static casters only
+		bool shadowMapChanged = pointShadowMap.Render(&scene);
+		if (voxelizer.hybridVolumes)
+			shadowMapChanged = pointShadowMap.StaticChanged();
+		if ((shadowMapChanged && publishedGroups.empty() && !isEditing) || (wasLoading && meshLoader.IsIdle()))
+			voxelizer.mRegenerateVoxelData = true;
+		// Like meshes, one regeneration once the texture burst has drained
+		if (texturesArrived && textureCache.IsIdle()) {
+			voxelizer.mRegenerateVoxelData = true;
+			texturesArrived = false;
+		}
 
-		// Depth Prepass
-		if(!voxelizer.enableDebugVoxel)
-			depthPrePass.Render(&scene);
+		// Voxelizer Pass
+		voxelizer.Generate(&scene, &pointShadowMap, &clusterCuller, &sceneBVH);
+
+		// Depth Prepass, the main pass draws the same culled stream so GL_EQUAL still matches
+		if (!voxelizer.enableDebugVoxel) {
+			if (cpuCuller.enabled)
+				cpuCuller.Cull(&scene, gCamera.frustumPlanes.data());
+			else
+				clusterCuller.CullCamera(&scene);
+			depthPrePass.Render(&scene, &clusterCuller, &cpuCuller);
+			clusterCuller.BuildHiZ(&gCamera, depthPrePass.GetDepthAttachment());
+		}
 
 		// Main Pass
 		if (wireframeMode) 
@@ -251,7 +363,7 @@ int main() {
 		else
 			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-		GpuProfiler::Begin("Final Pass");
+		GpuProfiler::Begin(std::string("Final Pass (") + GetGIModeName(voxelizer.giMode) + ")");
 		mainFBO.bind();
 		mainFBO.setClearColor(0.3f, 0.3f, 0.3f, 1.0f);
 		mainFBO.setViewport(gFBOWidth, gFBOHeight);
@@ -270,30 +382,75 @@ int main() {
 				mainProgram.bind();
 				mainProgram.setMat4("uVP", &VP[0][0]);
 				mainProgram.setTexture("uVolumeTexture", 0, voxelizer.voxelTexture->handle, true);
+				mainProgram.setTexture("uOccupancyTexture", 1, voxelizer.occupancyTexture->handle, true);
+				mainProgram.setInt("uGIMode", (int)voxelizer.giMode);
+				mainProgram.setVec3("uAmbientColor", &voxelizer.ambientColor[0]);
+				mainProgram.setInt("uShadowMode", (int)voxelizer.shadowMode);
+				mainProgram.setInt("uShadowMaxSteps", voxelizer.shadowMaxSteps);
+				mainProgram.setFloat("uShadowConeAperture", voxelizer.shadowConeAperture);
 				glm::vec3 voxelDim{ (float)voxelizer.mVoxelDims, (float)voxelizer.mUnitVoxelSize, voxelizer.mDebugMipInterpolation };
 				mainProgram.setVec3("uVoxelDims", &voxelDim[0]);
 
-				glm::vec3 cameraPosition = gCamera.GetPosition();
-				mainProgram.setVec3("uCameraPosition", &cameraPosition[0]);
 				mainProgram.setVec3("uLightPosition", &scene.lightPosition[0]);
-				for (auto& meshGroup : scene.meshGroup)
-					meshGroup.Draw(&mainProgram);
+				mainProgram.setInt("uTiledConeTrace", tiledConeTrace.enabled);
+				mainProgram.setBuffer(4, textureCache.GetHandleBuffer());
+				if (cpuCuller.enabled)
+					cpuCuller.Draw(&scene, &mainProgram);
+				else
+					clusterCuller.Draw(CullView::Camera, &scene, &mainProgram);
 				mainProgram.unbind();
 				glDepthMask(GL_TRUE);
 			}
 		}
+		if (hasPick) {
+			const MeshGroup& meshGroup = scene.meshGroup[pick.draw.group];
+			AABB bounds = TransformAABB(meshGroup.aabbs[pick.draw.draw], meshGroup.transforms[pick.draw.draw]);
+			DebugDraw::AddRect(bounds.min, bounds.max, { 1.0f, 1.0f, 0.0f });
+		}
 		DebugDraw::Render(VP);
 		mainFBO.unbind();
 		GpuProfiler::End();
 
+		bool addIndirect = tiledConeTrace.enabled && !voxelizer.enableDebugVoxel;
+		if (addIndirect)
+			tiledConeTrace.Render(&gCamera, &voxelizer, mainFBO.depthAttachment, mainFBO.attachments[1]);
+
+		// AO mode only traces opacity, reflections need the radiance volume
+		bool addSpecular = !voxelizer.enableDebugVoxel && voxelizer.giMode == GIMode::Radiance;
+		if (addSpecular)
+			specularPass.Render(&gCamera, &voxelizer, mainFBO.depthAttachment, mainFBO.attachments[1]);
+
+		GpuProfiler::Begin("Resolve");
+		resolveProgram.bind();
+		resolveProgram.setInt("uAddIndirect", addIndirect);
+		resolveProgram.setInt("uAddSpecular", addSpecular);
+		resolveProgram.setInt("uTonemap", !voxelizer.enableDebugVoxel);
+		resolveProgram.setTexture(0, mainFBO.attachments[0], GL_READ_ONLY, GL_RGBA16F);
+		resolveProgram.setTexture(1, tiledConeTrace.GetIndirectTexture(), GL_READ_ONLY, GL_RGBA16F);
+		resolveProgram.setTexture(2, specularPass.GetSpecularTexture(), GL_READ_ONLY, GL_RGBA16F);
+		resolveProgram.setTexture(3, outputTexture.handle, GL_WRITE_ONLY, outputTexture.internalFormat);
+		resolveProgram.dispatch((gFBOWidth + 7) / 8, (gFBOHeight + 7) / 8, 1);
+		resolveProgram.unbind();
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+		GpuProfiler::End();
+
 		ImGui::Begin("MainWindow");
 
 		MoveCamera(dt, ImGui::IsWindowFocused());
 		ImVec2 dims = ImGui::GetContentRegionAvail();
 		ImVec2 pos = ImGui::GetCursorScreenPos();
 
+		if (ImGui::IsWindowFocused() && ImGui::GetIO().KeyCtrl && ImGui::IsMouseClicked(0)) {
+			ImVec2 mouse = ImGui::GetMousePos();
+			glm::vec2 ndc{ (mouse.x - pos.x) / dims.x * 2.0f - 1.0f, 1.0f - (mouse.y - pos.y) / dims.y * 2.0f };
+			Ray ray{ gCamera.GetPosition(), Utils::GetRayDir(gCamera.GetProjectionMatrix(), gCamera.GetViewMatrix(), ndc) };
+			hasPick = sceneBVH.RayCast(ray, pick);
+			pickHits.clear();
+			sceneBVH.RayCastAll(ray, pickHits);
+		}
+
 		ImGui::GetWindowDrawList()->AddImage(
-			(ImTextureID)(uint64_t)mainFBO.attachments[0],
+			(ImTextureID)(uint64_t)outputTexture.handle,
 			ImVec2(pos.x, pos.y),
 			ImVec2(pos.x + dims.x, pos.y + dims.y),
 			ImVec2(0, 1),
@@ -311,7 +468,19 @@ int main() {
 		//voxelizer.mRegenerateVoxelData = needUpdate;
 		GpuProfiler::AddUI();
 		ImGui::Checkbox("Wireframe", &wireframeMode);
-
+		ImGui::DragFloat3("Light Position", &scene.lightPosition[0], 0.05f);
+
+		meshLoader.AddUI();
+		sceneGeometry.AddUI();
+		sceneBVH.AddUI();
+		if (hasPick)
+			ImGui::Text("Picked: group %d draw %d at %.2f, %d draws under cursor", pick.draw.group, pick.draw.draw, pick.t, (uint32_t)pickHits.size());
+		textureCache.AddUI();
+		pointShadowMap.AddUI(&scene);
+		clusterCuller.AddUI();
+		cpuCuller.AddUI();
+		tiledConeTrace.AddUI();
+		specularPass.AddUI();
 		voxelizer.AddUI();
 		ImGui::End();
 
@@ -330,10 +499,21 @@ int main() {
 		gWindowProps.mDx = 0.0f;
 		gWindowProps.mDy = 0.0f;
 	}
+	meshLoader.Destroy();
+	sceneGeometry.Destroy();
+	textureCache.Destroy();
+	clusterCuller.Destroy();
+	cpuCuller.Destroy();
 	mainProgram.destroy();
+	resolveProgram.destroy();
+	outputTexture.destroy();
+	tiledConeTrace.Destroy();
+	specularPass.Destroy();
+	pointShadowMap.Destroy();
 	mainFBO.destroy();
 	DebugDraw::Shutdown();
 	ImGuiService::Shutdown();
+	JobSystem::Shutdown();
 
 	glfwDestroyWindow(window);
 	glfwTerminate();
@@ -0,0 +1,429 @@
+#include "mesh-cache.h"
+
+#include "mesh.h"
+#include "scene-geometry.h"
+#include "texture-cache.h"
+#include "logger.h"
+#include "utils.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace MeshCache {
+	static const uint32_t MESH_CACHE_MAGIC = 0x434D5856; // VXMC
+	static const uint32_t MESH_CACHE_VERSION = 9;
+	static const uint64_t CHUNK_ALIGNMENT = 16;
+
+	enum ChunkId : uint32_t {
+		CHUNK_VERTICES = 0,
+		CHUNK_INDICES,
+		CHUNK_TRANSFORMS,
+		CHUNK_AABBS,
+		CHUNK_DRAW_COMMANDS,
+		CHUNK_MATERIALS,
+		// uint32_t length followed by the characters, per draw
+		CHUNK_NAMES,
+		// External files the source references (.bin buffers), a Signature
+		// followed by the uint32_t length and the path relative to the source
+		CHUNK_DEPENDENCIES,
+		CHUNK_DEQUANTIZATION,
+		CHUNK_MESHLETS,
+		CHUNK_LODS,
+		CHUNK_TEXTURES,
+		// TransformNode per hierarchy node, then the node of every draw
+		CHUNK_NODES,
+		CHUNK_DRAW_NODES,
+		// VertexStream::Position
+		CHUNK_POSITIONS,
+		CHUNK_COUNT
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceTimestamp;
+		uint64_t sourceHash;
+		uint32_t chunkCount;
+		// MeshLoadOptions::GetFlags of the load that produced the cache
+		uint32_t optionFlags;
+	};
+
+	struct Signature {
+		uint64_t timestamp;
+		uint64_t hash;
+	};
+
+	struct Chunk {
+		uint32_t id;
+		uint32_t elementSize;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	struct MappedFile {
+		const uint8_t* data = nullptr;
+		uint64_t size = 0;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#else
+		int file = -1;
+#endif
+	};
+
+	static void UnmapFile(MappedFile* mappedFile)
+	{
+#ifdef _WIN32
+		if (mappedFile->data) UnmapViewOfFile(mappedFile->data);
+		if (mappedFile->mapping) CloseHandle(mappedFile->mapping);
+		if (mappedFile->file != INVALID_HANDLE_VALUE) CloseHandle(mappedFile->file);
+#else
+		if (mappedFile->data) munmap((void*)mappedFile->data, mappedFile->size);
+		if (mappedFile->file >= 0) close(mappedFile->file);
+#endif
+		*mappedFile = MappedFile{};
+	}
+
+	static bool MapFile(const std::string& filename, MappedFile* mappedFile)
+	{
+#ifdef _WIN32
+		mappedFile->file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (mappedFile->file == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(mappedFile->file, &fileSize) && fileSize.QuadPart > 0) {
+			mappedFile->size = (uint64_t)fileSize.QuadPart;
+			mappedFile->mapping = CreateFileMappingA(mappedFile->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mappedFile->mapping != nullptr)
+				mappedFile->data = (const uint8_t*)MapViewOfFile(mappedFile->mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+#else
+		mappedFile->file = open(filename.c_str(), O_RDONLY);
+		if (mappedFile->file < 0) return false;
+
+		struct stat fileStat;
+		if (fstat(mappedFile->file, &fileStat) == 0 && fileStat.st_size > 0) {
+			mappedFile->size = (uint64_t)fileStat.st_size;
+			void* data = mmap(nullptr, mappedFile->size, PROT_READ, MAP_PRIVATE, mappedFile->file, 0);
+			mappedFile->data = data == MAP_FAILED ? nullptr : (const uint8_t*)data;
+		}
+#endif
+		if (mappedFile->data == nullptr) {
+			// Releases whatever handles were opened before the failure
+			UnmapFile(mappedFile);
+			return false;
+		}
+		return true;
+	}
+
+	// FNV-1a
+	static uint64_t HashBytes(const uint8_t* data, uint64_t size)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (uint64_t i = 0; i < size; ++i) {
+			hash ^= data[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static bool GetSignature(const std::string& filename, Signature* signature)
+	{
+		std::error_code error;
+		auto writeTime = std::filesystem::last_write_time(filename, error);
+		if (error) return false;
+		signature->timestamp = (uint64_t)writeTime.time_since_epoch().count();
+
+		MappedFile source;
+		if (!MapFile(filename, &source)) return false;
+		signature->hash = HashBytes(source.data, source.size);
+		UnmapFile(&source);
+		return true;
+	}
+
+	static std::string ResolveDependency(const std::string& sourceFile, const std::string& dependency)
+	{
+		return (std::filesystem::path(sourceFile).parent_path() / dependency).string();
+	}
+
+	// Walks the dependency chunk, false if it is malformed or any file changed
+	static bool ValidateDependencies(const std::string& sourceFile, const uint8_t* data, const uint8_t* end)
+	{
+		while (data < end) {
+			if ((uint64_t)(end - data) < sizeof(Signature) + sizeof(uint32_t)) return false;
+			Signature stored;
+			std::memcpy(&stored, data, sizeof(Signature));
+			data += sizeof(Signature);
+			uint32_t length;
+			std::memcpy(&length, data, sizeof(uint32_t));
+			data += sizeof(uint32_t);
+			if ((uint64_t)(end - data) < length) return false;
+
+			std::string dependency(reinterpret_cast<const char*>(data), length);
+			data += length;
+
+			Signature current;
+			if (!GetSignature(ResolveDependency(sourceFile, dependency), &current)) return false;
+			if (current.timestamp != stored.timestamp || current.hash != stored.hash) return false;
+		}
+		return true;
+	}
+
+	std::string GetCachePath(const std::string& sourceFile)
+	{
+		return sourceFile + ".vxcache";
+	}
+
+	template<typename T>
+	static void CopyChunk(const MappedFile& file, const Chunk& chunk, std::vector<T>& output)
+	{
+		const T* begin = reinterpret_cast<const T*>(file.data + chunk.offset);
+		output.assign(begin, begin + chunk.size / sizeof(T));
+	}
+
+	// Maps the cache and checks it against the source and its dependencies
+	static bool MapValidCache(const std::string& sourceFile, const MeshLoadOptions& options, MappedFile* file, const Chunk** chunks)
+	{
+		Signature signature;
+		if (!GetSignature(sourceFile, &signature)) return false;
+
+		std::string cachePath = GetCachePath(sourceFile);
+		if (!MapFile(cachePath, file)) return false;
+
+		const Header* header = reinterpret_cast<const Header*>(file->data);
+		bool valid = file->size >= sizeof(Header) &&
+			header->magic == MESH_CACHE_MAGIC &&
+			header->version == MESH_CACHE_VERSION &&
+			header->sourceTimestamp == signature.timestamp &&
+			header->sourceHash == signature.hash &&
+			header->chunkCount == CHUNK_COUNT &&
+			header->optionFlags == options.GetFlags() &&
+			file->size >= sizeof(Header) + sizeof(Chunk) * CHUNK_COUNT;
+
+		*chunks = reinterpret_cast<const Chunk*>(file->data + sizeof(Header));
+		for (uint32_t i = 0; valid && i < CHUNK_COUNT; ++i)
+			valid = (*chunks)[i].id == i && (*chunks)[i].offset + (*chunks)[i].size <= file->size;
+
+		if (valid) {
+			const uint8_t* dependencies = file->data + (*chunks)[CHUNK_DEPENDENCIES].offset;
+			valid = ValidateDependencies(sourceFile, dependencies, dependencies + (*chunks)[CHUNK_DEPENDENCIES].size);
+		}
+
+		if (!valid) {
+			logger::Warn("Mesh cache is stale, rebuilding: " + cachePath);
+			UnmapFile(file);
+			return false;
+		}
+		return true;
+	}
+
+	// Length prefixed strings
+	static std::vector<uint8_t> WriteStringTable(const std::vector<std::string>& strings)
+	{
+		std::vector<uint8_t> table;
+		for (auto& string : strings) {
+			uint32_t length = (uint32_t)string.size();
+			table.insert(table.end(), (uint8_t*)&length, (uint8_t*)&length + sizeof(uint32_t));
+			table.insert(table.end(), string.begin(), string.end());
+		}
+		return table;
+	}
+
+	static void ReadStringTable(const MappedFile& file, const Chunk& chunk, std::vector<std::string>& strings)
+	{
+		const uint8_t* data = file.data + chunk.offset;
+		const uint8_t* end = data + chunk.size;
+		while ((uint64_t)(end - data) >= sizeof(uint32_t)) {
+			uint32_t length;
+			std::memcpy(&length, data, sizeof(uint32_t));
+			data += sizeof(uint32_t);
+			if ((uint64_t)(end - data) < length) {
+				logger::Warn("Truncated string table in mesh cache");
+				break;
+			}
+			strings.emplace_back(reinterpret_cast<const char*>(data), length);
+			data += length;
+		}
+	}
+
+	// Everything except the vertex and index blobs
+	static void ReadMetadata(const std::string& sourceFile, const MappedFile& file, const Chunk* chunks, const MeshLoadOptions& options, MeshGroup* meshGroup)
+	{
+		meshGroup->vertexFormat = options.quantizeVertices ? VertexFormat::Quantized : VertexFormat::Float;
+		meshGroup->indexType = chunks[CHUNK_INDICES].elementSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		CopyChunk(file, chunks[CHUNK_DEQUANTIZATION], meshGroup->dequantization);
+		CopyChunk(file, chunks[CHUNK_TRANSFORMS], meshGroup->transforms);
+		CopyChunk(file, chunks[CHUNK_AABBS], meshGroup->aabbs);
+		CopyChunk(file, chunks[CHUNK_DRAW_COMMANDS], meshGroup->drawCommands);
+		CopyChunk(file, chunks[CHUNK_MATERIALS], meshGroup->materials);
+		CopyChunk(file, chunks[CHUNK_MESHLETS], meshGroup->meshlets);
+		CopyChunk(file, chunks[CHUNK_LODS], meshGroup->lods);
+		CopyChunk(file, chunks[CHUNK_DRAW_NODES], meshGroup->drawNodes);
+
+		// The world matrices are rebuilt, they match CHUNK_TRANSFORMS
+		std::vector<TransformNode> nodes;
+		CopyChunk(file, chunks[CHUNK_NODES], nodes);
+		for (auto& node : nodes)
+			meshGroup->hierarchy.AddNode(node.parent, node.translation, glm::quat(node.rotation.w, node.rotation.x, node.rotation.y, node.rotation.z), node.scale);
+		std::vector<uint32_t> changedNodes;
+		meshGroup->hierarchy.Update(changedNodes);
+
+		ReadStringTable(file, chunks[CHUNK_NAMES], meshGroup->names);
+
+		// Stored relative to the source so the asset folder can move
+		ReadStringTable(file, chunks[CHUNK_TEXTURES], meshGroup->textures);
+		for (auto& texture : meshGroup->textures)
+			texture = ResolveDependency(sourceFile, texture);
+	}
+
+	static void LogLoad(const std::string& sourceFile, const MeshGroup* meshGroup, const Chunk* chunks, float validateTime, float copyTime, float uploadTime)
+	{
+		logger::Debug("Loaded mesh cache: " + GetCachePath(sourceFile) + ": " + std::to_string(meshGroup->drawCommands.size()) + " draws, " +
+			std::to_string(chunks[CHUNK_VERTICES].size / chunks[CHUNK_VERTICES].elementSize) + " vertices, " +
+			std::to_string(chunks[CHUNK_INDICES].size / chunks[CHUNK_INDICES].elementSize) + " indices");
+		logger::Debug("  map + validate " + std::to_string(validateTime) + "ms, copy " + std::to_string(copyTime) +
+			"ms, upload " + std::to_string(uploadTime) + "ms");
+	}
+
+	bool Load(const std::string& sourceFile, Scene* scene, MeshGroup* meshGroup, const MeshLoadOptions& options)
+	{
+		Utils::Timer timer;
+		MappedFile file;
+		const Chunk* chunks = nullptr;
+		if (!MapValidCache(sourceFile, options, &file, &chunks)) return false;
+		float validateTime = timer.Lap();
+
+		ReadMetadata(sourceFile, file, chunks, options, meshGroup);
+		float copyTime = timer.Lap();
+
+		// Vertex and index blobs go to the GPU straight from the mapping
+		const Chunk& vertexChunk = chunks[CHUNK_VERTICES];
+		const Chunk& indexChunk = chunks[CHUNK_INDICES];
+		scene->textures->ResolveMaterials(meshGroup);
+		scene->geometry->Upload(meshGroup,
+			file.data + vertexChunk.offset, (uint32_t)vertexChunk.size,
+			file.data + chunks[CHUNK_POSITIONS].offset,
+			file.data + indexChunk.offset, (uint32_t)indexChunk.size);
+		float uploadTime = timer.Lap();
+
+		LogLoad(sourceFile, meshGroup, chunks, validateTime, copyTime, uploadTime);
+		UnmapFile(&file);
+		return true;
+	}
+
+	bool Read(const std::string& sourceFile, MeshGroup* meshGroup, MeshData* meshData, const MeshLoadOptions& options)
+	{
+		Utils::Timer timer;
+		MappedFile file;
+		const Chunk* chunks = nullptr;
+		if (!MapValidCache(sourceFile, options, &file, &chunks)) return false;
+		float validateTime = timer.Lap();
+
+		ReadMetadata(sourceFile, file, chunks, options, meshGroup);
+		CopyChunk(file, chunks[CHUNK_VERTICES], meshData->vertices);
+		CopyChunk(file, chunks[CHUNK_POSITIONS], meshData->positions);
+		CopyChunk(file, chunks[CHUNK_INDICES], meshData->indices);
+		float copyTime = timer.Lap();
+
+		LogLoad(sourceFile, meshGroup, chunks, validateTime, copyTime, 0.0f);
+		UnmapFile(&file);
+		return true;
+	}
+
+	void Write(const std::string& sourceFile, const std::vector<std::string>& dependencies, const MeshGroup* meshGroup, const MeshData& meshData, const MeshLoadOptions& options)
+	{
+		Header header = {};
+		header.magic = MESH_CACHE_MAGIC;
+		header.version = MESH_CACHE_VERSION;
+		header.chunkCount = CHUNK_COUNT;
+		header.optionFlags = options.GetFlags();
+		Signature signature;
+		if (!GetSignature(sourceFile, &signature)) return;
+		header.sourceTimestamp = signature.timestamp;
+		header.sourceHash = signature.hash;
+
+		std::vector<uint8_t> dependencyTable;
+		for (auto& dependency : dependencies) {
+			Signature dependencySignature;
+			if (!GetSignature(ResolveDependency(sourceFile, dependency), &dependencySignature)) {
+				logger::Warn("Skipping mesh cache, missing dependency: " + dependency);
+				return;
+			}
+			uint32_t length = (uint32_t)dependency.size();
+			dependencyTable.insert(dependencyTable.end(), (uint8_t*)&dependencySignature, (uint8_t*)&dependencySignature + sizeof(Signature));
+			dependencyTable.insert(dependencyTable.end(), (uint8_t*)&length, (uint8_t*)&length + sizeof(uint32_t));
+			dependencyTable.insert(dependencyTable.end(), dependency.begin(), dependency.end());
+		}
+
+		std::vector<uint8_t> names = WriteStringTable(meshGroup->names);
+		std::filesystem::path directory = std::filesystem::path(sourceFile).parent_path();
+		std::vector<std::string> relativeTextures;
+		for (auto& texture : meshGroup->textures)
+			relativeTextures.push_back(std::filesystem::path(texture).lexically_relative(directory).string());
+		std::vector<uint8_t> textures = WriteStringTable(relativeTextures);
+
+		std::vector<TransformNode> nodes;
+		for (uint32_t node = 0; node < meshGroup->hierarchy.GetNodeCount(); ++node)
+			nodes.push_back(meshGroup->hierarchy.GetNode(node));
+
+		struct ChunkData {
+			const void* data;
+			uint32_t elementSize;
+			uint64_t size;
+		};
+		ChunkData chunkData[CHUNK_COUNT] = {
+			{ meshData.vertices.data(), GetVertexSize(meshGroup->vertexFormat), meshData.vertices.size() },
+			{ meshData.indices.data(), GetIndexSize(meshGroup->indexType), meshData.indices.size() },
+			{ meshGroup->transforms.data(), sizeof(glm::mat4), meshGroup->transforms.size() * sizeof(glm::mat4) },
+			{ meshGroup->aabbs.data(), sizeof(AABB), meshGroup->aabbs.size() * sizeof(AABB) },
+			{ meshGroup->drawCommands.data(), sizeof(DrawElementsIndirectCommand), meshGroup->drawCommands.size() * sizeof(DrawElementsIndirectCommand) },
+			{ meshGroup->materials.data(), sizeof(Material), meshGroup->materials.size() * sizeof(Material) },
+			{ names.data(), 1, names.size() },
+			{ dependencyTable.data(), 1, dependencyTable.size() },
+			{ meshGroup->dequantization.data(), sizeof(PositionDequantization), meshGroup->dequantization.size() * sizeof(PositionDequantization) },
+			{ meshGroup->meshlets.data(), sizeof(Meshlet), meshGroup->meshlets.size() * sizeof(Meshlet) },
+			{ meshGroup->lods.data(), sizeof(DrawLods), meshGroup->lods.size() * sizeof(DrawLods) },
+			{ textures.data(), 1, textures.size() },
+			{ nodes.data(), sizeof(TransformNode), nodes.size() * sizeof(TransformNode) },
+			{ meshGroup->drawNodes.data(), sizeof(uint32_t), meshGroup->drawNodes.size() * sizeof(uint32_t) },
+			{ meshData.positions.data(), GetPositionSize(meshGroup->vertexFormat), meshData.positions.size() },
+		};
+
+		Chunk chunks[CHUNK_COUNT];
+		uint64_t offset = sizeof(Header) + sizeof(chunks);
+		for (uint32_t i = 0; i < CHUNK_COUNT; ++i) {
+			offset = (offset + CHUNK_ALIGNMENT - 1) & ~(CHUNK_ALIGNMENT - 1);
+			chunks[i] = Chunk{ i, chunkData[i].elementSize, offset, chunkData[i].size };
+			offset += chunkData[i].size;
+		}
+
+		std::string cachePath = GetCachePath(sourceFile);
+		std::ofstream outFile(cachePath, std::ios::binary | std::ios::trunc);
+		if (!outFile) {
+			logger::Warn("Failed to write mesh cache: " + cachePath);
+			return;
+		}
+
+		outFile.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		outFile.write(reinterpret_cast<const char*>(chunks), sizeof(chunks));
+		static const char ZERO_PADDING[CHUNK_ALIGNMENT] = {};
+		for (uint32_t i = 0; i < CHUNK_COUNT; ++i) {
+			uint64_t position = (uint64_t)outFile.tellp();
+			outFile.write(ZERO_PADDING, chunks[i].offset - position);
+			outFile.write(reinterpret_cast<const char*>(chunkData[i].data), chunkData[i].size);
+		}
+		logger::Debug("Written mesh cache: " + cachePath);
+	}
+}
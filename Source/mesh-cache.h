@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct MeshGroup;
+struct MeshData;
+struct Scene;
+struct MeshLoadOptions;
+
+/*
+* Versioned binary cache written next to a glTF asset on first load. Every
+* chunk is laid out exactly as it is uploaded, so a warm start maps the file
+* and hands the vertex and index blobs straight to the scene geometry pools.
+*/
+namespace MeshCache {
+	std::string GetCachePath(const std::string& sourceFile);
+
+	// Returns false if there is no cache or it is stale, meshGroup is untouched in that case
+	// A cache written with different load options counts as stale
+	// The group's textures are resolved and it is uploaded into the scene geometry
+	bool Load(const std::string& sourceFile, Scene* scene, MeshGroup* meshGroup, const MeshLoadOptions& options);
+
+	// CPU only variant of Load for worker threads, copies the vertex and index blobs out
+	bool Read(const std::string& sourceFile, MeshGroup* meshGroup, MeshData* meshData, const MeshLoadOptions& options);
+
+	// dependencies are external files the source references (glTF .bin buffers),
+	// relative to its directory. A change to any of them invalidates the cache.
+	void Write(const std::string& sourceFile, const std::vector<std::string>& dependencies, const MeshGroup* meshGroup, const MeshData& meshData, const MeshLoadOptions& options);
+}
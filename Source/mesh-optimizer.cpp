@@ -0,0 +1,656 @@
+#include "mesh-optimizer.h"
+
+#include "mesh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+namespace MeshOptimizer {
+
+	// Cache the Forsyth scores are tuned for, larger than the hardware FIFO on purpose
+	static const uint32_t kCacheSize = 32;
+
+	static float vertexScore(int cachePosition, uint32_t remaining) {
+		// Fully emitted vertices never pull triangles
+		if (remaining == 0) return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0) {
+			// The last triangle's vertices get a fixed score so it is not immediately reused
+			if (cachePosition < 3)
+				score = 0.75f;
+			else
+				score = std::pow(1.0f - float(cachePosition - 3) / float(kCacheSize - 3), 1.5f);
+		}
+		// Favour vertices with few triangles left so they leave the cache soon
+		return score + 2.0f / std::sqrt(float(remaining));
+	}
+
+	// Counts misses with timestamps instead of shifting a FIFO
+	struct CacheSimulator {
+		std::vector<uint32_t> timestamps;
+		uint32_t timestamp;
+		uint32_t cacheSize;
+
+		CacheSimulator(uint32_t vertexCount, uint32_t cacheSize) : timestamps(vertexCount, 0), cacheSize(cacheSize) {
+			timestamp = cacheSize + 1;
+		}
+
+		void Reset() {
+			// Every entry becomes older than the cache size
+			timestamp += cacheSize + 1;
+		}
+
+		uint32_t Triangle(const uint32_t* triangle) {
+			uint32_t misses = 0;
+			for (int k = 0; k < 3; ++k) {
+				uint32_t vertex = triangle[k];
+				if (timestamp - timestamps[vertex] > cacheSize) {
+					timestamps[vertex] = timestamp++;
+					misses++;
+				}
+			}
+			return misses;
+		}
+	};
+
+	float ComputeACMR(const uint32_t* indices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+	{
+		uint32_t triangleCount = indexCount / 3;
+		if (triangleCount == 0) return 0.0f;
+
+		CacheSimulator cache(vertexCount, cacheSize);
+		uint32_t misses = 0;
+		for (uint32_t i = 0; i < triangleCount; ++i)
+			misses += cache.Triangle(indices + i * 3);
+		return float(misses) / float(triangleCount);
+	}
+
+	void OptimizeVertexCache(uint32_t* indices, uint32_t indexCount, uint32_t vertexCount)
+	{
+		uint32_t triangleCount = indexCount / 3;
+		if (triangleCount == 0) return;
+
+		// Triangles adjacent to each vertex, emitted ones are swapped out of the list
+		std::vector<uint32_t> remaining(vertexCount, 0);
+		for (uint32_t i = 0; i < triangleCount * 3; ++i)
+			remaining[indices[i]]++;
+
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remaining[v];
+
+		std::vector<uint32_t> adjacency(triangleCount * 3);
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (uint32_t i = 0; i < triangleCount * 3; ++i)
+			adjacency[fill[indices[i]]++] = i / 3;
+
+		std::vector<int> cachePositions(vertexCount, -1);
+		std::vector<float> vertexScores(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			vertexScores[v] = vertexScore(-1, remaining[v]);
+
+		std::vector<float> triangleScores(triangleCount);
+		int bestTriangle = -1;
+		for (uint32_t t = 0; t < triangleCount; ++t) {
+			const uint32_t* triangle = indices + t * 3;
+			triangleScores[t] = vertexScores[triangle[0]] + vertexScores[triangle[1]] + vertexScores[triangle[2]];
+			if (bestTriangle < 0 || triangleScores[t] > triangleScores[bestTriangle])
+				bestTriangle = t;
+		}
+
+		std::vector<uint32_t> result(triangleCount * 3);
+		std::vector<uint8_t> emitted(triangleCount, 0);
+		uint32_t cache[kCacheSize + 3];
+		uint32_t cacheCount = 0;
+		uint32_t nextUnemitted = 0;
+
+		for (uint32_t output = 0; output < triangleCount; ++output) {
+			// Nothing in the cache has triangles left, continue with the next one in input order
+			if (bestTriangle < 0) {
+				while (emitted[nextUnemitted]) nextUnemitted++;
+				bestTriangle = nextUnemitted;
+			}
+
+			const uint32_t* triangle = indices + bestTriangle * 3;
+			emitted[bestTriangle] = 1;
+			std::copy(triangle, triangle + 3, result.begin() + output * 3);
+
+			for (int k = 0; k < 3; ++k) {
+				uint32_t vertex = triangle[k];
+				uint32_t* list = adjacency.data() + adjacencyOffsets[vertex];
+				uint32_t count = remaining[vertex];
+				for (uint32_t j = 0; j < count; ++j) {
+					if (list[j] == (uint32_t)bestTriangle) {
+						list[j] = list[count - 1];
+						break;
+					}
+				}
+				remaining[vertex]--;
+			}
+
+			// LRU update, the emitted triangle moves to the front
+			uint32_t newCache[kCacheSize + 3];
+			uint32_t newCount = 0;
+			for (int k = 0; k < 3; ++k) {
+				if (std::find(newCache, newCache + newCount, triangle[k]) == newCache + newCount)
+					newCache[newCount++] = triangle[k];
+			}
+			for (uint32_t i = 0; i < cacheCount; ++i) {
+				if (std::find(triangle, triangle + 3, cache[i]) == triangle + 3)
+					newCache[newCount++] = cache[i];
+			}
+
+			for (uint32_t i = 0; i < newCount; ++i) {
+				uint32_t vertex = newCache[i];
+				cachePositions[vertex] = i < kCacheSize ? (int)i : -1;
+				float score = vertexScore(cachePositions[vertex], remaining[vertex]);
+				float delta = score - vertexScores[vertex];
+				vertexScores[vertex] = score;
+
+				const uint32_t* list = adjacency.data() + adjacencyOffsets[vertex];
+				for (uint32_t j = 0; j < remaining[vertex]; ++j)
+					triangleScores[list[j]] += delta;
+			}
+
+			// Only triangles touching the cache changed, the best one is among them
+			bestTriangle = -1;
+			for (uint32_t i = 0; i < newCount && i < kCacheSize; ++i) {
+				uint32_t vertex = newCache[i];
+				const uint32_t* list = adjacency.data() + adjacencyOffsets[vertex];
+				for (uint32_t j = 0; j < remaining[vertex]; ++j) {
+					uint32_t t = list[j];
+					if (bestTriangle < 0 || triangleScores[t] > triangleScores[bestTriangle])
+						bestTriangle = t;
+				}
+			}
+
+			cacheCount = std::min(newCount, kCacheSize);
+			std::copy(newCache, newCache + cacheCount, cache);
+		}
+
+		std::copy(result.begin(), result.end(), indices);
+	}
+
+	void OptimizeOverdraw(uint32_t* indices, uint32_t indexCount, const Vertex* vertices, uint32_t vertexCount, float threshold)
+	{
+		uint32_t triangleCount = indexCount / 3;
+		if (triangleCount == 0) return;
+
+		// Hard boundaries where the cache optimizer had to start over, every vertex missed
+		std::vector<uint32_t> hardBoundaries;
+		CacheSimulator cache(vertexCount, 16);
+		for (uint32_t t = 0; t < triangleCount; ++t) {
+			if (cache.Triangle(indices + t * 3) == 3)
+				hardBoundaries.push_back(t);
+		}
+		if (hardBoundaries.empty() || hardBoundaries[0] != 0)
+			hardBoundaries.insert(hardBoundaries.begin(), 0);
+
+		// Soft boundaries split a hard cluster as soon as its prefix is within
+		// threshold of the cluster ACMR, the cache restarts with every cluster
+		std::vector<uint32_t> clusters;
+		for (uint32_t i = 0; i < hardBoundaries.size(); ++i) {
+			uint32_t start = hardBoundaries[i];
+			uint32_t end = i + 1 < hardBoundaries.size() ? hardBoundaries[i + 1] : triangleCount;
+
+			cache.Reset();
+			uint32_t clusterMisses = 0;
+			for (uint32_t t = start; t < end; ++t)
+				clusterMisses += cache.Triangle(indices + t * 3);
+			float clusterThreshold = threshold * float(clusterMisses) / float(end - start);
+
+			clusters.push_back(start);
+			cache.Reset();
+			uint32_t misses = 0, triangles = 0;
+			for (uint32_t t = start; t < end; ++t) {
+				misses += cache.Triangle(indices + t * 3);
+				triangles++;
+				if (t + 1 < end && float(misses) <= clusterThreshold * float(triangles)) {
+					clusters.push_back(t + 1);
+					cache.Reset();
+					misses = triangles = 0;
+				}
+			}
+		}
+
+		uint32_t clusterCount = (uint32_t)clusters.size();
+		if (clusterCount == 1) return;
+
+		// Area weighted centroid and normal of every cluster
+		std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f));
+		std::vector<glm::vec3> normals(clusterCount, glm::vec3(0.0f));
+		std::vector<float> areas(clusterCount, 0.0f);
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		for (uint32_t c = 0; c < clusterCount; ++c) {
+			uint32_t end = c + 1 < clusterCount ? clusters[c + 1] : triangleCount;
+			for (uint32_t t = clusters[c]; t < end; ++t) {
+				const glm::vec3& p0 = vertices[indices[t * 3 + 0]].position;
+				const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+				const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+				glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				float area = glm::length(normal);
+				centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+				normals[c] += normal;
+				areas[c] += area;
+			}
+			meshCentroid += centroids[c];
+			meshArea += areas[c];
+			centroids[c] /= std::max(areas[c], 1e-12f);
+		}
+		meshCentroid /= std::max(meshArea, 1e-12f);
+
+		// Clusters facing away from the center are likely in front of the rest
+		std::vector<float> sortKeys(clusterCount);
+		for (uint32_t c = 0; c < clusterCount; ++c) {
+			float length = glm::length(normals[c]);
+			glm::vec3 direction = length > 0.0f ? normals[c] / length : glm::vec3(0.0f);
+			sortKeys[c] = glm::dot(centroids[c] - meshCentroid, direction);
+		}
+
+		std::vector<uint32_t> order(clusterCount);
+		for (uint32_t c = 0; c < clusterCount; ++c)
+			order[c] = c;
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<uint32_t> result;
+		result.reserve(triangleCount * 3);
+		for (uint32_t c : order) {
+			uint32_t end = c + 1 < clusterCount ? clusters[c + 1] : triangleCount;
+			result.insert(result.end(), indices + clusters[c] * 3, indices + end * 3);
+		}
+		std::copy(result.begin(), result.end(), indices);
+	}
+
+	void OptimizeVertexFetch(Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount)
+	{
+		const uint32_t kUnused = ~0u;
+		std::vector<uint32_t> remap(vertexCount, kUnused);
+		uint32_t next = 0;
+		for (uint32_t i = 0; i < indexCount; ++i) {
+			uint32_t& vertex = remap[indices[i]];
+			if (vertex == kUnused)
+				vertex = next++;
+			indices[i] = vertex;
+		}
+		for (uint32_t v = 0; v < vertexCount; ++v) {
+			if (remap[v] == kUnused)
+				remap[v] = next++;
+		}
+
+		std::vector<Vertex> source(vertices, vertices + vertexCount);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			vertices[remap[v]] = source[v];
+	}
+
+	static Meshlet computeMeshletBounds(const uint32_t* indices, uint32_t firstIndex, uint32_t indexCount, const Vertex* vertices) {
+		glm::vec3 minExtent(FLT_MAX), maxExtent(-FLT_MAX);
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; ++i) {
+			minExtent = glm::min(minExtent, vertices[indices[i]].position);
+			maxExtent = glm::max(maxExtent, vertices[indices[i]].position);
+		}
+		glm::vec3 center = (minExtent + maxExtent) * 0.5f;
+		float radius = 0.0f;
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; ++i)
+			radius = std::max(radius, glm::length(vertices[indices[i]].position - center));
+
+		// Degenerate triangles have no facing and are left out of the cone
+		std::vector<glm::vec3> normals;
+		glm::vec3 axis(0.0f);
+		for (uint32_t i = firstIndex; i < firstIndex + indexCount; i += 3) {
+			const glm::vec3& p0 = vertices[indices[i + 0]].position;
+			const glm::vec3& p1 = vertices[indices[i + 1]].position;
+			const glm::vec3& p2 = vertices[indices[i + 2]].position;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(normal);
+			if (length <= 0.0f) continue;
+			normals.push_back(normal / length);
+			axis += normals.back();
+		}
+
+		// A cone wider than a hemisphere never lies entirely behind the viewer
+		glm::vec4 cone(0.0f, 0.0f, 0.0f, 2.0f);
+		float axisLength = glm::length(axis);
+		if (axisLength > 0.0f) {
+			axis /= axisLength;
+			float minDot = 1.0f;
+			for (auto& normal : normals)
+				minDot = std::min(minDot, glm::dot(axis, normal));
+			if (minDot > 0.0f)
+				cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+		}
+
+		Meshlet meshlet = {};
+		meshlet.sphere = glm::vec4(center, radius);
+		meshlet.cone = cone;
+		meshlet.firstIndex = firstIndex;
+		meshlet.indexCount = indexCount;
+		return meshlet;
+	}
+
+	void BuildMeshlets(const uint32_t* indices, uint32_t indexCount, const Vertex* vertices, uint32_t vertexCount, std::vector<Meshlet>& meshlets)
+	{
+		uint32_t triangleCount = indexCount / 3;
+		// Meshlet each vertex was last counted in, offset by one so 0 means never
+		std::vector<uint32_t> vertexMeshlet(vertexCount, 0);
+		uint32_t meshletId = 1;
+		uint32_t firstTriangle = 0, meshletVertices = 0;
+
+		for (uint32_t t = 0; t < triangleCount; ++t) {
+			const uint32_t* triangle = indices + t * 3;
+			uint32_t newVertices = 0;
+			for (int k = 0; k < 3; ++k) {
+				bool repeated = (k > 0 && triangle[k] == triangle[0]) || (k > 1 && triangle[k] == triangle[1]);
+				if (vertexMeshlet[triangle[k]] != meshletId && !repeated)
+					newVertices++;
+			}
+
+			if (meshletVertices + newVertices > MESHLET_MAX_VERTICES || t - firstTriangle == MESHLET_MAX_TRIANGLES) {
+				meshlets.push_back(computeMeshletBounds(indices, firstTriangle * 3, (t - firstTriangle) * 3, vertices));
+				meshletId++;
+				firstTriangle = t;
+				meshletVertices = 0;
+			}
+
+			for (int k = 0; k < 3; ++k) {
+				if (vertexMeshlet[triangle[k]] != meshletId) {
+					vertexMeshlet[triangle[k]] = meshletId;
+					meshletVertices++;
+				}
+			}
+		}
+
+		if (triangleCount > firstTriangle)
+			meshlets.push_back(computeMeshletBounds(indices, firstTriangle * 3, (triangleCount - firstTriangle) * 3, vertices));
+	}
+
+	// Symmetric plane quadric, w is the accumulated area so errors stay squared distances
+	struct Quadric {
+		float a00, a11, a22, a01, a02, a12;
+		float b0, b1, b2;
+		float c;
+		float w;
+	};
+
+	static void addPlaneQuadric(Quadric& q, glm::vec3 n, float d, float w) {
+		q.a00 += w * n.x * n.x;
+		q.a11 += w * n.y * n.y;
+		q.a22 += w * n.z * n.z;
+		q.a01 += w * n.x * n.y;
+		q.a02 += w * n.x * n.z;
+		q.a12 += w * n.y * n.z;
+		q.b0 += w * n.x * d;
+		q.b1 += w * n.y * d;
+		q.b2 += w * n.z * d;
+		q.c += w * d * d;
+		q.w += w;
+	}
+
+	static void addQuadric(Quadric& q, const Quadric& r) {
+		q.a00 += r.a00; q.a11 += r.a11; q.a22 += r.a22;
+		q.a01 += r.a01; q.a02 += r.a02; q.a12 += r.a12;
+		q.b0 += r.b0; q.b1 += r.b1; q.b2 += r.b2;
+		q.c += r.c;
+		q.w += r.w;
+	}
+
+	static float quadricError(const Quadric& q, glm::vec3 p) {
+		float rx = q.a00 * p.x + q.a01 * p.y + q.a02 * p.z;
+		float ry = q.a01 * p.x + q.a11 * p.y + q.a12 * p.z;
+		float rz = q.a02 * p.x + q.a12 * p.y + q.a22 * p.z;
+		float e = p.x * rx + p.y * ry + p.z * rz + 2.0f * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z) + q.c;
+		return std::abs(e) / std::max(q.w, 1e-12f);
+	}
+
+	static uint64_t edgeKey(uint32_t a, uint32_t b) {
+		return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+	}
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		// Triangles sharing the edge, removed by the collapse
+		uint32_t triangles;
+		float error;
+	};
+
+	uint32_t SimplifyMesh(uint32_t* destination, const uint32_t* indices, uint32_t indexCount, const Vertex* vertices, uint32_t vertexCount, uint32_t targetIndexCount, float* resultError)
+	{
+		*resultError = 0.0f;
+		std::vector<uint32_t> result(indices, indices + indexCount - indexCount % 3);
+
+		// Vertices with the same position form one group with its first vertex as
+		// the id, the other vertices of a group (wedges) are linked in a ring
+		std::vector<uint32_t> order(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			order[v] = v;
+		auto lessPosition = [&](uint32_t a, uint32_t b) {
+			const glm::vec3& pa = vertices[a].position;
+			const glm::vec3& pb = vertices[b].position;
+			return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+		};
+		std::sort(order.begin(), order.end(), lessPosition);
+
+		std::vector<uint32_t> group(vertexCount), nextWedge(vertexCount);
+		for (uint32_t i = 0; i < vertexCount;) {
+			uint32_t end = i + 1;
+			while (end < vertexCount && !lessPosition(order[i], order[end]))
+				end++;
+			for (uint32_t j = i; j < end; ++j) {
+				group[order[j]] = order[i];
+				nextWedge[order[j]] = order[j + 1 < end ? j + 1 : i];
+			}
+			i = end;
+		}
+
+		// Edges in group space with their triangle count, 1 means border
+		std::vector<std::pair<uint64_t, uint32_t>> edges;
+		auto countEdges = [&]() {
+			std::vector<uint64_t> keys;
+			keys.reserve(result.size());
+			for (uint32_t i = 0; i < result.size(); i += 3) {
+				for (int k = 0; k < 3; ++k)
+					keys.push_back(edgeKey(group[result[i + k]], group[result[i + (k + 1) % 3]]));
+			}
+			std::sort(keys.begin(), keys.end());
+			edges.clear();
+			for (uint32_t i = 0; i < keys.size();) {
+				uint32_t end = i + 1;
+				while (end < keys.size() && keys[end] == keys[i])
+					end++;
+				edges.push_back({ keys[i], end - i });
+				i = end;
+			}
+		};
+		auto findEdgeCount = [&](uint32_t a, uint32_t b) {
+			uint64_t key = edgeKey(a, b);
+			auto it = std::lower_bound(edges.begin(), edges.end(), std::make_pair(key, 0u));
+			return it != edges.end() && it->first == key ? it->second : 0u;
+		};
+
+		countEdges();
+		std::vector<Quadric> quadrics(vertexCount, Quadric{});
+		for (uint32_t i = 0; i < result.size(); i += 3) {
+			glm::vec3 p[3];
+			for (int k = 0; k < 3; ++k)
+				p[k] = vertices[result[i + k]].position;
+			glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+			float length = glm::length(normal);
+			if (length <= 0.0f) continue;
+			normal /= length;
+			for (int k = 0; k < 3; ++k)
+				addPlaneQuadric(quadrics[group[result[i + k]]], normal, -glm::dot(normal, p[0]), length * 0.5f);
+
+			// Planes through border edges, perpendicular to the surface, keep the outline in place
+			for (int k = 0; k < 3; ++k) {
+				uint32_t a = group[result[i + k]], b = group[result[i + (k + 1) % 3]];
+				if (findEdgeCount(a, b) != 1) continue;
+				glm::vec3 edge = p[(k + 1) % 3] - p[k];
+				glm::vec3 edgeNormal = glm::cross(edge, normal);
+				float edgeLength = glm::length(edgeNormal);
+				if (edgeLength <= 0.0f) continue;
+				edgeNormal /= edgeLength;
+				float weight = glm::dot(edge, edge) * 10.0f;
+				addPlaneQuadric(quadrics[a], edgeNormal, -glm::dot(edgeNormal, p[k]), weight);
+				addPlaneQuadric(quadrics[b], edgeNormal, -glm::dot(edgeNormal, p[k]), weight);
+			}
+		}
+
+		float maxError = 0.0f;
+		std::vector<uint32_t> remap(vertexCount);
+		std::vector<uint8_t> locked(vertexCount), border(vertexCount), seam(vertexCount);
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1), adjacency;
+		std::vector<Collapse> collapses;
+
+		while (result.size() > targetIndexCount) {
+			uint32_t triangleCount = (uint32_t)result.size() / 3;
+			if (edges.empty()) countEdges();
+
+			// Triangles around every vertex
+			std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+			for (uint32_t index : result)
+				adjacencyOffsets[index + 1]++;
+			for (uint32_t v = 0; v < vertexCount; ++v)
+				adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+			adjacency.resize(result.size());
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (uint32_t i = 0; i < result.size(); ++i)
+				adjacency[fill[result[i]]++] = i / 3;
+
+			std::fill(border.begin(), border.end(), 0);
+			for (auto& edge : edges) {
+				if (edge.second != 1) continue;
+				border[uint32_t(edge.first >> 32)] = 1;
+				border[uint32_t(edge.first)] = 1;
+			}
+			// A group is a seam if more than one of its wedges is still referenced
+			for (uint32_t v = 0; v < vertexCount; ++v) {
+				if (group[v] != v) continue;
+				uint32_t used = 0, wedge = v;
+				do {
+					used += adjacencyOffsets[wedge + 1] > adjacencyOffsets[wedge] ? 1 : 0;
+					wedge = nextWedge[wedge];
+				} while (wedge != v);
+				seam[v] = used > 1 ? 1 : 0;
+			}
+
+			// Cheapest allowed direction of every edge, borders and seams only move along themselves
+			collapses.clear();
+			for (auto& edge : edges) {
+				uint32_t a = uint32_t(edge.first >> 32), b = uint32_t(edge.first);
+				bool borderEdge = edge.second == 1;
+				Collapse best{ 0, 0, edge.second, FLT_MAX };
+				for (int direction = 0; direction < 2; ++direction) {
+					uint32_t from = direction == 0 ? a : b;
+					uint32_t to = direction == 0 ? b : a;
+					if (border[from] && !borderEdge) continue;
+					if (seam[from] && !seam[to]) continue;
+					Quadric q = quadrics[from];
+					addQuadric(q, quadrics[to]);
+					float error = quadricError(q, vertices[to].position);
+					if (error < best.error)
+						best = Collapse{ from, to, edge.second, error };
+				}
+				if (best.error < FLT_MAX)
+					collapses.push_back(best);
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+			for (uint32_t v = 0; v < vertexCount; ++v)
+				remap[v] = v;
+			std::fill(locked.begin(), locked.end(), 0);
+
+			uint32_t trianglesToRemove = triangleCount - targetIndexCount / 3;
+			uint32_t removed = 0, applied = 0;
+			for (auto& collapse : collapses) {
+				if (removed >= trianglesToRemove) break;
+				if (locked[collapse.from] || locked[collapse.to]) continue;
+
+				// Every referenced wedge of from needs exactly one wedge of to it shares an edge with
+				bool valid = true;
+				uint32_t wedge = collapse.from;
+				do {
+					uint32_t partner = ~0u;
+					uint32_t begin = adjacencyOffsets[wedge], end = adjacencyOffsets[wedge + 1];
+					for (uint32_t j = begin; j < end && valid; ++j) {
+						const uint32_t* triangle = result.data() + adjacency[j] * 3;
+						for (int k = 0; k < 3; ++k) {
+							if (group[triangle[k]] != collapse.to) continue;
+							if (partner != ~0u && partner != triangle[k]) valid = false;
+							partner = triangle[k];
+						}
+					}
+					if (begin != end && partner == ~0u) valid = false;
+					remap[wedge] = begin != end ? partner : wedge;
+					wedge = nextWedge[wedge];
+				} while (wedge != collapse.from && valid);
+
+				// Moving from onto to must not flip any remaining triangle
+				glm::vec3 target = vertices[collapse.to].position;
+				wedge = collapse.from;
+				do {
+					for (uint32_t j = adjacencyOffsets[wedge]; j < adjacencyOffsets[wedge + 1] && valid; ++j) {
+						const uint32_t* triangle = result.data() + adjacency[j] * 3;
+						glm::vec3 p[3], q[3];
+						bool collapsed = false;
+						for (int k = 0; k < 3; ++k) {
+							p[k] = q[k] = vertices[triangle[k]].position;
+							if (group[triangle[k]] == collapse.from) q[k] = target;
+							collapsed |= group[triangle[k]] == collapse.to;
+						}
+						if (collapsed) continue;
+						glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+						glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+						if (glm::dot(before, after) <= 0.0f) valid = false;
+					}
+					wedge = nextWedge[wedge];
+				} while (wedge != collapse.from && valid);
+
+				if (!valid) {
+					wedge = collapse.from;
+					do {
+						remap[wedge] = wedge;
+						wedge = nextWedge[wedge];
+					} while (wedge != collapse.from);
+					continue;
+				}
+
+				// The one ring keeps its pre collapse adjacency for the rest of the pass
+				wedge = collapse.from;
+				do {
+					for (uint32_t j = adjacencyOffsets[wedge]; j < adjacencyOffsets[wedge + 1]; ++j) {
+						const uint32_t* triangle = result.data() + adjacency[j] * 3;
+						for (int k = 0; k < 3; ++k)
+							locked[group[triangle[k]]] = 1;
+					}
+					wedge = nextWedge[wedge];
+				} while (wedge != collapse.from);
+
+				addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+				maxError = std::max(maxError, collapse.error);
+				removed += collapse.triangles;
+				applied++;
+			}
+
+			if (applied == 0) break;
+
+			uint32_t write = 0;
+			for (uint32_t i = 0; i < result.size(); i += 3) {
+				uint32_t a = remap[result[i + 0]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+				if (group[a] == group[b] || group[b] == group[c] || group[a] == group[c]) continue;
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+			edges.clear();
+		}
+
+		std::copy(result.begin(), result.end(), destination);
+		*resultError = std::sqrt(maxError);
+		return (uint32_t)result.size();
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+struct Vertex;
+struct Meshlet;
+
+/*
+* Load time reordering of a single primitive. Indices are local to the
+* primitive and must all be below vertexCount. The intended order is
+* OptimizeVertexCache, OptimizeOverdraw and finally OptimizeVertexFetch,
+* which reorders the vertices themselves to match the new index order.
+*/
+namespace MeshOptimizer {
+	// Average cache misses per triangle of a FIFO post transform cache, 0.5 is ideal and 3 the worst case
+	float ComputeACMR(const uint32_t* indices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize = 16);
+
+	// Forsyth's linear speed vertex cache optimization
+	void OptimizeVertexCache(uint32_t* indices, uint32_t indexCount, uint32_t vertexCount);
+
+	// Splits the cache optimized order into clusters and draws outward facing
+	// clusters first. threshold bounds the ACMR lost at cluster boundaries.
+	void OptimizeOverdraw(uint32_t* indices, uint32_t indexCount, const Vertex* vertices, uint32_t vertexCount, float threshold = 1.05f);
+
+	// Places vertices in first use order, unreferenced vertices go last
+	void OptimizeVertexFetch(Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount);
+
+	// Splits the triangles in their current order into meshlets of at most
+	// MESHLET_MAX_VERTICES unique vertices and MESHLET_MAX_TRIANGLES triangles.
+	// firstIndex is relative to indices, baseVertex and drawIndex are left 0.
+	void BuildMeshlets(const uint32_t* indices, uint32_t indexCount, const Vertex* vertices, uint32_t vertexCount, std::vector<Meshlet>& meshlets);
+
+	// Quadric error edge collapse towards targetIndexCount. Vertices are only
+	// collapsed onto other existing vertices, so the result indexes the same
+	// vertex array. Borders and attribute seams only collapse along themselves.
+	// Returns the index count written to destination, which needs indexCount
+	// entries, and the largest collapse error as a distance in resultError.
+	uint32_t SimplifyMesh(uint32_t* destination, const uint32_t* indices, uint32_t indexCount, const Vertex* vertices, uint32_t vertexCount, uint32_t targetIndexCount, float* resultError);
+}
@@ -3,9 +3,35 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define TINYGLTF_IMPLEMENTATION
+// External images are only referenced by uri, the TextureCache decodes them on workers
+#define TINYGLTF_NO_EXTERNAL_IMAGE
 #include "tinygltf/tiny_gltf.h"
 
 #include "logger.h"
+#include "mesh-cache.h"
+#include "mesh-optimizer.h"
+#include "scene-geometry.h"
+#include "texture-cache.h"
+#include "job-system.h"
+#include "utils.h"
+#include "vertex-quantization.h"
+
+#include <cstddef>
+#include <emmintrin.h>
+#include <filesystem>
+
+// Arvo's method, each output axis takes the min/max of every column contribution
+AABB TransformAABB(const AABB& aabb, const glm::mat4& transform) {
+	glm::vec3 min = glm::vec3(transform[3]);
+	glm::vec3 max = min;
+	for (int column = 0; column < 3; ++column) {
+		glm::vec3 a = glm::vec3(transform[column]) * aabb.min[column];
+		glm::vec3 b = glm::vec3(transform[column]) * aabb.max[column];
+		min += glm::min(a, b);
+		max += glm::max(a, b);
+	}
+	return AABB{ min, max };
+}
 
 void InitializePlaneMesh(GLMesh* mesh, int width, int height) {
 
@@ -122,15 +148,12 @@ static void parseMaterial(tinygltf::Model* model, Material* component, uint32_t
 	component->roughness = (float)pbr.roughnessFactor;
 	std::vector<double>& emissiveColor = material.emissiveFactor;
 	component->emissive = glm::vec4((float)emissiveColor[0], (float)emissiveColor[1], (float)emissiveColor[2], 1.0f);
-	/*
-	// Parse Material texture
-	auto loadTexture = [&](uint32_t index) {
-		tinygltf::Texture& texture = model->textures[index];
-		tinygltf::Image& image = model->images[texture.source];
-		const std::string& name = image.uri.length() == 0 ? image.name : image.uri;
-		return TextureCache::LoadTexture(name, image.width, image.height, image.image.data(), image.component, true);
-		};
 
+	// glTF image index + 1 for now, collectTextures turns it into a MeshGroup::textures slot
+	auto loadTexture = [&](int index) {
+		int source = model->textures[index].source;
+		return source >= 0 ? (uint32_t)source + 1 : 0u;
+	};
 
 	if (pbr.baseColorTexture.index >= 0)
 		component->albedoMap = loadTexture(pbr.baseColorTexture.index);
@@ -146,135 +169,464 @@ static void parseMaterial(tinygltf::Model* model, Material* component, uint32_t
 
 	if (material.emissiveTexture.index >= 0)
 		component->emissiveMap = loadTexture(material.emissiveTexture.index);
-	 */
-}
-
-static void parseMesh(tinygltf::Model* model, tinygltf::Mesh& mesh, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, MeshGroup* meshGroup, const glm::mat4& transform) {
-	for (auto& primitive : mesh.primitives)
-	{
-		// Parse position
-		const tinygltf::Accessor& positionAccessor = model->accessors[primitive.attributes["POSITION"]];
-		float* positions = (float*)getBufferPtr(model, positionAccessor);
-		uint32_t numPosition = (uint32_t)positionAccessor.count;
-
-		// Parse normals
-		float* normals = nullptr;
-		auto normalAttributes = primitive.attributes.find("NORMAL");
-		if (normalAttributes != primitive.attributes.end()) {
-			const tinygltf::Accessor& normalAccessor = model->accessors[normalAttributes->second];
-			assert(numPosition == normalAccessor.count);
-			normals = (float*)getBufferPtr(model, normalAccessor);
-		}
+}
 
-		// Parse tangents
-		float* tangents = nullptr;
-		auto tangentAttributes = primitive.attributes.find("TANGENT");
-		if (tangentAttributes != primitive.attributes.end()) {
-			const tinygltf::Accessor& tangentAccessor = model->accessors[normalAttributes->second];
-			assert(numPosition == tangentAccessor.count);
-			tangents = (float*)getBufferPtr(model, tangentAccessor);
+// Keeps the external images the materials use. Embedded images would need
+// tinygltf to decode them serially, their slots are cleared instead
+static void collectTextures(tinygltf::Model* model, const std::string& filename, MeshGroup* meshGroup) {
+	std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+	std::vector<uint32_t> imageSlots(model->images.size(), UINT32_MAX);
+	auto remap = [&](uint32_t& slot) {
+		if (slot == 0) return;
+		uint32_t imageIndex = slot - 1;
+		if (imageSlots[imageIndex] == UINT32_MAX) {
+			const tinygltf::Image& image = model->images[imageIndex];
+			if (image.uri.empty() || image.uri.compare(0, 5, "data:") == 0) {
+				logger::Warn("Skipping embedded image: " + image.name);
+				imageSlots[imageIndex] = 0;
+			}
+			else {
+				meshGroup->textures.push_back((directory / image.uri).string());
+				imageSlots[imageIndex] = (uint32_t)meshGroup->textures.size();
+			}
 		}
+		slot = imageSlots[imageIndex];
+	};
 
-		// Parse UV
-		float* uvs = nullptr;
-		auto uvAttributes = primitive.attributes.find("TEXCOORD_0");
-		if (uvAttributes != primitive.attributes.end()) {
-			const tinygltf::Accessor& uvAccessor = model->accessors[uvAttributes->second];
-			assert(numPosition == uvAccessor.count);
-			uvs = (float*)getBufferPtr(model, uvAccessor);
-		}
+	for (auto& material : meshGroup->materials) {
+		remap(material.albedoMap);
+		remap(material.normalMap);
+		remap(material.emissiveMap);
+		remap(material.metallicMap);
+		remap(material.roughnessMap);
+		remap(material.ambientOcclusionMap);
+		remap(material.opacityMap);
+	}
+}
 
+// Raw source pointers a worker needs to convert one primitive's geometry.
+// Accessor lookups, materials and names are resolved serially beforehand,
+// so workers only read the glTF buffers and write their own output slice.
+struct PrimitiveJob {
+	const uint8_t* positions;
+	const uint8_t* normals;
+	const uint8_t* uvs;
+	const uint8_t* indices;
+	uint32_t positionStride;
+	uint32_t normalStride;
+	uint32_t uvStride;
+	int indexComponentType;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t vertexOffset;
+	uint32_t indexOffset;
+};
+
+// The 4-wide stores spill one float into the next attribute, so positions,
+// normals and uvs must be written in that order. The last element of each
+// source is copied scalar to avoid reading past the end of the glTF buffer.
+static void convertPositions(const uint8_t* src, uint32_t stride, uint32_t count, Vertex* dst) {
+	if (count == 0) return;
+	for (uint32_t i = 0; i < count - 1; ++i) {
+		__m128 p = _mm_loadu_ps((const float*)(src + i * stride));
+		_mm_storeu_ps(&dst[i].position.x, p);
+	}
+	const float* last = (const float*)(src + (count - 1) * stride);
+	dst[count - 1].position = glm::vec3(last[0], last[1], last[2]);
+}
 
-		uint32_t vertexOffset = (uint32_t)(vertices.size() * sizeof(Vertex));
-		uint32_t indexOffset = (uint32_t)(indices.size() * sizeof(uint32_t));
+static void convertNormals(const uint8_t* src, uint32_t stride, uint32_t count, Vertex* dst) {
+	if (count == 0) return;
+	if (src == nullptr) {
+		__m128 up = _mm_setr_ps(0.0f, 1.0f, 0.0f, 0.0f);
+		for (uint32_t i = 0; i < count; ++i)
+			_mm_storeu_ps(&dst[i].normal.x, up);
+		return;
+	}
+	for (uint32_t i = 0; i < count - 1; ++i) {
+		__m128 n = _mm_loadu_ps((const float*)(src + i * stride));
+		_mm_storeu_ps(&dst[i].normal.x, n);
+	}
+	const float* last = (const float*)(src + (count - 1) * stride);
+	dst[count - 1].normal = glm::vec3(last[0], last[1], last[2]);
+}
 
-		for (uint32_t i = 0; i < numPosition; ++i) {
-			Vertex vertex;
-			vertex.position = { positions[i * 3 + 0], positions[i * 3 + 1], positions[i * 3 + 2] };
+// uv' = (u, 1 - v)
+static void convertUVs(const uint8_t* src, uint32_t stride, uint32_t count, Vertex* dst) {
+	if (src == nullptr) {
+		for (uint32_t i = 0; i < count; ++i)
+			dst[i].uv = glm::vec2(0.0f);
+		return;
+	}
+	const __m128 sign = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+	const __m128 bias = _mm_setr_ps(0.0f, 1.0f, 0.0f, 1.0f);
+	for (uint32_t i = 0; i < count; ++i) {
+		__m128 uv = _mm_castpd_ps(_mm_load_sd((const double*)(src + i * stride)));
+		uv = _mm_add_ps(_mm_mul_ps(uv, sign), bias);
+		_mm_storel_pi((__m64*)&dst[i].uv.x, uv);
+	}
+}
 
-			if (normals)
-				vertex.normal = { normals[i * 3 + 0], normals[i * 3 + 1], normals[i * 3 + 2] };
-			else
-				vertex.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+static void convertIndices(const uint8_t* src, int componentType, uint32_t count, uint32_t* dst) {
+	if (componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
+		std::memcpy(dst, src, count * sizeof(uint32_t));
+	}
+	else if (componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+		const uint16_t* src16 = (const uint16_t*)src;
+		const __m128i zero = _mm_setzero_si128();
+		uint32_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(src16 + i));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(v, zero));
+			_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(v, zero));
+		}
+		for (; i < count; ++i)
+			dst[i] = src16[i];
+	}
+	else {
+		for (uint32_t i = 0; i < count; ++i)
+			dst[i] = src[i];
+	}
+}
 
-			if (uvs)
-				vertex.uv = { uvs[i * 2 + 0],  1.0f - uvs[i * 2 + 1] };
-			else
-				vertex.uv = { 0.0f, 0.0f };
+// Nodes given as a matrix are decomposed, glTF forbids shear so TRS is exact
+static uint32_t addNode(TransformHierarchy* hierarchy, const tinygltf::Node& node, int32_t parent) {
+	glm::vec3 translation = glm::vec3(0.0f);
+	glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec3 scale = glm::vec3(1.0f);
+	if (node.matrix.size() == 16) {
+		glm::mat4 matrix;
+		for (int i = 0; i < 16; ++i)
+			matrix[i / 4][i % 4] = (float)node.matrix[i];
+		translation = glm::vec3(matrix[3]);
+		scale = glm::vec3(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+		glm::mat3 r = glm::mat3(glm::vec3(matrix[0]) / scale.x, glm::vec3(matrix[1]) / scale.y, glm::vec3(matrix[2]) / scale.z);
+		rotation = glm::quat_cast(r);
+	}
+	if (node.translation.size() > 0)
+		translation = glm::vec3((float)node.translation[0], (float)node.translation[1], (float)node.translation[2]);
+	if (node.rotation.size() > 0)
+		rotation = glm::quat((float)node.rotation[3], (float)node.rotation[0], (float)node.rotation[1], (float)node.rotation[2]);
+	if (node.scale.size() > 0)
+		scale = glm::vec3((float)node.scale[0], (float)node.scale[1], (float)node.scale[2]);
+	return hierarchy->AddNode(parent, translation, rotation, scale);
+}
 
-			vertices.push_back(std::move(vertex));
+// Walks the node hierarchy iteratively in the same depth-first order the old
+// recursive parser used. Every node enters the hierarchy after its parent,
+// meshNodes pairs each mesh instance with its hierarchy node
+static void flattenNodes(tinygltf::Model* model, TransformHierarchy* hierarchy, std::vector<std::pair<int, uint32_t>>& meshNodes) {
+	// glTF node index and the hierarchy index of its parent
+	std::vector<std::pair<int, int32_t>> stack;
+	for (auto& scene : model->scenes) {
+		for (auto it = scene.nodes.rbegin(); it != scene.nodes.rend(); ++it)
+			stack.emplace_back(*it, -1);
+
+		while (!stack.empty()) {
+			auto [nodeIndex, parent] = stack.back();
+			stack.pop_back();
+
+			const tinygltf::Node& node = model->nodes[nodeIndex];
+			uint32_t hierarchyNode = addNode(hierarchy, node, parent);
+			if (node.mesh >= 0)
+				meshNodes.emplace_back(node.mesh, hierarchyNode);
+
+			for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+				stack.emplace_back(*it, (int32_t)hierarchyNode);
 		}
+	}
+
+	std::vector<uint32_t> changedNodes;
+	hierarchy->Update(changedNodes);
+}
 
-		const tinygltf::Accessor& indicesAccessor = model->accessors[primitive.indices];
-		uint32_t indexCount = (uint32_t)indicesAccessor.count;
-		if (indicesAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
-			uint32_t* indicesPtr = (uint32_t*)getBufferPtr(model, indicesAccessor);
-			indices.insert(indices.end(), indicesPtr, indicesPtr + indexCount);
+static const tinygltf::Accessor* findAttribute(tinygltf::Model* model, const tinygltf::Primitive& primitive, const char* name) {
+	auto found = primitive.attributes.find(name);
+	if (found == primitive.attributes.end())
+		return nullptr;
+	return &model->accessors[found->second];
+}
+
+static uint32_t getStride(tinygltf::Model* model, const tinygltf::Accessor& accessor) {
+	int stride = accessor.ByteStride(model->bufferViews[accessor.bufferView]);
+	return stride > 0 ? (uint32_t)stride : 0;
+}
+
+// Counting pass, assigns every primitive its slice of the output arrays and
+// fills the per-draw transform, bounds, draw command, material and name.
+// Meshes referenced by several nodes are converted once, in the order they
+// are first referenced, drawInstances receives the nodes of every draw
+static void buildPrimitiveJobs(tinygltf::Model* model, const std::vector<std::pair<int, uint32_t>>& meshNodes,
+	std::vector<PrimitiveJob>& jobs, MeshGroup* meshGroup, std::vector<std::vector<uint32_t>>& drawInstances,
+	uint32_t* totalVertices, uint32_t* totalIndices) {
+	std::vector<int> meshOrder;
+	std::vector<std::vector<uint32_t>> meshInstances(model->meshes.size());
+	for (auto& [mesh, node] : meshNodes) {
+		if (meshInstances[mesh].empty())
+			meshOrder.push_back(mesh);
+		meshInstances[mesh].push_back(node);
+	}
+
+	uint32_t vertexOffset = 0;
+	uint32_t indexOffset = 0;
+	for (int meshIndex : meshOrder) {
+		const tinygltf::Mesh& mesh = model->meshes[meshIndex];
+		const std::vector<uint32_t>& nodes = meshInstances[meshIndex];
+		for (auto& primitive : mesh.primitives) {
+			const tinygltf::Accessor* positionAccessor = findAttribute(model, primitive, "POSITION");
+			if (positionAccessor == nullptr || primitive.indices < 0) {
+				logger::Warn("Skipping primitive without positions or indices in mesh: " + mesh.name);
+				continue;
+			}
+
+			PrimitiveJob job = {};
+			job.vertexCount = (uint32_t)positionAccessor->count;
+			job.positions = getBufferPtr(model, *positionAccessor);
+			job.positionStride = getStride(model, *positionAccessor);
+
+			if (const tinygltf::Accessor* normalAccessor = findAttribute(model, primitive, "NORMAL")) {
+				assert(job.vertexCount == normalAccessor->count);
+				job.normals = getBufferPtr(model, *normalAccessor);
+				job.normalStride = getStride(model, *normalAccessor);
+			}
+
+			if (const tinygltf::Accessor* uvAccessor = findAttribute(model, primitive, "TEXCOORD_0")) {
+				assert(job.vertexCount == uvAccessor->count);
+				job.uvs = getBufferPtr(model, *uvAccessor);
+				job.uvStride = getStride(model, *uvAccessor);
+			}
+
+			const tinygltf::Accessor& indicesAccessor = model->accessors[primitive.indices];
+			job.indexCount = (uint32_t)indicesAccessor.count;
+			job.indices = getBufferPtr(model, indicesAccessor);
+			job.indexComponentType = indicesAccessor.componentType;
+			if (job.indexComponentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT &&
+				job.indexComponentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT &&
+				job.indexComponentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
+				logger::Error("Undefined indices componentType: " + std::to_string(job.indexComponentType));
+
+			job.vertexOffset = vertexOffset;
+			job.indexOffset = indexOffset;
+			vertexOffset += job.vertexCount;
+			indexOffset += job.indexCount;
+			jobs.push_back(job);
+
+			glm::vec3 minExtent = glm::vec3(positionAccessor->minValues[0], positionAccessor->minValues[1], positionAccessor->minValues[2]);
+			glm::vec3 maxExtent = glm::vec3(positionAccessor->maxValues[0], positionAccessor->maxValues[1], positionAccessor->maxValues[2]);
+			meshGroup->transforms.push_back(meshGroup->hierarchy.GetWorld(nodes[0]));
+			meshGroup->drawNodes.push_back(nodes[0]);
+			drawInstances.push_back(nodes);
+			meshGroup->aabbs.push_back(AABB{ minExtent, maxExtent });
+
+			DrawElementsIndirectCommand drawCommand = {};
+			drawCommand.count_ = job.indexCount;
+			drawCommand.instanceCount_ = 1;
+			drawCommand.firstIndex_ = job.indexOffset;
+			drawCommand.baseVertex_ = job.vertexOffset;
+			drawCommand.baseInstance_ = (uint32_t)meshGroup->drawCommands.size();
+			meshGroup->drawCommands.push_back(drawCommand);
+
+			Material material = {};
+			parseMaterial(model, &material, primitive.material);
+			meshGroup->materials.push_back(material);
+			meshGroup->names.push_back(primitive.material >= 0 ? model->materials[primitive.material].name : std::string());
 		}
-		else if (indicesAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
-			uint16_t* indicesPtr = (uint16_t*)getBufferPtr(model, indicesAccessor);
-			indices.insert(indices.end(), indicesPtr, indicesPtr + indexCount);
+	}
+	*totalVertices = vertexOffset;
+	*totalIndices = indexOffset;
+}
+
+// Repeats every draw once per node that references its mesh, after all per
+// primitive processing is done. Instances share the vertex and index range
+// of their primitive and are laid out consecutively, the first command draws
+// all of them through instanceCount_ and the following ones are left empty.
+// Culled streams still emit every instance as its own command
+static void expandInstances(MeshGroup* meshGroup, const std::vector<std::vector<uint32_t>>& drawInstances) {
+	std::vector<AABB> aabbs;
+	std::vector<DrawElementsIndirectCommand> drawCommands;
+	std::vector<Material> materials;
+	std::vector<std::string> names;
+	std::vector<PositionDequantization> dequantization;
+	std::vector<DrawLods> lods;
+	std::vector<Meshlet> meshlets;
+	aabbs.swap(meshGroup->aabbs);
+	drawCommands.swap(meshGroup->drawCommands);
+	materials.swap(meshGroup->materials);
+	names.swap(meshGroup->names);
+	dequantization.swap(meshGroup->dequantization);
+	lods.swap(meshGroup->lods);
+	meshlets.swap(meshGroup->meshlets);
+	meshGroup->transforms.clear();
+	meshGroup->drawNodes.clear();
+
+	// Meshlets are stored in draw order
+	uint32_t meshletIndex = 0;
+	for (uint32_t drawIndex = 0; drawIndex < drawCommands.size(); ++drawIndex) {
+		uint32_t firstMeshlet = meshletIndex;
+		while (meshletIndex < meshlets.size() && meshlets[meshletIndex].drawIndex == drawIndex)
+			++meshletIndex;
+
+		const std::vector<uint32_t>& nodes = drawInstances[drawIndex];
+		for (uint32_t instance = 0; instance < nodes.size(); ++instance) {
+			uint32_t instanceDraw = (uint32_t)meshGroup->drawCommands.size();
+			DrawElementsIndirectCommand drawCommand = drawCommands[drawIndex];
+			drawCommand.instanceCount_ = instance == 0 ? (uint32_t)nodes.size() : 0;
+			drawCommand.baseInstance_ = instanceDraw;
+			meshGroup->drawCommands.push_back(drawCommand);
+			meshGroup->transforms.push_back(meshGroup->hierarchy.GetWorld(nodes[instance]));
+			meshGroup->drawNodes.push_back(nodes[instance]);
+			meshGroup->aabbs.push_back(aabbs[drawIndex]);
+			meshGroup->materials.push_back(materials[drawIndex]);
+			meshGroup->names.push_back(names[drawIndex]);
+			meshGroup->dequantization.push_back(dequantization[drawIndex]);
+			meshGroup->lods.push_back(lods[drawIndex]);
+			for (uint32_t i = firstMeshlet; i < meshletIndex; ++i) {
+				Meshlet meshlet = meshlets[i];
+				meshlet.drawIndex = instanceDraw;
+				meshGroup->meshlets.push_back(meshlet);
+			}
 		}
-		else
-			logger::Error("Undefined indices componentType: " + std::to_string(indicesAccessor.componentType));
-
-		glm::vec3 minExtent = glm::vec3(positionAccessor.minValues[0], positionAccessor.minValues[1], positionAccessor.minValues[2]);
-		glm::vec3 maxExtent = glm::vec3(positionAccessor.maxValues[0], positionAccessor.maxValues[1], positionAccessor.maxValues[2]);
-
-		meshGroup->transforms.push_back(transform);
-		meshGroup->aabbs.push_back(AABB{ minExtent, maxExtent });
-		DrawElementsIndirectCommand drawCommand = {};
-		drawCommand.count_ = indexCount;
-		drawCommand.instanceCount_ = 1;
-		drawCommand.firstIndex_ = indexOffset / sizeof(uint32_t);
-		drawCommand.baseVertex_ = vertexOffset / sizeof(Vertex);
-		drawCommand.baseInstance_ = 0;
-		meshGroup->drawCommands.push_back(std::move(drawCommand));
-
-		Material material = {};
-		std::string materialName = model->materials[primitive.material].name;
-		meshGroup->names.push_back(materialName);
-		parseMaterial(model, &material, primitive.material);
-		meshGroup->materials.push_back(std::move(material));
 	}
 }
 
-void parseNodeHierarchy(tinygltf::Model* model, int nodeIndex, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, MeshGroup* meshGroup) {
-	tinygltf::Node& node = model->nodes[nodeIndex];
+// Copies the leading position bytes of every vertex in the final layout
+static void extractPositions(VertexFormat format, MeshData* meshData) {
+	uint32_t vertexSize = GetVertexSize(format);
+	uint32_t positionSize = GetPositionSize(format);
+	uint32_t vertexCount = (uint32_t)(meshData->vertices.size() / vertexSize);
+	meshData->positions.resize((size_t)vertexCount * positionSize);
+	const uint8_t* src = meshData->vertices.data();
+	uint8_t* dst = meshData->positions.data();
+	for (uint32_t i = 0; i < vertexCount; ++i)
+		std::memcpy(dst + (size_t)i * positionSize, src + (size_t)i * vertexSize, positionSize);
+}
 
-	// Create entity and write the transforms
-	glm::mat4 translation = glm::mat4(1.0f);
-	glm::mat4 rotation = glm::mat4(1.0f);
-	glm::mat4 scale = glm::mat4(1.0f);
-	if (node.translation.size() > 0)
-		translation = glm::translate(glm::mat4(1.0f), glm::vec3((float)node.translation[0], (float)node.translation[1], (float)node.translation[2]));
-	if (node.rotation.size() > 0)
-		rotation = glm::mat4_cast(glm::fquat((float)node.rotation[3], (float)node.rotation[0], (float)node.rotation[1], (float)node.rotation[2]));
-	if (node.scale.size() > 0)
-		scale = glm::scale(glm::mat4(1.0f), glm::vec3((float)node.scale[0], (float)node.scale[1], (float)node.scale[2]));
+static void convertPrimitive(const PrimitiveJob& job, Vertex* vertices, uint32_t* indices) {
+	Vertex* dstVertices = vertices + job.vertexOffset;
+	convertPositions(job.positions, job.positionStride, job.vertexCount, dstVertices);
+	convertNormals(job.normals, job.normalStride, job.vertexCount, dstVertices);
+	convertUVs(job.uvs, job.uvStride, job.vertexCount, dstVertices);
+	convertIndices(job.indices, job.indexComponentType, job.indexCount, indices + job.indexOffset);
+}
 
-	glm::mat4 transform = translation * rotation * scale;
-	// Update MeshData
-	if (node.mesh >= 0) {
-		tinygltf::Mesh& mesh = model->meshes[node.mesh];
-		parseMesh(model, mesh, vertices, indices, meshGroup, transform);
+static bool hasValidIndices(const PrimitiveJob& job, const uint32_t* indices) {
+	const uint32_t* primitiveIndices = indices + job.indexOffset;
+	for (uint32_t i = 0; i < job.indexCount; ++i) {
+		if (primitiveIndices[i] >= job.vertexCount)
+			return false;
 	}
+	return true;
+}
+
+// ACMR before and after. Primitives with out of range indices are left as
+// they are and report 0, the cache simulation cannot index their vertices.
+static glm::vec2 optimizePrimitive(const PrimitiveJob& job, Vertex* vertices, uint32_t* indices) {
+	if (!hasValidIndices(job, indices))
+		return glm::vec2(0.0f);
+
+	Vertex* dstVertices = vertices + job.vertexOffset;
+	uint32_t* dstIndices = indices + job.indexOffset;
 
-	for (auto child : node.children)
-		parseNodeHierarchy(model, child, vertices, indices, meshGroup);
+	float before = MeshOptimizer::ComputeACMR(dstIndices, job.indexCount, job.vertexCount);
+	MeshOptimizer::OptimizeVertexCache(dstIndices, job.indexCount, job.vertexCount);
+	MeshOptimizer::OptimizeOverdraw(dstIndices, job.indexCount, dstVertices, job.vertexCount);
+	MeshOptimizer::OptimizeVertexFetch(dstVertices, job.vertexCount, dstIndices, job.indexCount);
+	return glm::vec2(before, MeshOptimizer::ComputeACMR(dstIndices, job.indexCount, job.vertexCount));
 }
 
-void parseScene(tinygltf::Model* model,
-	tinygltf::Scene* scene,
-	std::vector<Vertex>& vertices,
-	std::vector<unsigned int>& indices,
-	MeshGroup* meshGroup)
-{
-	for (auto node : scene->nodes)
-		parseNodeHierarchy(model, node, vertices, indices, meshGroup);
+// LOD 1 and up of one primitive, LOD 0 stays where it is in the index buffer
+struct PrimitiveLods {
+	std::vector<uint32_t> indices[MAX_LOD_COUNT];
+	float errors[MAX_LOD_COUNT] = {};
+	uint32_t count = 1;
+};
+
+// Every LOD halves the triangle count of the source primitive. The chain stops
+// early once the simplifier cannot make real progress, e.g. on locked seams.
+static void simplifyPrimitive(const PrimitiveJob& job, const Vertex* vertices, const uint32_t* indices, PrimitiveLods* lods) {
+	if (!hasValidIndices(job, indices)) return;
+
+	const uint32_t* source = indices + job.indexOffset;
+	const Vertex* sourceVertices = vertices + job.vertexOffset;
+	uint32_t previousCount = job.indexCount;
+	for (uint32_t lod = 1; lod < MAX_LOD_COUNT; ++lod) {
+		uint32_t target = (job.indexCount >> lod) / 3 * 3;
+		// Small primitives are cheap enough at full detail
+		if (target < MESHLET_MAX_TRIANGLES * 3) break;
+
+		std::vector<uint32_t>& lodIndices = lods->indices[lod];
+		lodIndices.resize(job.indexCount);
+		uint32_t count = MeshOptimizer::SimplifyMesh(lodIndices.data(), source, job.indexCount, sourceVertices, job.vertexCount, target, &lods->errors[lod]);
+		if (count * 4 > previousCount * 3) {
+			lodIndices.clear();
+			break;
+		}
+
+		lodIndices.resize(count);
+		MeshOptimizer::OptimizeVertexCache(lodIndices.data(), count, job.vertexCount);
+		lods->errors[lod] = std::max(lods->errors[lod], lods->errors[lod - 1]);
+		lods->count = lod + 1;
+		previousCount = count;
+	}
+}
+
+void InitializeDrawLods(MeshGroup* meshGroup) {
+	meshGroup->lods.resize(meshGroup->drawCommands.size());
+	for (uint32_t drawIndex = 0; drawIndex < meshGroup->drawCommands.size(); ++drawIndex) {
+		const DrawElementsIndirectCommand& drawCommand = meshGroup->drawCommands[drawIndex];
+		const AABB& aabb = meshGroup->aabbs[drawIndex];
+		DrawLods drawLods = {};
+		drawLods.sphere = glm::vec4((aabb.min + aabb.max) * 0.5f, glm::length(aabb.max - aabb.min) * 0.5f);
+		drawLods.lods[0] = MeshLod{ drawCommand.firstIndex_, drawCommand.count_, 0.0f, 0 };
+		drawLods.lodCount = 1;
+		drawLods.baseVertex = drawCommand.baseVertex_;
+		meshGroup->lods[drawIndex] = drawLods;
+	}
+}
+
+// Primitives with out of range indices get a single meshlet that is never culled
+static void buildPrimitiveMeshlets(const PrimitiveJob& job, uint32_t drawIndex, const DrawLods& drawLods, const Vertex* vertices, const uint32_t* indices, std::vector<Meshlet>& meshlets) {
+	bool valid = hasValidIndices(job, indices);
+	for (uint32_t lod = 0; lod < drawLods.lodCount; ++lod) {
+		const MeshLod& meshLod = drawLods.lods[lod];
+		size_t firstMeshlet = meshlets.size();
+		if (valid) {
+			MeshOptimizer::BuildMeshlets(indices + meshLod.firstIndex, meshLod.indexCount, vertices + job.vertexOffset, job.vertexCount, meshlets);
+		}
+		else {
+			Meshlet meshlet = {};
+			meshlet.sphere = glm::vec4(0.0f, 0.0f, 0.0f, 1e30f);
+			meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 2.0f);
+			meshlet.indexCount = meshLod.indexCount;
+			meshlets.push_back(meshlet);
+		}
+
+		for (size_t i = firstMeshlet; i < meshlets.size(); ++i) {
+			meshlets[i].firstIndex += meshLod.firstIndex;
+			meshlets[i].baseVertex = job.vertexOffset;
+			meshlets[i].drawIndex = drawIndex;
+			meshlets[i].lod = lod;
+		}
+	}
+}
+
+// .bin files the model reads its geometry from, relative to the glTF
+static std::vector<std::string> getExternalBuffers(tinygltf::Model* model) {
+	std::vector<std::string> buffers;
+	for (auto& buffer : model->buffers) {
+		if (buffer.uri.empty() || tinygltf::IsDataURI(buffer.uri))
+			continue;
+		std::string path;
+		if (!tinygltf::URIDecode(buffer.uri, &path, nullptr))
+			path = buffer.uri;
+		buffers.push_back(path);
+	}
+	return buffers;
 }
 
-void LoadMesh(const std::string& filename, MeshGroup* meshGroup) {
+// Parses the glTF into CPU arrays on the calling thread and refreshes the cache
+static bool parseGLTF(const std::string& filename, MeshGroup* meshGroup, MeshData* meshData, const MeshLoadOptions& options) {
+	Utils::Timer timer;
 	tinygltf::TinyGLTF loader;
 	tinygltf::Model model;
 	std::string err, warn;
@@ -285,72 +637,204 @@ void LoadMesh(const std::string& filename, MeshGroup* meshGroup) {
 			if (!warn.empty()) logger::Warn(warn);
 			if (!err.empty()) logger::Error(err);
 			logger::Error("Failed to load file: " + filename);
-			return;
+			return false;
 		}
 	}
 
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
-
-	for (auto& scene : model.scenes)
-		parseScene(&model, &scene, vertices, indices, meshGroup);
-
-	// Upload data
-	uint32_t vertexSize = (uint32_t)(sizeof(Vertex) * vertices.size());
-	meshGroup->vertexBuffer.init(vertices.data(), vertexSize, 0);
-
-	uint32_t indexSize = (uint32_t)(indices.size() * sizeof(uint32_t));
-	meshGroup->indexBuffer.init(indices.data(), indexSize, 0);
-
-	uint32_t transformSize = (uint32_t)(meshGroup->transforms.size() * sizeof(glm::mat4));
-	meshGroup->transformBuffer.init(meshGroup->transforms.data(), transformSize, GL_DYNAMIC_STORAGE_BIT);
+	float parseTime = timer.Lap();
+
+	std::vector<std::pair<int, uint32_t>> meshNodes;
+	flattenNodes(&model, &meshGroup->hierarchy, meshNodes);
+
+	std::vector<PrimitiveJob> jobs;
+	std::vector<std::vector<uint32_t>> drawInstances;
+	uint32_t totalVertices = 0, totalIndices = 0;
+	buildPrimitiveJobs(&model, meshNodes, jobs, meshGroup, drawInstances, &totalVertices, &totalIndices);
+	collectTextures(&model, filename, meshGroup);
+
+	// Converted straight into the upload blobs
+	meshData->vertices.resize(totalVertices * sizeof(Vertex));
+	meshData->indices.resize(totalIndices * sizeof(uint32_t));
+	Vertex* vertices = reinterpret_cast<Vertex*>(meshData->vertices.data());
+	uint32_t* indices = reinterpret_cast<uint32_t*>(meshData->indices.data());
+	uint32_t drawCount = (uint32_t)jobs.size();
+	float countTime = timer.Lap();
+
+	JobSystem::Context context;
+	JobSystem::Dispatch(context, drawCount, 1, [&](uint32_t drawIndex) {
+		convertPrimitive(jobs[drawIndex], vertices, indices);
+	});
+	JobSystem::Wait(context);
+	float convertTime = timer.Lap();
+
+	if (options.optimizeIndices) {
+		std::vector<glm::vec2> acmr(drawCount);
+		JobSystem::Dispatch(context, drawCount, 1, [&](uint32_t drawIndex) {
+			acmr[drawIndex] = optimizePrimitive(jobs[drawIndex], vertices, indices);
+		});
+		JobSystem::Wait(context);
+
+		glm::vec2 total(0.0f);
+		for (uint32_t drawIndex = 0; drawIndex < drawCount; ++drawIndex) {
+			total += acmr[drawIndex] * float(jobs[drawIndex].indexCount / 3);
+			logger::Debug("  primitive " + std::to_string(drawIndex) + " (" + meshGroup->names[drawIndex] + "): ACMR " +
+				std::to_string(acmr[drawIndex].x) + " -> " + std::to_string(acmr[drawIndex].y));
+		}
+		total /= float(std::max(totalIndices / 3, 1u));
+		logger::Debug("Optimized " + std::to_string(drawCount) + " primitives: ACMR " + std::to_string(total.x) + " -> " + std::to_string(total.y));
+	}
+	float optimizeTime = timer.Lap();
+
+	InitializeDrawLods(meshGroup);
+	uint32_t lodIndexCount = 0;
+	if (options.generateLods) {
+		std::vector<PrimitiveLods> primitiveLods(drawCount);
+		JobSystem::Dispatch(context, drawCount, 1, [&](uint32_t drawIndex) {
+			simplifyPrimitive(jobs[drawIndex], vertices, indices, &primitiveLods[drawIndex]);
+		});
+		JobSystem::Wait(context);
+
+		for (auto& lods : primitiveLods) {
+			for (uint32_t lod = 1; lod < lods.count; ++lod)
+				lodIndexCount += (uint32_t)lods.indices[lod].size();
+		}
 
-	uint32_t drawCommandSize = (uint32_t)(meshGroup->drawCommands.size() * sizeof(DrawElementsIndirectCommand));
-	meshGroup->drawIndirectBuffer.init(meshGroup->drawCommands.data(), drawCommandSize, GL_DYNAMIC_STORAGE_BIT);
+		// Appended behind every LOD 0, the index blob is reallocated
+		meshData->indices.resize((totalIndices + lodIndexCount) * sizeof(uint32_t));
+		indices = reinterpret_cast<uint32_t*>(meshData->indices.data());
+		uint32_t offset = totalIndices;
+		for (uint32_t drawIndex = 0; drawIndex < drawCount; ++drawIndex) {
+			PrimitiveLods& lods = primitiveLods[drawIndex];
+			DrawLods& drawLods = meshGroup->lods[drawIndex];
+			for (uint32_t lod = 1; lod < lods.count; ++lod) {
+				uint32_t count = (uint32_t)lods.indices[lod].size();
+				std::copy(lods.indices[lod].begin(), lods.indices[lod].end(), indices + offset);
+				drawLods.lods[lod] = MeshLod{ offset, count, lods.errors[lod], 0 };
+				offset += count;
+			}
+			drawLods.lodCount = lods.count;
+		}
+	}
+	float lodTime = timer.Lap();
+
+	// Bounds are taken from the float positions, they stay valid after quantization
+	std::vector<std::vector<Meshlet>> primitiveMeshlets(drawCount);
+	JobSystem::Dispatch(context, drawCount, 1, [&](uint32_t drawIndex) {
+		buildPrimitiveMeshlets(jobs[drawIndex], drawIndex, meshGroup->lods[drawIndex], vertices, indices, primitiveMeshlets[drawIndex]);
+	});
+	JobSystem::Wait(context);
+	meshGroup->meshlets.clear();
+	for (auto& meshlets : primitiveMeshlets)
+		meshGroup->meshlets.insert(meshGroup->meshlets.end(), meshlets.begin(), meshlets.end());
+	float meshletTime = timer.Lap();
+
+	if (options.quantizeVertices)
+		QuantizeMeshData(meshGroup, meshData);
+	else
+		InitializeIdentityDequantization(meshGroup);
+	extractPositions(meshGroup->vertexFormat, meshData);
+	float quantizeTime = timer.Lap();
+
+	expandInstances(meshGroup, drawInstances);
+
+	MeshCache::Write(filename, getExternalBuffers(&model), meshGroup, *meshData, options);
+	float cacheTime = timer.Lap();
+
+	logger::Debug("Parsed " + filename + ": " + std::to_string(drawCount) + " primitives, " + std::to_string(meshGroup->drawCommands.size()) + " draws, " +
+		std::to_string(meshGroup->meshlets.size()) + " meshlets, " +
+		std::to_string(totalVertices) + " vertices, " + std::to_string(totalIndices) + " indices, " + std::to_string(lodIndexCount) + " LOD indices");
+	logger::Debug("  parse " + std::to_string(parseTime) + "ms, count " + std::to_string(countTime) +
+		"ms, convert " + std::to_string(convertTime) + "ms (" + std::to_string(JobSystem::GetThreadCount() + 1) +
+		" threads), optimize " + std::to_string(optimizeTime) + "ms, lods " + std::to_string(lodTime) + "ms, meshlets " + std::to_string(meshletTime) + "ms, quantize " + std::to_string(quantizeTime) + "ms, cache " + std::to_string(cacheTime) + "ms");
+	return true;
+}
 
-	uint32_t materialSize = (uint32_t)(meshGroup->materials.size() * sizeof(Material));
-	meshGroup->materialBuffer.init(meshGroup->materials.data(), materialSize, GL_DYNAMIC_STORAGE_BIT);
+bool ParseMesh(const std::string& filename, MeshGroup* meshGroup, MeshData* meshData, const MeshLoadOptions& options) {
+	if (MeshCache::Read(filename, meshGroup, meshData, options))
+		return true;
+	return parseGLTF(filename, meshGroup, meshData, options);
+}
 
-	glGenVertexArrays(1, &meshGroup->vao);
-	glBindVertexArray(meshGroup->vao);
+bool LoadMesh(const std::string& filename, Scene* scene, MeshGroup* meshGroup, const MeshLoadOptions& options) {
+	// Warm start, skips tinygltf entirely and logs its own timings
+	if (MeshCache::Load(filename, scene, meshGroup, options))
+		return true;
+
+	MeshData meshData;
+	if (!parseGLTF(filename, meshGroup, &meshData, options))
+		return false;
+
+	Utils::Timer timer;
+	scene->textures->ResolveMaterials(meshGroup);
+	scene->geometry->Upload(meshGroup, meshData.vertices.data(), (uint32_t)meshData.vertices.size(),
+		meshData.positions.data(), meshData.indices.data(), (uint32_t)meshData.indices.size());
+	logger::Debug("  upload " + std::to_string(timer.Lap()) + "ms");
+	return true;
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, meshGroup->vertexBuffer.handle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshGroup->indexBuffer.handle);
-	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, meshGroup->drawIndirectBuffer.handle);
-	
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 8, 0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void*)(sizeof(float) * 3));
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void*)(sizeof(float) * 6));
-	glBindVertexArray(0);
+// Writes the transforms and normal matrices of draws [first, first + count)
+static void uploadTransforms(MeshGroup* meshGroup, uint32_t first, uint32_t count) {
+	std::vector<NormalMatrix> normalMatrices(count);
+	ComputeNormalMatrices(&meshGroup->transforms[first], count, normalMatrices.data());
+	GeometryPool* pool = meshGroup->pool;
+	uint32_t drawIndex = meshGroup->firstDraw + first;
+	glNamedBufferSubData(pool->transformBuffer.buffer.handle, drawIndex * sizeof(glm::mat4), count * sizeof(glm::mat4), &meshGroup->transforms[first]);
+	glNamedBufferSubData(pool->normalMatrixBuffer.buffer.handle, drawIndex * sizeof(NormalMatrix), count * sizeof(NormalMatrix), normalMatrices.data());
 }
 
 void MeshGroup::updateTransforms()
 {
-	uint32_t dataSize = (uint32_t)(transforms.size() * sizeof(glm::mat4));
-	glNamedBufferSubData(transformBuffer.handle, 0, dataSize, transforms.data());
+	uploadTransforms(this, 0, (uint32_t)transforms.size());
+}
+
+void MeshGroup::updateHierarchy()
+{
+	changedBounds.clear();
+	std::vector<uint32_t> changedNodes;
+	hierarchy.Update(changedNodes);
+	if (changedNodes.empty()) return;
+
+	// Consecutive changed draws are uploaded as one range
+	uint32_t drawCount = (uint32_t)drawNodes.size();
+	uint32_t rangeStart = drawCount;
+	for (uint32_t drawIndex = 0; drawIndex <= drawCount; ++drawIndex) {
+		bool changed = drawIndex < drawCount && hierarchy.WasChanged(drawNodes[drawIndex]);
+		if (changed) {
+			changedBounds.push_back(TransformAABB(aabbs[drawIndex], transforms[drawIndex]));
+			transforms[drawIndex] = hierarchy.GetWorld(drawNodes[drawIndex]);
+			changedBounds.push_back(TransformAABB(aabbs[drawIndex], transforms[drawIndex]));
+			if (rangeStart == drawCount)
+				rangeStart = drawIndex;
+		}
+		else if (rangeStart != drawCount) {
+			uploadTransforms(this, rangeStart, drawIndex - rangeStart);
+			rangeStart = drawCount;
+		}
+	}
 }
 
 void MeshGroup::updateMaterials()
 {
 	uint32_t dataSize = (uint32_t)materials.size() * sizeof(Material);
-	glNamedBufferSubData(materialBuffer.handle, 0, dataSize, materials.data());
-	/*
-	uint32_t dataSize = (uint32_t)materials.size() * sizeof(Material);
-	Material* material = (Material*)glMapNamedBuffer(materialBuffer.handle, GL_WRITE_ONLY);
-	std::memcpy(material, materials.data(), dataSize);
-	glUnmapNamedBuffer(materialBuffer.handle);
-	*/
+	glNamedBufferSubData(pool->materialBuffer.buffer.handle, firstDraw * sizeof(Material), dataSize, materials.data());
+}
 
+DrawElementsIndirectCommand MeshGroup::getPoolCommand(uint32_t drawIndex) const
+{
+	DrawElementsIndirectCommand drawCommand = drawCommands[drawIndex];
+	drawCommand.instanceCount_ = 1;
+	drawCommand.firstIndex_ += firstIndex;
+	drawCommand.baseVertex_ += baseVertex;
+	drawCommand.baseInstance_ = firstDraw + drawIndex;
+	return drawCommand;
+}
+
+void MeshGroup::Draw(GLProgram* program, VertexStream stream)
+{
+	DrawIndirect(program, pool->drawIndirectBuffer.buffer.handle, stream);
 }
 
-void MeshGroup::Draw(GLProgram* program)
+void MeshGroup::DrawIndirect(GLProgram* program, GLuint commandBuffer, VertexStream stream)
 {
-	glBindVertexArray(vao);
-	program->setBuffer(1, transformBuffer.handle);
-	program->setBuffer(2, materialBuffer.handle);
-	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, (uint32_t)drawCommands.size(), 0);
-	glBindVertexArray(0);
+	pool->DrawIndirect(program, commandBuffer, firstDraw, (uint32_t)drawCommands.size(), stream);
 }
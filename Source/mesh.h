@@ -2,6 +2,7 @@
 
 #include "glm-includes.h"
 #include "gl-utils.h"
+#include "transform-hierarchy.h"
 #include <string>
 #include <vector>
 
@@ -10,6 +11,9 @@ struct AABB {
 	glm::vec3 max;
 };
 
+// Bounds of the transformed box
+AABB TransformAABB(const AABB& aabb, const glm::mat4& transform);
+
 struct Material {
 	glm::vec4 albedo{ 1.0f, 1.0f, 1.0f, 1.0f };
 	glm::vec4 emissive{ 0.0f, 0.0f, 0.0f, 0.0f };
@@ -19,6 +23,8 @@ struct Material {
 	float ao = 1.0f;
 	float transparency = 1.0f;
 
+	// Map slots index the TextureCache handle table, 0 is no texture. Straight
+	// out of ParseMesh they are MeshGroup::textures index + 1 instead
 	uint32_t padding;
 	uint32_t albedoMap = 0;
 	uint32_t normalMap = 0;
@@ -30,25 +36,112 @@ struct Material {
 	uint32_t opacityMap = 0;
 };
 
+enum class VertexFormat : uint32_t {
+	// Vertex, 32 bytes
+	Float = 0,
+	// QuantizedVertex, 16 bytes
+	Quantized = 1,
+};
+
+enum class VertexStream : uint32_t {
+	// Interleaved Vertex or QuantizedVertex
+	Full = 0,
+	// Tightly packed positions for passes that only need depth
+	Position = 1,
+};
+
+// Per draw, position = offset + unorm16 * scale. Identity for VertexFormat::Float
+struct PositionDequantization {
+	glm::vec4 offset;
+	glm::vec4 scale;
+};
+
+static const uint32_t MESHLET_MAX_VERTICES = 64;
+static const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// Consecutive triangles of one draw, culled on the GPU as a unit
+struct Meshlet {
+	// Draw local bounding sphere, w is the radius
+	glm::vec4 sphere;
+	// Normal cone axis and the sine of its spread, w > 1 when the cone cannot cull
+	glm::vec4 cone;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t baseVertex;
+	uint32_t drawIndex;
+	// Only drawn while its draw has this LOD selected
+	uint32_t lod;
+	uint32_t padding[3];
+};
+
+static const uint32_t MAX_LOD_COUNT = 4;
+
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	// Largest deviation from LOD 0 in draw local units
+	float error;
+	uint32_t padding;
+};
+
+// Simplification chain of one draw, LOD 0 is the source primitive. All LODs
+// index the same vertices and share the draw's baseVertex.
+struct DrawLods {
+	// Draw local bounding sphere, w is the radius
+	glm::vec4 sphere;
+	MeshLod lods[MAX_LOD_COUNT];
+	uint32_t lodCount;
+	uint32_t baseVertex;
+	uint32_t padding[2];
+};
+
+struct GeometryPool;
 struct MeshGroup {
-	GLBuffer vertexBuffer;
-	GLBuffer indexBuffer;
-	GLBuffer drawIndirectBuffer;
-	GLBuffer transformBuffer;
-	GLBuffer materialBuffer;
+	// Placement in the SceneGeometry pool, in elements of the pool arrays
+	GeometryPool* pool = nullptr;
+	uint32_t baseVertex = 0;
+	uint32_t firstIndex = 0;
+	uint32_t firstDraw = 0;
+	uint32_t firstMeshlet = 0;
 
-	GLuint vao;
+	// Dynamic groups are re-rendered into shadow maps every frame
+	bool isDynamic = false;
+	VertexFormat vertexFormat = VertexFormat::Float;
+	GLenum indexType = GL_UNSIGNED_INT;
 
+	// Per draw world matrix, mirrors the hierarchy node in drawNodes
 	std::vector<glm::mat4> transforms;
+	// Draw local
 	std::vector<AABB> aabbs;
+	TransformHierarchy hierarchy;
+	std::vector<uint32_t> drawNodes;
+	// World bounds before and after every draw moved by the last updateHierarchy
+	std::vector<AABB> changedBounds;
 	std::vector<DrawElementsIndirectCommand> drawCommands;
 	std::vector<Material> materials;
 	std::vector<std::string> names;
+	// Image paths the material map slots refer to until TextureCache::ResolveMaterials
+	std::vector<std::string> textures;
+	std::vector<PositionDequantization> dequantization;
+	std::vector<Meshlet> meshlets;
+	std::vector<DrawLods> lods;
 
 	void updateTransforms();
+	// Resolves edited hierarchy nodes and uploads the transforms of the draws below them
+	void updateHierarchy();
 	void updateMaterials();
 
-	void Draw(GLProgram* program);
+	// Single instance command of one draw rebased onto the pool, for command lists built on the CPU
+	DrawElementsIndirectCommand getPoolCommand(uint32_t drawIndex) const;
+
+	// Draws only this group out of its pool. Draw commands carry their pool wide
+	// draw index in baseInstance, the shaders index the per draw buffers with
+	// gl_BaseInstanceARB + gl_InstanceID so culled streams keep working. Instances
+	// of a primitive are consecutive draws, drawn by the first one's command
+	void Draw(GLProgram* program, VertexStream stream = VertexStream::Full);
+
+	// Same as Draw with a command buffer of one command per pool draw, e.g. with other LODs selected
+	void DrawIndirect(GLProgram* program, GLuint commandBuffer, VertexStream stream = VertexStream::Full);
 };
 
 struct Vertex {
@@ -57,14 +150,66 @@ struct Vertex {
 	glm::vec2 uv;
 };
 
+struct QuantizedVertex {
+	// unorm16 inside the draw bounds, w is padding
+	uint16_t position[4];
+	// snorm16 octahedral
+	int16_t normal[2];
+	// half floats
+	uint16_t uv[2];
+};
+
+inline uint32_t GetVertexSize(VertexFormat format) {
+	return format == VertexFormat::Quantized ? (uint32_t)sizeof(QuantizedVertex) : (uint32_t)sizeof(Vertex);
+}
+
+// The position leads both vertex layouts, the stream keeps only those bytes
+inline uint32_t GetPositionSize(VertexFormat format) {
+	return format == VertexFormat::Quantized ? (uint32_t)sizeof(QuantizedVertex::position) : (uint32_t)sizeof(Vertex::position);
+}
+
+inline uint32_t GetIndexSize(GLenum indexType) {
+	return indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+struct MeshLoadOptions {
+	// QuantizedVertex layout, plus 16-bit indices if every draw fits
+	bool quantizeVertices = false;
+	// Vertex cache, overdraw and vertex fetch reordering of every primitive
+	bool optimizeIndices = false;
+	// Quadric simplified LODs appended to the index buffer
+	bool generateLods = false;
+
+	// Stored in the mesh cache, a cache built with other options is rebuilt
+	uint32_t GetFlags() const { return (quantizeVertices ? 1u : 0u) | (optimizeIndices ? 2u : 0u) | (generateLods ? 4u : 0u); }
+};
+
+// Vertex and index blobs of a group exactly as they are uploaded
+struct MeshData {
+	std::vector<uint8_t> vertices;
+	// VertexStream::Position copy of vertices
+	std::vector<uint8_t> positions;
+	std::vector<uint8_t> indices;
+};
+
 class Camera;
+class SceneGeometry;
+class TextureCache;
 struct Scene {
 	std::vector<MeshGroup> meshGroup;
+	// GPU side of every group in meshGroup
+	SceneGeometry* geometry;
+	TextureCache* textures;
 	glm::vec3 lightPosition;
 	Camera* camera;
 	GLMesh mLightMesh;
 };
 
-void LoadMesh(const std::string& filename, MeshGroup* meshGroup);
+// Resolves the group's textures and uploads it into the scene geometry, the caller still adds it to Scene::meshGroup
+bool LoadMesh(const std::string& filename, Scene* scene, MeshGroup* meshGroup, const MeshLoadOptions& options = {});
+// CPU only part of LoadMesh, safe to call from a worker thread
+bool ParseMesh(const std::string& filename, MeshGroup* meshGroup, MeshData* meshData, const MeshLoadOptions& options = {});
+// Single LOD chains for groups loaded without generateLods
+void InitializeDrawLods(MeshGroup* meshGroup);
 void InitializePlaneMesh(GLMesh* mesh, int width, int height);
 void InitializeCubeMesh(GLMesh* mesh);
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "point-shadow-map.h"
+
+#include "gl-utils.h"
+#include "gpu-query.h"
+#include "imgui-service.h"
+
+#include <string>
+
+void PointShadowMap::Initialize(uint32_t resolution, float farPlane)
+{
+	mResolution = resolution;
+	mFarPlane = farPlane;
+
+	TextureCreateInfo createInfo = {};
+	createInfo.width = createInfo.height = resolution;
+	createInfo.format = GL_DEPTH_COMPONENT;
+	createInfo.internalFormat = GL_DEPTH_COMPONENT32F;
+	createInfo.target = GL_TEXTURE_CUBE_MAP;
+	createInfo.dataType = GL_FLOAT;
+	createInfo.minFilterType = createInfo.magFilterType = GL_NEAREST;
+
+	mStaticShadowMap = std::make_unique<GLTexture>();
+	mStaticShadowMap->init(&createInfo);
+	mCompositeShadowMap = std::make_unique<GLTexture>();
+	mCompositeShadowMap->init(&createInfo);
+
+	glCreateFramebuffers(1, &mStaticFramebuffer);
+	glNamedFramebufferTexture(mStaticFramebuffer, GL_DEPTH_ATTACHMENT, mStaticShadowMap->handle, 0);
+	glNamedFramebufferDrawBuffer(mStaticFramebuffer, GL_NONE);
+
+	glCreateFramebuffers(1, &mCompositeFramebuffer);
+	glNamedFramebufferTexture(mCompositeFramebuffer, GL_DEPTH_ATTACHMENT, mCompositeShadowMap->handle, 0);
+	glNamedFramebufferDrawBuffer(mCompositeFramebuffer, GL_NONE);
+
+	mProgram = std::make_unique<GLProgram>();
+	mProgram->init(GLShader("Assets/Shaders/point-shadow.vert"), GLShader("Assets/Shaders/point-shadow.frag"), GLShader("Assets/Shaders/point-shadow.geom"));
+}
+
+void PointShadowMap::RenderCasters(Scene* scene, GLuint framebuffer, bool dynamic, bool clear)
+{
+	static const glm::vec3 FACE_DIRECTIONS[6] = {
+		{ 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f },
+		{ 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+	};
+	static const glm::vec3 FACE_UPS[6] = {
+		{ 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+		{ 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+	};
+
+	glm::vec3 lightPosition = scene->lightPosition;
+	glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.01f, mFarPlane);
+	glm::mat4 faceVP[6];
+	for (int i = 0; i < 6; ++i)
+		faceVP[i] = projection * glm::lookAt(lightPosition, lightPosition + FACE_DIRECTIONS[i], FACE_UPS[i]);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, mResolution, mResolution);
+	if (clear)
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+	mProgram->bind();
+	mProgram->setMat4("uFaceVP", &faceVP[0][0][0], 6);
+	mProgram->setVec3("uLightPosition", &lightPosition[0]);
+	mProgram->setFloat("uFarPlane", mFarPlane);
+	for (auto& meshGroup : scene->meshGroup) {
+		if (meshGroup.isDynamic == dynamic)
+			meshGroup.Draw(mProgram.get(), VertexStream::Position);
+	}
+	mProgram->unbind();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool PointShadowMap::Render(Scene* scene)
+{
+	bool lightMoved = scene->lightPosition != mCachedLightPosition;
+	bool staticUpdated = mStaticDirty || lightMoved;
+	mStaticChanged = staticUpdated;
+
+	mHasDynamicCasters = false;
+	for (auto& meshGroup : scene->meshGroup)
+		mHasDynamicCasters |= meshGroup.isDynamic;
+
+	if (!staticUpdated && !mHasDynamicCasters) return false;
+
+	glDepthMask(GL_TRUE);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glDisable(GL_CULL_FACE);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+	if (staticUpdated) {
+		GpuProfiler::Begin("Point Shadow Static");
+		RenderCasters(scene, mStaticFramebuffer, false, true);
+		GpuProfiler::End();
+		mCachedLightPosition = scene->lightPosition;
+		mStaticDirty = false;
+	}
+
+	if (mHasDynamicCasters) {
+		GpuProfiler::Begin("Point Shadow Dynamic");
+		glCopyImageSubData(mStaticShadowMap->handle, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0,
+			mCompositeShadowMap->handle, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0,
+			mResolution, mResolution, 6);
+		RenderCasters(scene, mCompositeFramebuffer, true, false);
+		GpuProfiler::End();
+	}
+
+	glEnable(GL_CULL_FACE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	return staticUpdated || mHasDynamicCasters;
+}
+
+uint32_t PointShadowMap::GetShadowMap()
+{
+	return mHasDynamicCasters ? mCompositeShadowMap->handle : mStaticShadowMap->handle;
+}
+
+uint32_t PointShadowMap::GetStaticShadowMap()
+{
+	return mStaticShadowMap->handle;
+}
+
+void PointShadowMap::AddUI(Scene* scene)
+{
+	for (uint32_t i = 0; i < scene->meshGroup.size(); ++i) {
+		std::string label = "Dynamic Shadow Caster " + std::to_string(i);
+		// Moving a group between layers changes the static casters
+		if (ImGui::Checkbox(label.c_str(), &scene->meshGroup[i].isDynamic))
+			Invalidate();
+	}
+}
+
+void PointShadowMap::Destroy()
+{
+	glDeleteFramebuffers(1, &mStaticFramebuffer);
+	glDeleteFramebuffers(1, &mCompositeFramebuffer);
+	mStaticShadowMap->destroy();
+	mCompositeShadowMap->destroy();
+	mProgram->destroy();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+#include "mesh.h"
+
+class GLProgram;
+
+/*
+* Omnidirectional shadow map for the scene point light, storing linear
+* distance to the light. Static casters live in their own cubemap that is
+* only re-rendered when the light moves, dynamic casters are composited on
+* top of a copy of it every frame.
+*/
+class PointShadowMap {
+
+public:
+	void Initialize(uint32_t resolution, float farPlane = 50.0f);
+
+	// Returns true if the map returned by GetShadowMap changed this frame,
+	// either the static layer or the dynamic composite was re-rendered
+	bool Render(Scene* scene);
+
+	uint32_t GetShadowMap();
+
+	// Static casters only
+	uint32_t GetStaticShadowMap();
+
+	// True if the last Render re-rendered the static layer
+	bool StaticChanged() { return mStaticChanged; }
+
+	float GetFarPlane() { return mFarPlane; }
+
+	void Invalidate() { mStaticDirty = true; }
+
+	// Toggles which mesh groups are treated as dynamic casters
+	void AddUI(Scene* scene);
+
+	void Destroy();
+
+private:
+	void RenderCasters(Scene* scene, GLuint framebuffer, bool dynamic, bool clear);
+
+	uint32_t mResolution;
+	float mFarPlane;
+	bool mStaticDirty = true;
+	bool mStaticChanged = false;
+	bool mHasDynamicCasters = false;
+	glm::vec3 mCachedLightPosition{ 0.0f };
+
+	GLuint mStaticFramebuffer, mCompositeFramebuffer;
+	std::unique_ptr<GLTexture> mStaticShadowMap, mCompositeShadowMap;
+	std::unique_ptr<GLProgram> mProgram;
+};
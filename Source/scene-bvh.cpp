@@ -0,0 +1,415 @@
+#include "scene-bvh.h"
+
+#include "imgui-service.h"
+#include "job-system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <numeric>
+
+static const uint32_t BIN_COUNT = 16;
+// Leaves are only forced below this size when splitting costs more than testing every draw
+static const uint32_t MAX_LEAF_SIZE = 4;
+static const uint32_t PARALLEL_BUILD_SIZE = 1024;
+// Draws per bounds job, fewer draws are transformed inline
+static const uint32_t PARALLEL_BOUNDS_SIZE = 1024;
+static const float REBUILD_COST_RATIO = 1.5f;
+// Cost of visiting an inner node relative to testing one draw
+static const float TRAVERSAL_COST = 1.0f;
+
+struct SceneBVH::BuildContext {
+	JobSystem::Context jobs;
+	std::atomic<uint32_t> nodeCount{ 1 };
+};
+
+static AABB EmptyAABB()
+{
+	return AABB{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+}
+
+static void Grow(AABB& aabb, const AABB& other)
+{
+	aabb.min = glm::min(aabb.min, other.min);
+	aabb.max = glm::max(aabb.max, other.max);
+}
+
+static float SurfaceArea(const AABB& aabb)
+{
+	glm::vec3 extent = glm::max(aabb.max - aabb.min, glm::vec3(0.0f));
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static bool Overlaps(const AABB& a, const AABB& b)
+{
+	return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::greaterThanEqual(a.max, b.min));
+}
+
+// 0 outside, 1 intersecting, 2 inside every plane
+static int ClassifyBox(const AABB& aabb, const glm::vec4* planes)
+{
+	int result = 2;
+	for (int i = 0; i < 6; ++i) {
+		const glm::vec4& plane = planes[i];
+		glm::vec3 p{ plane.x > 0.0f ? aabb.max.x : aabb.min.x, plane.y > 0.0f ? aabb.max.y : aabb.min.y, plane.z > 0.0f ? aabb.max.z : aabb.min.z };
+		glm::vec3 n{ plane.x > 0.0f ? aabb.min.x : aabb.max.x, plane.y > 0.0f ? aabb.min.y : aabb.max.y, plane.z > 0.0f ? aabb.min.z : aabb.max.z };
+		if (glm::dot(glm::vec3(plane), p) + plane.w < 0.0f)
+			return 0;
+		if (glm::dot(glm::vec3(plane), n) + plane.w < 0.0f)
+			result = 1;
+	}
+	return result;
+}
+
+static bool IntersectBox(const Ray& ray, const AABB& aabb, float& tEntry)
+{
+	glm::vec2 t;
+	if (!Utils::RayBoxIntersection(ray, aabb.min, aabb.max, t) || t.y < 0.0f)
+		return false;
+	tEntry = std::max(t.x, 0.0f);
+	return true;
+}
+
+void SceneBVH::UpdateDrawBounds(Scene* scene)
+{
+	uint32_t drawCount = (uint32_t)mDraws.size();
+	mDrawBounds.resize(drawCount);
+	mCentroids.resize(drawCount);
+
+	auto updateBounds = [&](uint32_t index) {
+		const DrawRef& draw = mDraws[index];
+		const MeshGroup& meshGroup = scene->meshGroup[draw.group];
+		AABB bounds = TransformAABB(meshGroup.aabbs[draw.draw], meshGroup.transforms[draw.draw]);
+		mDrawBounds[index] = bounds;
+		mCentroids[index] = (bounds.min + bounds.max) * 0.5f;
+	};
+	if (drawCount <= PARALLEL_BOUNDS_SIZE) {
+		for (uint32_t index = 0; index < drawCount; ++index)
+			updateBounds(index);
+		return;
+	}
+
+	JobSystem::Context context;
+	JobSystem::Dispatch(context, drawCount, PARALLEL_BOUNDS_SIZE, updateBounds);
+	JobSystem::Wait(context);
+}
+
+void SceneBVH::Build(Scene* scene)
+{
+	Utils::Timer timer;
+	mDraws.clear();
+	mGroupDrawCounts.clear();
+	for (uint32_t groupIndex = 0; groupIndex < scene->meshGroup.size(); ++groupIndex) {
+		const MeshGroup& meshGroup = scene->meshGroup[groupIndex];
+		uint32_t drawCount = (uint32_t)meshGroup.drawCommands.size();
+		mGroupDrawCounts.push_back(drawCount);
+		if (meshGroup.aabbs.size() < drawCount) continue;
+		for (uint32_t drawIndex = 0; drawIndex < drawCount; ++drawIndex)
+			mDraws.push_back(DrawRef{ groupIndex, drawIndex });
+	}
+	UpdateDrawBounds(scene);
+
+	uint32_t drawCount = (uint32_t)mDraws.size();
+	mIndices.resize(drawCount);
+	std::iota(mIndices.begin(), mIndices.end(), 0);
+	mNodes.clear();
+	if (drawCount > 0) {
+		// A binary tree with one draw per leaf is the upper bound
+		mNodes.resize(2 * drawCount - 1);
+		BuildContext context;
+		BuildNode(context, 0, 0, drawCount);
+		JobSystem::Wait(context.jobs);
+		mNodes.resize(context.nodeCount);
+	}
+
+	mBuildCost = mCost = ComputeCost();
+	mBuildTime = timer.Lap();
+}
+
+void SceneBVH::BuildNode(BuildContext& context, uint32_t nodeIndex, uint32_t begin, uint32_t end)
+{
+	Node& node = mNodes[nodeIndex];
+	node.bounds = EmptyAABB();
+	AABB centroidBounds = EmptyAABB();
+	for (uint32_t i = begin; i < end; ++i) {
+		Grow(node.bounds, mDrawBounds[mIndices[i]]);
+		Grow(centroidBounds, AABB{ mCentroids[mIndices[i]], mCentroids[mIndices[i]] });
+	}
+	uint32_t count = end - begin;
+	node.first = begin;
+	node.count = count;
+	if (count == 1) return;
+
+	// Binned SAH over all three axes, the split is between bins bestSplit - 1 and bestSplit
+	glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	uint32_t bestSplit = 0;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (extent[axis] <= 0.0f) continue;
+
+		AABB binBounds[BIN_COUNT];
+		uint32_t binCounts[BIN_COUNT] = {};
+		for (auto& bounds : binBounds)
+			bounds = EmptyAABB();
+		float scale = BIN_COUNT / extent[axis];
+		for (uint32_t i = begin; i < end; ++i) {
+			uint32_t index = mIndices[i];
+			uint32_t bin = std::min(BIN_COUNT - 1, (uint32_t)((mCentroids[index][axis] - centroidBounds.min[axis]) * scale));
+			binCounts[bin]++;
+			Grow(binBounds[bin], mDrawBounds[index]);
+		}
+
+		float rightAreas[BIN_COUNT];
+		uint32_t rightCounts[BIN_COUNT];
+		AABB right = EmptyAABB();
+		uint32_t rightCount = 0;
+		for (uint32_t bin = BIN_COUNT - 1; bin > 0; --bin) {
+			Grow(right, binBounds[bin]);
+			rightCount += binCounts[bin];
+			rightAreas[bin] = SurfaceArea(right);
+			rightCounts[bin] = rightCount;
+		}
+
+		AABB left = EmptyAABB();
+		uint32_t leftCount = 0;
+		for (uint32_t split = 1; split < BIN_COUNT; ++split) {
+			Grow(left, binBounds[split - 1]);
+			leftCount += binCounts[split - 1];
+			if (leftCount == 0 || rightCounts[split] == 0) continue;
+			float cost = leftCount * SurfaceArea(left) + rightCounts[split] * rightAreas[split];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	float area = SurfaceArea(node.bounds);
+	bool splitPays = bestAxis >= 0 && TRAVERSAL_COST * area + bestCost < count * area;
+	if (!splitPays && count <= MAX_LEAF_SIZE) return;
+
+	uint32_t middle;
+	if (bestAxis >= 0) {
+		float scale = BIN_COUNT / extent[bestAxis];
+		float minCentroid = centroidBounds.min[bestAxis];
+		auto it = std::partition(mIndices.begin() + begin, mIndices.begin() + end, [&](uint32_t index) {
+			return std::min(BIN_COUNT - 1, (uint32_t)((mCentroids[index][bestAxis] - minCentroid) * scale)) < bestSplit;
+		});
+		middle = (uint32_t)(it - mIndices.begin());
+	}
+	else {
+		// Every centroid coincides, any split is as good as another
+		middle = begin + count / 2;
+	}
+
+	uint32_t children = context.nodeCount.fetch_add(2);
+	node.first = children;
+	node.count = 0;
+	if (count > PARALLEL_BUILD_SIZE) {
+		JobSystem::Execute(context.jobs, [this, &context, children, begin, middle]() {
+			BuildNode(context, children, begin, middle);
+		});
+		BuildNode(context, children + 1, middle, end);
+	}
+	else {
+		BuildNode(context, children, begin, middle);
+		BuildNode(context, children + 1, middle, end);
+	}
+}
+
+void SceneBVH::Refit(Scene* scene)
+{
+	Utils::Timer timer;
+	UpdateDrawBounds(scene);
+	// Children always follow their parent
+	for (int32_t nodeIndex = (int32_t)mNodes.size() - 1; nodeIndex >= 0; --nodeIndex) {
+		Node& node = mNodes[nodeIndex];
+		if (node.count > 0) {
+			node.bounds = EmptyAABB();
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+				Grow(node.bounds, mDrawBounds[mIndices[i]]);
+		}
+		else {
+			node.bounds = mNodes[node.first].bounds;
+			Grow(node.bounds, mNodes[node.first + 1].bounds);
+		}
+	}
+	mCost = ComputeCost();
+	mRefitTime = timer.Lap();
+}
+
+void SceneBVH::Update(Scene* scene)
+{
+	bool drawSetChanged = scene->meshGroup.size() != mGroupDrawCounts.size();
+	bool moved = false;
+	for (uint32_t groupIndex = 0; groupIndex < scene->meshGroup.size(); ++groupIndex) {
+		const MeshGroup& meshGroup = scene->meshGroup[groupIndex];
+		if (!drawSetChanged && mGroupDrawCounts[groupIndex] != meshGroup.drawCommands.size())
+			drawSetChanged = true;
+		moved |= !meshGroup.changedBounds.empty();
+	}
+
+	if (drawSetChanged) {
+		Build(scene);
+		return;
+	}
+	if (!moved) return;
+
+	Refit(scene);
+	if (mCost > mBuildCost * REBUILD_COST_RATIO)
+		Build(scene);
+}
+
+float SceneBVH::ComputeCost() const
+{
+	if (mNodes.empty()) return 0.0f;
+	float rootArea = SurfaceArea(mNodes[0].bounds);
+	if (rootArea <= 0.0f) return 0.0f;
+
+	float cost = 0.0f;
+	for (const Node& node : mNodes) {
+		float area = SurfaceArea(node.bounds) / rootArea;
+		cost += node.count > 0 ? area * node.count : area * TRAVERSAL_COST;
+	}
+	return cost;
+}
+
+void SceneBVH::CollectLeaves(uint32_t nodeIndex, std::vector<DrawRef>& draws) const
+{
+	const Node& node = mNodes[nodeIndex];
+	if (node.count > 0) {
+		for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			draws.push_back(mDraws[mIndices[i]]);
+		return;
+	}
+	CollectLeaves(node.first, draws);
+	CollectLeaves(node.first + 1, draws);
+}
+
+void SceneBVH::QueryFrustum(const glm::vec4* frustumPlanes, std::vector<DrawRef>& draws) const
+{
+	if (mNodes.empty()) return;
+
+	std::vector<uint32_t> stack{ 0 };
+	while (!stack.empty()) {
+		const Node& node = mNodes[stack.back()];
+		uint32_t nodeIndex = stack.back();
+		stack.pop_back();
+
+		int classification = ClassifyBox(node.bounds, frustumPlanes);
+		if (classification == 0) continue;
+		if (classification == 2) {
+			// Everything below is inside as well
+			CollectLeaves(nodeIndex, draws);
+			continue;
+		}
+
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (ClassifyBox(mDrawBounds[mIndices[i]], frustumPlanes) != 0)
+					draws.push_back(mDraws[mIndices[i]]);
+			}
+		}
+		else {
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+		}
+	}
+}
+
+void SceneBVH::QueryOverlap(const AABB& bounds, std::vector<DrawRef>& draws) const
+{
+	if (mNodes.empty()) return;
+
+	std::vector<uint32_t> stack{ 0 };
+	while (!stack.empty()) {
+		const Node& node = mNodes[stack.back()];
+		stack.pop_back();
+		if (!Overlaps(node.bounds, bounds)) continue;
+
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (Overlaps(mDrawBounds[mIndices[i]], bounds))
+					draws.push_back(mDraws[mIndices[i]]);
+			}
+		}
+		else {
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+		}
+	}
+}
+
+bool SceneBVH::RayCast(const Ray& ray, RayHit& hit) const
+{
+	if (mNodes.empty()) return false;
+
+	bool found = false;
+	hit.t = FLT_MAX;
+	std::vector<uint32_t> stack{ 0 };
+	while (!stack.empty()) {
+		const Node& node = mNodes[stack.back()];
+		stack.pop_back();
+		float t;
+		if (!IntersectBox(ray, node.bounds, t) || t >= hit.t) continue;
+
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (IntersectBox(ray, mDrawBounds[mIndices[i]], t) && t < hit.t) {
+					hit = RayHit{ mDraws[mIndices[i]], t };
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		// The nearer child is popped first so its hit prunes the other
+		float tLeft = FLT_MAX, tRight = FLT_MAX;
+		IntersectBox(ray, mNodes[node.first].bounds, tLeft);
+		IntersectBox(ray, mNodes[node.first + 1].bounds, tRight);
+		if (tLeft < tRight) {
+			stack.push_back(node.first + 1);
+			stack.push_back(node.first);
+		}
+		else {
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+		}
+	}
+	return found;
+}
+
+void SceneBVH::RayCastAll(const Ray& ray, std::vector<RayHit>& hits) const
+{
+	if (mNodes.empty()) return;
+
+	uint32_t firstHit = (uint32_t)hits.size();
+	std::vector<uint32_t> stack{ 0 };
+	while (!stack.empty()) {
+		const Node& node = mNodes[stack.back()];
+		stack.pop_back();
+		float t;
+		if (!IntersectBox(ray, node.bounds, t)) continue;
+
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (IntersectBox(ray, mDrawBounds[mIndices[i]], t))
+					hits.push_back(RayHit{ mDraws[mIndices[i]], t });
+			}
+		}
+		else {
+			stack.push_back(node.first);
+			stack.push_back(node.first + 1);
+		}
+	}
+	std::sort(hits.begin() + firstHit, hits.end(), [](const RayHit& a, const RayHit& b) { return a.t < b.t; });
+}
+
+void SceneBVH::AddUI()
+{
+	ImGui::Text("BVH: %d draws, %d nodes", (uint32_t)mDraws.size(), (uint32_t)mNodes.size());
+	ImGui::Text("BVH Build: %.3f ms, Refit: %.3f ms", mBuildTime, mRefitTime);
+	ImGui::Text("BVH SAH Cost: %.2f (%.2f at build)", mCost, mBuildCost);
+}
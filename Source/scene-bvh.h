@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "mesh.h"
+#include "utils.h"
+
+// One draw of Scene::meshGroup
+struct DrawRef {
+	uint32_t group;
+	uint32_t draw;
+};
+
+struct RayHit {
+	DrawRef draw;
+	// Entry distance along the ray, 0 when the origin is inside the box
+	float t;
+};
+
+/*
+* Binned SAH BVH over the world AABBs of every scene draw. Draws of groups
+* without bounds are left out. Node children are allocated in pairs after
+* their parent, so a reverse walk over the nodes refits the tree bottom up
+* when transforms change. Update rebuilds when the draw set changes or the
+* refitted tree has degraded past REBUILD_COST_RATIO of its built SAH cost.
+* Picking is against draw bounds, not triangles.
+*/
+class SceneBVH {
+
+public:
+	// Subtrees larger than PARALLEL_BUILD_SIZE draws are built on the JobSystem
+	void Build(Scene* scene);
+
+	// Same topology, bounds recomputed from the current transforms
+	void Refit(Scene* scene);
+
+	// Rebuilds or refits after loading and hierarchy updates of this frame
+	void Update(Scene* scene);
+
+	void QueryFrustum(const glm::vec4* frustumPlanes, std::vector<DrawRef>& draws) const;
+
+	void QueryOverlap(const AABB& bounds, std::vector<DrawRef>& draws) const;
+
+	// Nearest draw along the ray
+	bool RayCast(const Ray& ray, RayHit& hit) const;
+
+	// Every draw along the ray, sorted by distance
+	void RayCastAll(const Ray& ray, std::vector<RayHit>& hits) const;
+
+	uint32_t GetDrawCount() const { return (uint32_t)mDraws.size(); }
+
+	void AddUI();
+
+private:
+	struct Node {
+		AABB bounds;
+		// Leaves index mIndices[first, first + count), inner nodes have children first and first + 1
+		uint32_t first;
+		uint32_t count;
+	};
+
+	// Node allocation and pending jobs of one Build
+	struct BuildContext;
+
+	void UpdateDrawBounds(Scene* scene);
+	void BuildNode(BuildContext& context, uint32_t nodeIndex, uint32_t begin, uint32_t end);
+	// Expected traversal cost relative to the root surface area
+	float ComputeCost() const;
+	void CollectLeaves(uint32_t nodeIndex, std::vector<DrawRef>& draws) const;
+
+	std::vector<Node> mNodes;
+	std::vector<uint32_t> mIndices;
+	std::vector<DrawRef> mDraws;
+	std::vector<AABB> mDrawBounds;
+	std::vector<glm::vec3> mCentroids;
+	// Draw count of every group at the last Build
+	std::vector<uint32_t> mGroupDrawCounts;
+
+	float mBuildCost = 0.0f;
+	float mCost = 0.0f;
+	float mBuildTime = 0.0f;
+	float mRefitTime = 0.0f;
+};
@@ -0,0 +1,290 @@
+#include "scene-geometry.h"
+
+#include "imgui-service.h"
+#include "vertex-quantization.h"
+
+#include <algorithm>
+#include <cassert>
+
+// Sized for the sponza and cornell box scenes, larger scenes grow the buffers
+static const uint32_t INITIAL_VERTEX_CAPACITY = 64 * 1024 * 1024;
+static const uint32_t INITIAL_INDEX_CAPACITY = 32 * 1024 * 1024;
+
+uint32_t GrowableBuffer::Allocate(uint32_t bytes, uint32_t alignment)
+{
+	uint32_t offset = (size + alignment - 1) / alignment * alignment;
+	uint32_t required = offset + bytes;
+	if (required > capacity) {
+		// Immutable storage cannot grow in place
+		uint32_t newCapacity = std::max(required, capacity * 2);
+		GLBuffer newBuffer;
+		newBuffer.init(nullptr, newCapacity, GL_DYNAMIC_STORAGE_BIT);
+		if (size > 0)
+			glCopyNamedBufferSubData(buffer.handle, newBuffer.handle, 0, 0, size);
+		if (capacity > 0)
+			buffer.destroy();
+		buffer = newBuffer;
+		capacity = newCapacity;
+	}
+	size = required;
+	return offset;
+}
+
+uint32_t GrowableBuffer::Append(const void* data, uint32_t bytes)
+{
+	uint32_t offset = Allocate(bytes, 4);
+	if (bytes > 0)
+		glNamedBufferSubData(buffer.handle, offset, bytes, data);
+	return offset;
+}
+
+void GrowableBuffer::Destroy()
+{
+	if (capacity > 0)
+		buffer.destroy();
+	capacity = 0;
+	size = 0;
+}
+
+void GeometryPool::Bind(GLProgram* program, VertexStream stream)
+{
+	glBindVertexArray(stream == VertexStream::Position ? positionVao : vao);
+	program->setBuffer(1, transformBuffer.buffer.handle);
+	program->setBuffer(2, materialBuffer.buffer.handle);
+	program->setBuffer(3, dequantizationBuffer.buffer.handle);
+	program->setBuffer(5, normalMatrixBuffer.buffer.handle);
+	program->setInt("uQuantizedVertices", vertexFormat == VertexFormat::Quantized);
+}
+
+void GeometryPool::DrawIndirect(GLProgram* program, GLuint commandBuffer, uint32_t firstDraw, uint32_t drawCount, VertexStream stream)
+{
+	if (drawCount == 0) return;
+
+	Bind(program, stream);
+	// The indirect binding is context state, not part of the VAO
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	const void* offset = (const void*)(uintptr_t)(firstDraw * sizeof(DrawElementsIndirectCommand));
+	glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, offset, drawCount, 0);
+	glBindVertexArray(0);
+}
+
+void GeometryPool::DrawIndirectCount(GLProgram* program, GLuint commandBuffer, GLuint countBuffer, uint32_t maxDrawCount, VertexStream stream)
+{
+	if (maxDrawCount == 0) return;
+
+	Bind(program, stream);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+	glMultiDrawElementsIndirectCount(GL_TRIANGLES, indexType, 0, 0, maxDrawCount, 0);
+	glBindBuffer(GL_PARAMETER_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+void GeometryPool::DrawIndirectCountIndices(GLProgram* program, GLuint culledIndexBuffer, GLuint commandBuffer, GLuint countBuffer, uint32_t maxDrawCount, VertexStream stream)
+{
+	if (maxDrawCount == 0) return;
+
+	GLuint streamVao = stream == VertexStream::Position ? positionVao : vao;
+	glVertexArrayElementBuffer(streamVao, culledIndexBuffer);
+	Bind(program, stream);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+	glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, 0, 0, maxDrawCount, 0);
+	glBindBuffer(GL_PARAMETER_BUFFER, 0);
+	glBindVertexArray(0);
+	glVertexArrayElementBuffer(streamVao, indexBuffer.buffer.handle);
+}
+
+GeometryPool* SceneGeometry::FindPool(VertexFormat vertexFormat, GLenum indexType)
+{
+	for (auto& pool : mPools) {
+		if (pool->vertexFormat == vertexFormat && pool->indexType == indexType)
+			return pool.get();
+	}
+
+	mPools.push_back(std::make_unique<GeometryPool>());
+	GeometryPool* pool = mPools.back().get();
+	pool->index = (uint32_t)mPools.size() - 1;
+	pool->vertexFormat = vertexFormat;
+	pool->indexType = indexType;
+	uint32_t vertexSize = GetVertexSize(vertexFormat);
+	uint32_t positionSize = GetPositionSize(vertexFormat);
+	pool->vertexBuffer.Allocate(INITIAL_VERTEX_CAPACITY, 1);
+	pool->positionBuffer.Allocate(INITIAL_VERTEX_CAPACITY / vertexSize * positionSize, 1);
+	pool->indexBuffer.Allocate(INITIAL_INDEX_CAPACITY, 1);
+	pool->vertexBuffer.size = 0;
+	pool->positionBuffer.size = 0;
+	pool->indexBuffer.size = 0;
+
+	glCreateVertexArrays(1, &pool->vao);
+	if (vertexFormat == VertexFormat::Quantized) {
+		// Normalized fetch, the vertex shaders finish the decode
+		glVertexArrayAttribFormat(pool->vao, 0, 3, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(QuantizedVertex, position));
+		glVertexArrayAttribFormat(pool->vao, 1, 2, GL_SHORT, GL_TRUE, offsetof(QuantizedVertex, normal));
+		glVertexArrayAttribFormat(pool->vao, 2, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(QuantizedVertex, uv));
+	}
+	else {
+		glVertexArrayAttribFormat(pool->vao, 0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position));
+		glVertexArrayAttribFormat(pool->vao, 1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, normal));
+		glVertexArrayAttribFormat(pool->vao, 2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, uv));
+	}
+	for (GLuint attribute = 0; attribute < 3; ++attribute) {
+		glEnableVertexArrayAttrib(pool->vao, attribute);
+		glVertexArrayAttribBinding(pool->vao, attribute, 0);
+	}
+
+	glCreateVertexArrays(1, &pool->positionVao);
+	if (vertexFormat == VertexFormat::Quantized)
+		glVertexArrayAttribFormat(pool->positionVao, 0, 3, GL_UNSIGNED_SHORT, GL_TRUE, 0);
+	else
+		glVertexArrayAttribFormat(pool->positionVao, 0, 3, GL_FLOAT, GL_FALSE, 0);
+	glEnableVertexArrayAttrib(pool->positionVao, 0);
+	glVertexArrayAttribBinding(pool->positionVao, 0, 0);
+	return pool;
+}
+
+void SceneGeometry::Allocate(MeshGroup* meshGroup, uint32_t vertexSize, uint32_t indexSize)
+{
+	GeometryPool* pool = FindPool(meshGroup->vertexFormat, meshGroup->indexType);
+	uint32_t vertexStride = GetVertexSize(pool->vertexFormat);
+	uint32_t positionStride = GetPositionSize(pool->vertexFormat);
+	uint32_t indexStride = GetIndexSize(pool->indexType);
+
+	meshGroup->pool = pool;
+	meshGroup->baseVertex = pool->vertexBuffer.Allocate(vertexSize, vertexStride) / vertexStride;
+	uint32_t basePosition = pool->positionBuffer.Allocate(vertexSize / vertexStride * positionStride, positionStride) / positionStride;
+	assert(basePosition == meshGroup->baseVertex);
+	meshGroup->firstIndex = pool->indexBuffer.Allocate(indexSize, indexStride) / indexStride;
+
+	// Any buffer may have moved
+	glVertexArrayVertexBuffer(pool->vao, 0, pool->vertexBuffer.buffer.handle, 0, vertexStride);
+	glVertexArrayElementBuffer(pool->vao, pool->indexBuffer.buffer.handle);
+	glVertexArrayVertexBuffer(pool->positionVao, 0, pool->positionBuffer.buffer.handle, 0, positionStride);
+	glVertexArrayElementBuffer(pool->positionVao, pool->indexBuffer.buffer.handle);
+}
+
+void SceneGeometry::AddDraws(MeshGroup* meshGroup)
+{
+	GeometryPool* pool = meshGroup->pool;
+	uint32_t drawCount = (uint32_t)meshGroup->drawCommands.size();
+	meshGroup->firstDraw = pool->drawCount;
+	meshGroup->firstMeshlet = pool->meshletCount;
+
+	if (meshGroup->dequantization.size() != drawCount)
+		InitializeIdentityDequantization(meshGroup);
+	if (meshGroup->lods.size() != drawCount)
+		InitializeDrawLods(meshGroup);
+
+	std::vector<DrawElementsIndirectCommand> drawCommands = meshGroup->drawCommands;
+	std::vector<DrawLods> lods = meshGroup->lods;
+	for (uint32_t drawIndex = 0; drawIndex < drawCount; ++drawIndex) {
+		DrawElementsIndirectCommand& drawCommand = drawCommands[drawIndex];
+		drawCommand.firstIndex_ += meshGroup->firstIndex;
+		drawCommand.baseVertex_ += meshGroup->baseVertex;
+		drawCommand.baseInstance_ += meshGroup->firstDraw;
+
+		DrawLods& drawLods = lods[drawIndex];
+		for (uint32_t lod = 0; lod < drawLods.lodCount; ++lod)
+			drawLods.lods[lod].firstIndex += meshGroup->firstIndex;
+		drawLods.baseVertex += meshGroup->baseVertex;
+	}
+
+	std::vector<DrawBounds> bounds(drawCount);
+	for (uint32_t drawIndex = 0; drawIndex < drawCount; ++drawIndex) {
+		// Groups without bounds are never culled at the draw level
+		if (drawIndex < meshGroup->aabbs.size())
+			bounds[drawIndex] = DrawBounds{ glm::vec4(meshGroup->aabbs[drawIndex].min, 0.0f), glm::vec4(meshGroup->aabbs[drawIndex].max, 0.0f) };
+		else
+			bounds[drawIndex] = DrawBounds{ glm::vec4(-1e30f), glm::vec4(1e30f) };
+	}
+
+	// Pool culling only draws meshlets, groups without them get one uncullable meshlet per draw
+	std::vector<Meshlet> meshlets = meshGroup->meshlets;
+	if (meshlets.empty()) {
+		for (uint32_t drawIndex = 0; drawIndex < drawCount; ++drawIndex) {
+			Meshlet meshlet = {};
+			meshlet.sphere = glm::vec4(0.0f, 0.0f, 0.0f, 1e30f);
+			meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 2.0f);
+			meshlet.firstIndex = meshGroup->drawCommands[drawIndex].firstIndex_;
+			meshlet.indexCount = meshGroup->drawCommands[drawIndex].count_;
+			meshlet.baseVertex = meshGroup->drawCommands[drawIndex].baseVertex_;
+			meshlet.drawIndex = drawIndex;
+			meshlets.push_back(meshlet);
+		}
+	}
+	for (auto& meshlet : meshlets) {
+		pool->meshletIndexCount += meshlet.indexCount;
+		meshlet.firstIndex += meshGroup->firstIndex;
+		meshlet.baseVertex += meshGroup->baseVertex;
+		meshlet.drawIndex += meshGroup->firstDraw;
+	}
+
+	pool->drawIndirectBuffer.Append(drawCommands.data(), drawCount * sizeof(DrawElementsIndirectCommand));
+	std::vector<NormalMatrix> normalMatrices(drawCount);
+	ComputeNormalMatrices(meshGroup->transforms.data(), drawCount, normalMatrices.data());
+	pool->transformBuffer.Append(meshGroup->transforms.data(), drawCount * sizeof(glm::mat4));
+	pool->normalMatrixBuffer.Append(normalMatrices.data(), drawCount * sizeof(NormalMatrix));
+	pool->materialBuffer.Append(meshGroup->materials.data(), drawCount * sizeof(Material));
+	pool->dequantizationBuffer.Append(meshGroup->dequantization.data(), drawCount * sizeof(PositionDequantization));
+	pool->lodBuffer.Append(lods.data(), drawCount * sizeof(DrawLods));
+	pool->boundsBuffer.Append(bounds.data(), drawCount * sizeof(DrawBounds));
+	pool->meshletBuffer.Append(meshlets.data(), (uint32_t)(meshlets.size() * sizeof(Meshlet)));
+	pool->drawCount += drawCount;
+	pool->meshletCount += (uint32_t)meshlets.size();
+}
+
+void SceneGeometry::Upload(MeshGroup* meshGroup, const void* vertices, uint32_t vertexSize, const void* positions, const void* indices, uint32_t indexSize)
+{
+	Allocate(meshGroup, vertexSize, indexSize);
+	GeometryPool* pool = meshGroup->pool;
+	uint32_t vertexOffset = meshGroup->baseVertex * GetVertexSize(pool->vertexFormat);
+	uint32_t positionSize = vertexSize / GetVertexSize(pool->vertexFormat) * GetPositionSize(pool->vertexFormat);
+	uint32_t positionOffset = meshGroup->baseVertex * GetPositionSize(pool->vertexFormat);
+	uint32_t indexOffset = meshGroup->firstIndex * GetIndexSize(pool->indexType);
+	glNamedBufferSubData(pool->vertexBuffer.buffer.handle, vertexOffset, vertexSize, vertices);
+	glNamedBufferSubData(pool->positionBuffer.buffer.handle, positionOffset, positionSize, positions);
+	glNamedBufferSubData(pool->indexBuffer.buffer.handle, indexOffset, indexSize, indices);
+	AddDraws(meshGroup);
+}
+
+void SceneGeometry::Draw(GLProgram* program, VertexStream stream)
+{
+	for (auto& pool : mPools)
+		pool->DrawIndirect(program, pool->drawIndirectBuffer.buffer.handle, 0, pool->drawCount, stream);
+}
+
+void SceneGeometry::AddUI()
+{
+	if (!ImGui::CollapsingHeader("Scene Geometry")) return;
+
+	for (uint32_t poolIndex = 0; poolIndex < mPools.size(); ++poolIndex) {
+		GeometryPool* pool = mPools[poolIndex].get();
+		ImGui::Text("Pool %d (%s, %d bit indices): %d draws, %d meshlets", poolIndex,
+			pool->vertexFormat == VertexFormat::Quantized ? "quantized" : "float",
+			GetIndexSize(pool->indexType) * 8, pool->drawCount, pool->meshletCount);
+		ImGui::Text("  vertices %.2f / %.2f MB, positions %.2f / %.2f MB, indices %.2f / %.2f MB",
+			pool->vertexBuffer.size / (1024.0f * 1024.0f), pool->vertexBuffer.capacity / (1024.0f * 1024.0f),
+			pool->positionBuffer.size / (1024.0f * 1024.0f), pool->positionBuffer.capacity / (1024.0f * 1024.0f),
+			pool->indexBuffer.size / (1024.0f * 1024.0f), pool->indexBuffer.capacity / (1024.0f * 1024.0f));
+	}
+}
+
+void SceneGeometry::Destroy()
+{
+	for (auto& pool : mPools) {
+		glDeleteVertexArrays(1, &pool->vao);
+		glDeleteVertexArrays(1, &pool->positionVao);
+		pool->vertexBuffer.Destroy();
+		pool->positionBuffer.Destroy();
+		pool->indexBuffer.Destroy();
+		pool->drawIndirectBuffer.Destroy();
+		pool->transformBuffer.Destroy();
+		pool->normalMatrixBuffer.Destroy();
+		pool->materialBuffer.Destroy();
+		pool->dequantizationBuffer.Destroy();
+		pool->lodBuffer.Destroy();
+		pool->boundsBuffer.Destroy();
+		pool->meshletBuffer.Destroy();
+	}
+	mPools.clear();
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "mesh.h"
+
+// Grow only GPU array, the contents move to a bigger buffer when it runs out
+struct GrowableBuffer {
+	GLBuffer buffer;
+	uint32_t capacity = 0;
+	uint32_t size = 0;
+
+	// Reserves bytes at an offset aligned to alignment and returns the offset
+	uint32_t Allocate(uint32_t bytes, uint32_t alignment);
+	uint32_t Append(const void* data, uint32_t bytes);
+	void Destroy();
+};
+
+// Draw local AABB as read by lod-select.comp
+struct DrawBounds {
+	glm::vec4 min;
+	glm::vec4 max;
+};
+
+/*
+* Geometry of every group with one vertex format and index type. Vertices and
+* indices are sub-allocated from one buffer each, and the per draw arrays of
+* all groups are concatenated, so a pass draws the whole pool with a single
+* glMultiDrawElementsIndirect. Draw commands carry their pool wide draw index
+* in baseInstance.
+*/
+struct GeometryPool {
+	// Position in SceneGeometry, per pool state elsewhere is indexed with it
+	uint32_t index;
+	VertexFormat vertexFormat;
+	GLenum indexType;
+	GLuint vao = 0;
+	// Same indices against the position stream, vertex i lives at the same index in both buffers
+	GLuint positionVao = 0;
+
+	GrowableBuffer vertexBuffer;
+	GrowableBuffer positionBuffer;
+	GrowableBuffer indexBuffer;
+
+	GrowableBuffer drawIndirectBuffer;
+	GrowableBuffer transformBuffer;
+	// NormalMatrix per draw, rewritten together with transformBuffer
+	GrowableBuffer normalMatrixBuffer;
+	GrowableBuffer materialBuffer;
+	GrowableBuffer dequantizationBuffer;
+	GrowableBuffer lodBuffer;
+	GrowableBuffer boundsBuffer;
+	GrowableBuffer meshletBuffer;
+
+	uint32_t drawCount = 0;
+	uint32_t meshletCount = 0;
+	// Sum of meshlet index counts over every LOD and instance. Instances share
+	// their index range, so this can exceed what indexBuffer holds
+	uint32_t meshletIndexCount = 0;
+
+	void Bind(GLProgram* program, VertexStream stream);
+
+	// firstDraw and drawCount index commandBuffer, which holds one command per pool draw
+	void DrawIndirect(GLProgram* program, GLuint commandBuffer, uint32_t firstDraw, uint32_t drawCount, VertexStream stream = VertexStream::Full);
+
+	// Draws a GPU written command stream, the draw count is read from countBuffer
+	void DrawIndirectCount(GLProgram* program, GLuint commandBuffer, GLuint countBuffer, uint32_t maxDrawCount, VertexStream stream = VertexStream::Full);
+
+	// Same over 32 bit indices from culledIndexBuffer that already include baseVertex, e.g. culled triangle lists
+	void DrawIndirectCountIndices(GLProgram* program, GLuint culledIndexBuffer, GLuint commandBuffer, GLuint countBuffer, uint32_t maxDrawCount, VertexStream stream = VertexStream::Full);
+};
+
+/*
+* Scene wide geometry allocator. Groups are placed into the pool of their
+* layout, in practice every scene group shares one pool since they are all
+* loaded with the same options. Allocations are never freed, groups stay
+* resident for the lifetime of the scene.
+*/
+class SceneGeometry {
+
+public:
+	// Reserves vertex, position and index space for a group in the pool of its
+	// layout. The pool buffers may move on every Allocate, look their handles up after it
+	void Allocate(MeshGroup* meshGroup, uint32_t vertexSize, uint32_t indexSize);
+
+	// Appends the draw commands, transforms, materials, LODs and meshlets of an
+	// allocated group rebased onto its allocation. Its vertices and indices must
+	// be written before the group is drawn
+	void AddDraws(MeshGroup* meshGroup);
+
+	// Allocate, a direct upload of the blobs and AddDraws. positions holds the
+	// VertexStream::Position copy of vertices
+	void Upload(MeshGroup* meshGroup, const void* vertices, uint32_t vertexSize, const void* positions, const void* indices, uint32_t indexSize);
+
+	// One multi draw per pool
+	void Draw(GLProgram* program, VertexStream stream = VertexStream::Full);
+
+	uint32_t GetPoolCount() const { return (uint32_t)mPools.size(); }
+
+	GeometryPool* GetPool(uint32_t poolIndex) { return mPools[poolIndex].get(); }
+
+	void AddUI();
+
+	void Destroy();
+
+private:
+	GeometryPool* FindPool(VertexFormat vertexFormat, GLenum indexType);
+
+	std::vector<std::unique_ptr<GeometryPool>> mPools;
+};
@@ -0,0 +1,335 @@
+#include "texture-cache.h"
+
+#include "imgui-service.h"
+#include "logger.h"
+#include "utils.h"
+#include "tinygltf/stb_image.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+static const uint32_t BC_CACHE_MAGIC = 0x43425856; // "VXBC"
+static const uint32_t BC_CACHE_VERSION = 1;
+
+struct CompressedHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceTimestamp;
+	uint64_t sourceSize;
+	uint32_t internalFormat;
+	uint32_t mipCount;
+};
+
+// Followed by size bytes of BC3 blocks
+struct CompressedMip {
+	uint32_t width;
+	uint32_t height;
+	uint32_t size;
+};
+
+static std::string GetCompressedCachePath(const std::string& path, bool srgb)
+{
+	return path + (srgb ? ".srgb.bctex" : ".bctex");
+}
+
+static GLenum GetInternalFormat(bool compressed, bool srgb)
+{
+	if (compressed)
+		return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	return srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+}
+
+// 2x2 box filter, the last row and column are repeated for odd sizes
+static void BuildMipChain(std::vector<std::vector<uint8_t>>& levels, std::vector<glm::uvec2>& sizes)
+{
+	while (sizes.back().x > 1 || sizes.back().y > 1) {
+		glm::uvec2 srcSize = sizes.back();
+		glm::uvec2 dstSize = glm::max(srcSize / 2u, glm::uvec2(1u));
+		const uint8_t* src = levels.back().data();
+		std::vector<uint8_t> dst(dstSize.x * dstSize.y * 4);
+		for (uint32_t y = 0; y < dstSize.y; ++y) {
+			uint32_t y0 = std::min(y * 2, srcSize.y - 1), y1 = std::min(y * 2 + 1, srcSize.y - 1);
+			for (uint32_t x = 0; x < dstSize.x; ++x) {
+				uint32_t x0 = std::min(x * 2, srcSize.x - 1), x1 = std::min(x * 2 + 1, srcSize.x - 1);
+				for (uint32_t c = 0; c < 4; ++c) {
+					uint32_t sum = src[(y0 * srcSize.x + x0) * 4 + c] + src[(y0 * srcSize.x + x1) * 4 + c] +
+						src[(y1 * srcSize.x + x0) * 4 + c] + src[(y1 * srcSize.x + x1) * 4 + c];
+					dst[(y * dstSize.x + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+				}
+			}
+		}
+		levels.push_back(std::move(dst));
+		sizes.push_back(dstSize);
+	}
+}
+
+static bool ReadCompressedCache(const std::string& cachePath, uint64_t sourceTimestamp, uint64_t sourceSize, GLenum internalFormat, std::vector<std::vector<uint8_t>>& levels, std::vector<glm::uvec2>& sizes)
+{
+	std::ifstream file(cachePath, std::ios::binary);
+	if (!file) return false;
+
+	CompressedHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(CompressedHeader));
+	if (!file || header.magic != BC_CACHE_MAGIC || header.version != BC_CACHE_VERSION) return false;
+	if (header.sourceTimestamp != sourceTimestamp || header.sourceSize != sourceSize || header.internalFormat != internalFormat) return false;
+
+	for (uint32_t level = 0; level < header.mipCount; ++level) {
+		CompressedMip mip;
+		file.read(reinterpret_cast<char*>(&mip), sizeof(CompressedMip));
+		if (!file) return false;
+		std::vector<uint8_t> data(mip.size);
+		file.read(reinterpret_cast<char*>(data.data()), mip.size);
+		if (!file) return false;
+		levels.push_back(std::move(data));
+		sizes.push_back(glm::uvec2(mip.width, mip.height));
+	}
+	return header.mipCount > 0;
+}
+
+void TextureCache::Initialize(bool compress, uint64_t uploadBudget)
+{
+	mCompress = compress;
+	mUploadBudget = uploadBudget;
+
+	// Slot 0 means no texture
+	GLuint64 nullHandle = 0;
+	mHandleBuffer.Append(&nullHandle, sizeof(GLuint64));
+}
+
+uint32_t TextureCache::Request(const std::string& path, bool srgb)
+{
+	std::string key = srgb ? path + "|srgb" : path;
+	auto found = mTextureIndices.find(key);
+	if (found != mTextureIndices.end())
+		return found->second;
+
+	mTextures.push_back(std::make_unique<Texture>());
+	Texture* texture = mTextures.back().get();
+	texture->path = path;
+	texture->srgb = srgb;
+	texture->internalFormat = GetInternalFormat(mCompress, srgb);
+
+	uint32_t textureIndex = (uint32_t)mTextures.size();
+	mTextureIndices[key] = textureIndex;
+	GLuint64 nullHandle = 0;
+	mHandleBuffer.Append(&nullHandle, sizeof(GLuint64));
+	mPending.push_back(textureIndex);
+
+	JobSystem::Execute(texture->context, [this, texture]() {
+		Decode(texture);
+	});
+	return textureIndex;
+}
+
+void TextureCache::ResolveMaterials(MeshGroup* meshGroup)
+{
+	auto resolve = [&](uint32_t& slot, bool srgb) {
+		if (slot == 0) return;
+		if (slot > meshGroup->textures.size()) {
+			slot = 0;
+			return;
+		}
+		slot = Request(meshGroup->textures[slot - 1], srgb);
+	};
+
+	// Color maps are authored in sRGB, data maps are linear
+	for (auto& material : meshGroup->materials) {
+		resolve(material.albedoMap, true);
+		resolve(material.emissiveMap, true);
+		resolve(material.normalMap, false);
+		resolve(material.metallicMap, false);
+		resolve(material.roughnessMap, false);
+		resolve(material.ambientOcclusionMap, false);
+		resolve(material.opacityMap, false);
+	}
+}
+
+void TextureCache::Decode(Texture* texture)
+{
+	Utils::Timer timer;
+	std::error_code error;
+	auto writeTime = std::filesystem::last_write_time(texture->path, error);
+	if (error) return;
+	texture->sourceTimestamp = (uint64_t)writeTime.time_since_epoch().count();
+	texture->sourceSize = (uint64_t)std::filesystem::file_size(texture->path, error);
+	if (error) return;
+
+	std::vector<std::vector<uint8_t>> levels;
+	std::vector<glm::uvec2> sizes;
+	if (mCompress && ReadCompressedCache(GetCompressedCachePath(texture->path, texture->srgb), texture->sourceTimestamp, texture->sourceSize, texture->internalFormat, levels, sizes)) {
+		texture->fromCache = true;
+	}
+	else {
+		levels.clear();
+		sizes.clear();
+
+		// Rows bottom up, the mesh uvs are flipped on load (see convertUVs)
+		stbi_set_flip_vertically_on_load_thread(1);
+		int width, height, components;
+		stbi_uc* pixels = stbi_load(texture->path.c_str(), &width, &height, &components, 4);
+		if (pixels == nullptr) return;
+
+		levels.emplace_back(pixels, pixels + (size_t)width * height * 4);
+		sizes.push_back(glm::uvec2(width, height));
+		stbi_image_free(pixels);
+		BuildMipChain(levels, sizes);
+	}
+
+	for (uint32_t level = 0; level < levels.size(); ++level)
+		texture->mips.push_back(MipLevel{ sizes[level].x, sizes[level].y, std::move(levels[level]) });
+	texture->decodeTime = timer.Lap();
+	texture->decoded = true;
+}
+
+bool TextureCache::Upload(Texture* texture, uint64_t* budget)
+{
+	while (texture->uploadedMips < texture->mips.size()) {
+		if (*budget == 0) return false;
+
+		uint32_t level = texture->uploadedMips;
+		const MipLevel& mip = texture->mips[level];
+		uint64_t size = mip.data.size();
+		if (texture->fromCache)
+			glCompressedTextureSubImage2D(texture->handle, level, 0, 0, mip.width, mip.height, texture->internalFormat, (GLsizei)size, mip.data.data());
+		else
+			glTextureSubImage2D(texture->handle, level, 0, 0, mip.width, mip.height, GL_RGBA, GL_UNSIGNED_BYTE, mip.data.data());
+
+		*budget -= std::min(*budget, size);
+		mBurstUploadedBytes += size;
+		mTotalUploadedBytes += size;
+		texture->uploadedMips++;
+	}
+	return true;
+}
+
+void TextureCache::MakeResident(uint32_t textureIndex)
+{
+	Texture* texture = mTextures[textureIndex - 1].get();
+	texture->bindlessHandle = glGetTextureHandleARB(texture->handle);
+	glMakeTextureHandleResidentARB(texture->bindlessHandle);
+	glNamedBufferSubData(mHandleBuffer.buffer.handle, textureIndex * sizeof(GLuint64), sizeof(GLuint64), &texture->bindlessHandle);
+	texture->state = TextureState::Resident;
+}
+
+void TextureCache::WriteCompressedCache(Texture* texture)
+{
+	auto mips = std::make_shared<std::vector<MipLevel>>();
+	for (uint32_t level = 0; level < texture->uploadedMips; ++level) {
+		GLint width, height, size;
+		glGetTextureLevelParameteriv(texture->handle, level, GL_TEXTURE_WIDTH, &width);
+		glGetTextureLevelParameteriv(texture->handle, level, GL_TEXTURE_HEIGHT, &height);
+		glGetTextureLevelParameteriv(texture->handle, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+		MipLevel mip{ (uint32_t)width, (uint32_t)height, std::vector<uint8_t>(size) };
+		glGetCompressedTextureImage(texture->handle, level, size, mip.data.data());
+		mips->push_back(std::move(mip));
+	}
+
+	CompressedHeader header{ BC_CACHE_MAGIC, BC_CACHE_VERSION, texture->sourceTimestamp, texture->sourceSize, texture->internalFormat, (uint32_t)mips->size() };
+	std::string cachePath = GetCompressedCachePath(texture->path, texture->srgb);
+	JobSystem::Execute(texture->context, [header, cachePath, mips]() {
+		std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			logger::Warn("Failed to write texture cache: " + cachePath);
+			return;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(CompressedHeader));
+		for (auto& mip : *mips) {
+			CompressedMip mipHeader{ mip.width, mip.height, (uint32_t)mip.data.size() };
+			file.write(reinterpret_cast<const char*>(&mipHeader), sizeof(CompressedMip));
+			file.write(reinterpret_cast<const char*>(mip.data.data()), mip.data.size());
+		}
+	});
+}
+
+bool TextureCache::Update()
+{
+	bool madeResident = false;
+	uint64_t budget = mUploadBudget;
+	Utils::Timer timer;
+	for (uint32_t i = 0; i < mPending.size();) {
+		uint32_t textureIndex = mPending[i];
+		Texture* texture = mTextures[textureIndex - 1].get();
+
+		if (texture->state == TextureState::Decoding) {
+			if (JobSystem::IsBusy(texture->context)) {
+				++i;
+				continue;
+			}
+			if (!texture->decoded) {
+				logger::Warn("Failed to load texture: " + texture->path);
+				texture->state = TextureState::Failed;
+				mPending.erase(mPending.begin() + i);
+				continue;
+			}
+
+			const MipLevel& base = texture->mips[0];
+			glCreateTextures(GL_TEXTURE_2D, 1, &texture->handle);
+			glTextureStorage2D(texture->handle, (GLsizei)texture->mips.size(), texture->internalFormat, base.width, base.height);
+			glTextureParameteri(texture->handle, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTextureParameteri(texture->handle, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTextureParameteri(texture->handle, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTextureParameteri(texture->handle, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTextureParameterf(texture->handle, GL_TEXTURE_MAX_ANISOTROPY, 8.0f);
+
+			for (auto& mip : texture->mips)
+				mBurstDecodedBytes += mip.data.size();
+			mBurstDecodeTime += texture->decodeTime;
+			texture->state = TextureState::Uploading;
+		}
+
+		// Out of budget, the remaining mips continue next frame
+		if (!Upload(texture, &budget)) break;
+
+		MakeResident(textureIndex);
+		madeResident = true;
+		mBurstTextures++;
+		if (texture->fromCache)
+			mBurstCached++;
+		else if (mCompress)
+			WriteCompressedCache(texture);
+		texture->mips = std::vector<MipLevel>();
+		mPending.erase(mPending.begin() + i);
+	}
+	mBurstUploadTime += timer.Lap();
+
+	if (mPending.empty() && mBurstTextures > 0) {
+		float decodedMB = mBurstDecodedBytes / (1024.0f * 1024.0f);
+		float uploadedMB = mBurstUploadedBytes / (1024.0f * 1024.0f);
+		logger::Debug("Textures resident: " + std::to_string(mBurstTextures) + " (" + std::to_string(mBurstCached) + " from BC cache), decoded " +
+			std::to_string(decodedMB) + "MB in " + std::to_string(mBurstDecodeTime) + "ms of worker time (" +
+			std::to_string(decodedMB * 1000.0f / std::max(mBurstDecodeTime, 0.001f)) + " MB/s per worker), uploaded " +
+			std::to_string(uploadedMB) + "MB in " + std::to_string(mBurstUploadTime) + "ms (" +
+			std::to_string(uploadedMB * 1000.0f / std::max(mBurstUploadTime, 0.001f)) + " MB/s)");
+		mBurstTextures = mBurstCached = 0;
+		mBurstDecodedBytes = mBurstUploadedBytes = 0;
+		mBurstDecodeTime = mBurstUploadTime = 0.0f;
+	}
+	return madeResident;
+}
+
+void TextureCache::AddUI()
+{
+	if (!ImGui::CollapsingHeader("Texture Cache")) return;
+
+	uint32_t resident = 0;
+	for (auto& texture : mTextures)
+		resident += texture->state == TextureState::Resident;
+	ImGui::Text("Textures: %d resident, %d pending", resident, (int)mPending.size());
+	ImGui::Text("Uploaded: %.2f MB (%s)", mTotalUploadedBytes / (1024.0f * 1024.0f), mCompress ? "BC3" : "RGBA8");
+}
+
+void TextureCache::Destroy()
+{
+	for (auto& texture : mTextures) {
+		JobSystem::Wait(texture->context);
+		if (texture->bindlessHandle != 0)
+			glMakeTextureHandleNonResidentARB(texture->bindlessHandle);
+		if (texture->handle != 0)
+			glDeleteTextures(1, &texture->handle);
+	}
+	mTextures.clear();
+	mTextureIndices.clear();
+	mPending.clear();
+	mHandleBuffer.Destroy();
+}
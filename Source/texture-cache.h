@@ -0,0 +1,109 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "job-system.h"
+#include "scene-geometry.h"
+
+/*
+* Material textures of every mesh group. Images are deduplicated by path,
+* decoded with stb_image and mipmapped on the JobSystem, and uploaded on the
+* GL thread within a per frame budget. Every texture is exposed through one
+* table of resident ARB_bindless_texture handles that the shaders index with
+* the Material map slots, slot 0 meaning no texture. Entries stay null until
+* their texture is resident.
+*
+* With compression enabled the driver encodes BC3 on upload and the compressed
+* mips are read back into a .bctex file next to the image, later runs upload
+* those directly and skip both the decode and the encode.
+*/
+class TextureCache {
+
+public:
+	void Initialize(bool compress = true, uint64_t uploadBudget = 32 * 1024 * 1024);
+
+	// Table index of the texture, its decode is queued right away
+	uint32_t Request(const std::string& path, bool srgb);
+
+	// Maps the group local map slots written by ParseMesh to table indices
+	void ResolveMaterials(MeshGroup* meshGroup);
+
+	// Uploads decoded textures and publishes their handles, once per frame on the GL thread.
+	// Returns true if any texture became resident
+	bool Update();
+
+	// No texture is decoding or uploading
+	bool IsIdle() const { return mPending.empty(); }
+
+	// uvec2 bindless handle per table index
+	GLuint GetHandleBuffer() const { return mHandleBuffer.buffer.handle; }
+
+	void AddUI();
+
+	void Destroy();
+
+private:
+	enum class TextureState {
+		Decoding,
+		Uploading,
+		Resident,
+		Failed,
+	};
+
+	struct MipLevel {
+		uint32_t width;
+		uint32_t height;
+		// RGBA8, or BC3 blocks when loaded from the disk cache
+		std::vector<uint8_t> data;
+	};
+
+	struct Texture {
+		std::string path;
+		bool srgb;
+		TextureState state = TextureState::Decoding;
+		JobSystem::Context context;
+
+		// Written by the decode job
+		bool decoded = false;
+		bool fromCache = false;
+		std::vector<MipLevel> mips;
+		uint64_t sourceTimestamp = 0;
+		uint64_t sourceSize = 0;
+		float decodeTime = 0.0f;
+
+		uint32_t uploadedMips = 0;
+		GLenum internalFormat = 0;
+		GLuint handle = 0;
+		GLuint64 bindlessHandle = 0;
+	};
+
+	void Decode(Texture* texture);
+	// Returns false if the budget ran out before every mip was uploaded
+	bool Upload(Texture* texture, uint64_t* budget);
+	void MakeResident(uint32_t textureIndex);
+	// Reads the driver encoded mips back and writes them on a worker
+	void WriteCompressedCache(Texture* texture);
+
+	bool mCompress = true;
+	uint64_t mUploadBudget = 0;
+
+	// Table index - 1
+	std::vector<std::unique_ptr<Texture>> mTextures;
+	std::unordered_map<std::string, uint32_t> mTextureIndices;
+	// Requested textures that are not resident or failed yet, in request order
+	std::vector<uint32_t> mPending;
+	GrowableBuffer mHandleBuffer;
+
+	// Throughput of the current loading burst, logged once it drains
+	uint32_t mBurstTextures = 0;
+	uint32_t mBurstCached = 0;
+	uint64_t mBurstDecodedBytes = 0;
+	uint64_t mBurstUploadedBytes = 0;
+	float mBurstDecodeTime = 0.0f;
+	float mBurstUploadTime = 0.0f;
+	uint64_t mTotalUploadedBytes = 0;
+};
@@ -0,0 +1,147 @@
+#include "transform-hierarchy.h"
+
+#include <cassert>
+#include <xmmintrin.h>
+
+// Column major a * b, one broadcast multiply-add per column of b
+static void multiplyMatrices(const glm::mat4& a, const glm::mat4& b, glm::mat4* out) {
+	__m128 a0 = _mm_loadu_ps(&a[0][0]);
+	__m128 a1 = _mm_loadu_ps(&a[1][0]);
+	__m128 a2 = _mm_loadu_ps(&a[2][0]);
+	__m128 a3 = _mm_loadu_ps(&a[3][0]);
+	for (int column = 0; column < 4; ++column) {
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[column][0]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[column][1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[column][2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[column][3])));
+		_mm_storeu_ps(&(*out)[column][0], r);
+	}
+}
+
+// Each lane holds one matrix, element [column * 3 + row] of the upper 3x3.
+// The inverse transpose is the cofactor matrix over the determinant, whose
+// columns are cross products of the source columns
+static void normalMatrices4(const __m128 m[9], __m128 out[9]) {
+	auto cross = [](const __m128* a, const __m128* b, __m128* c) {
+		c[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+		c[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+		c[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+	};
+	cross(&m[3], &m[6], &out[0]);
+	cross(&m[6], &m[0], &out[3]);
+	cross(&m[0], &m[3], &out[6]);
+
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], out[0]), _mm_mul_ps(m[1], out[1])), _mm_mul_ps(m[2], out[2]));
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+	for (int i = 0; i < 9; ++i)
+		out[i] = _mm_mul_ps(out[i], invDet);
+}
+
+void ComputeNormalMatrices(const glm::mat4* transforms, uint32_t count, NormalMatrix* normalMatrices)
+{
+	for (uint32_t first = 0; first < count; first += 4) {
+		// The last batch repeats its final transform in the unused lanes
+		uint32_t lanes = count - first < 4 ? count - first : 4;
+		alignas(16) float elements[9][4];
+		for (uint32_t lane = 0; lane < 4; ++lane) {
+			const glm::mat4& transform = transforms[first + (lane < lanes ? lane : lanes - 1)];
+			for (int column = 0; column < 3; ++column) {
+				for (int row = 0; row < 3; ++row)
+					elements[column * 3 + row][lane] = transform[column][row];
+			}
+		}
+
+		__m128 m[9], result[9];
+		for (int i = 0; i < 9; ++i)
+			m[i] = _mm_load_ps(elements[i]);
+		normalMatrices4(m, result);
+		for (int i = 0; i < 9; ++i)
+			_mm_store_ps(elements[i], result[i]);
+
+		for (uint32_t lane = 0; lane < lanes; ++lane) {
+			NormalMatrix& normalMatrix = normalMatrices[first + lane];
+			for (int column = 0; column < 3; ++column) {
+				normalMatrix.columns[column] = glm::vec4(elements[column * 3 + 0][lane], elements[column * 3 + 1][lane],
+					elements[column * 3 + 2][lane], 0.0f);
+			}
+		}
+	}
+}
+
+// translate * rotate * scale without the two full matrix products
+static glm::mat4 composeLocal(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+	glm::mat3 r = glm::mat3_cast(rotation);
+	glm::mat4 local;
+	local[0] = glm::vec4(r[0] * scale.x, 0.0f);
+	local[1] = glm::vec4(r[1] * scale.y, 0.0f);
+	local[2] = glm::vec4(r[2] * scale.z, 0.0f);
+	local[3] = glm::vec4(translation, 1.0f);
+	return local;
+}
+
+uint32_t TransformHierarchy::AddNode(int32_t parent, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale)
+{
+	assert(parent < (int32_t)mParents.size());
+	mParents.push_back(parent);
+	mTranslations.push_back(translation);
+	mRotations.push_back(rotation);
+	mScales.push_back(scale);
+	mLocals.push_back(glm::mat4(1.0f));
+	mWorlds.push_back(glm::mat4(1.0f));
+	mFlags.push_back(FLAG_LOCAL_DIRTY);
+	return (uint32_t)mParents.size() - 1;
+}
+
+void TransformHierarchy::SetTranslation(uint32_t node, const glm::vec3& translation)
+{
+	mTranslations[node] = translation;
+	mFlags[node] |= FLAG_LOCAL_DIRTY;
+}
+
+void TransformHierarchy::SetRotation(uint32_t node, const glm::quat& rotation)
+{
+	mRotations[node] = rotation;
+	mFlags[node] |= FLAG_LOCAL_DIRTY;
+}
+
+void TransformHierarchy::SetScale(uint32_t node, const glm::vec3& scale)
+{
+	mScales[node] = scale;
+	mFlags[node] |= FLAG_LOCAL_DIRTY;
+}
+
+void TransformHierarchy::Update(std::vector<uint32_t>& changedNodes)
+{
+	uint32_t nodeCount = (uint32_t)mParents.size();
+	for (uint32_t node = 0; node < nodeCount; ++node) {
+		int32_t parent = mParents[node];
+		// Parents are resolved first, their changed flag is already final
+		bool parentChanged = parent >= 0 && (mFlags[parent] & FLAG_CHANGED);
+		uint8_t flags = mFlags[node];
+		if (!(flags & FLAG_LOCAL_DIRTY) && !parentChanged) {
+			mFlags[node] = 0;
+			continue;
+		}
+
+		if (flags & FLAG_LOCAL_DIRTY)
+			mLocals[node] = composeLocal(mTranslations[node], mRotations[node], mScales[node]);
+		if (parent >= 0)
+			multiplyMatrices(mWorlds[parent], mLocals[node], &mWorlds[node]);
+		else
+			mWorlds[node] = mLocals[node];
+
+		mFlags[node] = FLAG_CHANGED;
+		changedNodes.push_back(node);
+	}
+}
+
+TransformNode TransformHierarchy::GetNode(uint32_t node) const
+{
+	const glm::quat& rotation = mRotations[node];
+	TransformNode packed = {};
+	packed.rotation = glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w);
+	packed.translation = mTranslations[node];
+	packed.parent = mParents[node];
+	packed.scale = mScales[node];
+	return packed;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "glm-includes.h"
+#include <glm/gtc/quaternion.hpp>
+#include <stdint.h>
+#include <vector>
+
+// std430 mat3, inverse transpose of the upper 3x3 of a transform
+struct NormalMatrix {
+	glm::vec4 columns[3];
+};
+
+// Batches of four transforms per SSE iteration
+void ComputeNormalMatrices(const glm::mat4* transforms, uint32_t count, NormalMatrix* normalMatrices);
+
+// Packed node as stored in the mesh cache
+struct TransformNode {
+	glm::vec4 rotation;
+	glm::vec3 translation;
+	int32_t parent;
+	glm::vec3 scale;
+	uint32_t padding;
+};
+
+/*
+* Flattened node hierarchy of a mesh group. Nodes are stored in depth-first
+* order so every parent precedes its children and a single forward pass
+* resolves the world matrices. Local TRS, local and world matrices live in
+* separate arrays, Update only recomputes nodes whose local transform changed
+* and the subtrees below them.
+*/
+class TransformHierarchy {
+
+public:
+	// parent must already be in the hierarchy, -1 for roots
+	uint32_t AddNode(int32_t parent, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale);
+
+	void SetTranslation(uint32_t node, const glm::vec3& translation);
+	void SetRotation(uint32_t node, const glm::quat& rotation);
+	void SetScale(uint32_t node, const glm::vec3& scale);
+
+	// Resolves the dirty subtrees, changedNodes receives every node whose world matrix was rewritten
+	void Update(std::vector<uint32_t>& changedNodes);
+
+	// Only valid for the nodes reported by the last Update
+	bool WasChanged(uint32_t node) const { return mFlags[node] & FLAG_CHANGED; }
+
+	const glm::mat4& GetWorld(uint32_t node) const { return mWorlds[node]; }
+	uint32_t GetNodeCount() const { return (uint32_t)mParents.size(); }
+
+	TransformNode GetNode(uint32_t node) const;
+
+private:
+	enum : uint8_t {
+		FLAG_LOCAL_DIRTY = 1,
+		FLAG_CHANGED = 2,
+	};
+
+	std::vector<int32_t> mParents;
+	std::vector<glm::vec3> mTranslations;
+	std::vector<glm::quat> mRotations;
+	std::vector<glm::vec3> mScales;
+	std::vector<glm::mat4> mLocals;
+	std::vector<glm::mat4> mWorlds;
+	std::vector<uint8_t> mFlags;
+};
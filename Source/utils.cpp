@@ -5,6 +5,9 @@
 
 #include "tinygltf/stb_image.h"
 
+#include <algorithm>
+#include <cmath>
+
 namespace Utils {
     bool RayBoxIntersection(const Ray& ray, const glm::vec3& min, const glm::vec3& max, glm::vec2& t)
     {
@@ -81,6 +84,38 @@ namespace Utils {
         return true;
     }
 
+    bool TriangleBoxOverlap(const glm::vec3* triangle, const glm::vec3& center, const glm::vec3& halfSize)
+    {
+        glm::vec3 v[3] = { triangle[0] - center, triangle[1] - center, triangle[2] - center };
+        // Box face normals
+        glm::vec3 minV = glm::min(glm::min(v[0], v[1]), v[2]);
+        glm::vec3 maxV = glm::max(glm::max(v[0], v[1]), v[2]);
+        if (glm::any(glm::greaterThan(minV, halfSize)) || glm::any(glm::lessThan(maxV, -halfSize)))
+            return false;
+
+        // Triangle plane
+        glm::vec3 edges[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+        glm::vec3 normal = glm::cross(edges[0], edges[1]);
+        if (std::abs(glm::dot(normal, v[0])) > glm::dot(halfSize, glm::abs(normal)))
+            return false;
+
+        // Box axes crossed with the triangle edges
+        for (int i = 0; i < 3; ++i) {
+            for (int axisIndex = 0; axisIndex < 3; ++axisIndex) {
+                glm::vec3 unitAxis{ 0.0f };
+                unitAxis[axisIndex] = 1.0f;
+                glm::vec3 axis = glm::cross(unitAxis, edges[i]);
+                float p0 = glm::dot(v[0], axis);
+                float p1 = glm::dot(v[1], axis);
+                float p2 = glm::dot(v[2], axis);
+                float radius = glm::dot(halfSize, glm::abs(axis));
+                if (std::min(std::min(p0, p1), p2) > radius || std::max(std::max(p0, p1), p2) < -radius)
+                    return false;
+            }
+        }
+        return true;
+    }
+
     void FreeImage(void* buffer)
     {
         stbi_image_free(buffer);
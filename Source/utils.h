@@ -2,6 +2,7 @@
 
 #include "glm-includes.h"
 
+#include <chrono>
 #include <string>
 
 struct GLMesh;
@@ -12,6 +13,18 @@ struct Ray {
 
 namespace Utils {
 
+	// Milliseconds since construction or the previous lap
+	struct Timer {
+		std::chrono::high_resolution_clock::time_point last = std::chrono::high_resolution_clock::now();
+
+		float Lap() {
+			auto now = std::chrono::high_resolution_clock::now();
+			float elapsed = std::chrono::duration<float, std::milli>(now - last).count();
+			last = now;
+			return elapsed;
+		}
+	};
+
 	bool RayBoxIntersection(const Ray& ray, const glm::vec3& min, const glm::vec3& max, glm::vec2& t);
 
 	glm::vec3 GetRayDir(const glm::mat4& P, const glm::mat4& V, const glm::vec2& mouseCoord);
@@ -21,5 +34,8 @@ namespace Utils {
 	float* LoadImageFloat(const char* filename, int* width, int* height, int* nChannel);
 
 	bool FrustumBoxIntersection(const glm::vec3& min, const glm::vec3& max, glm::vec4* frustumPlanes);
+
+	// Separating axis test, touching counts as overlapping
+	bool TriangleBoxOverlap(const glm::vec3* triangle, const glm::vec3& center, const glm::vec3& halfSize);
 	void FreeImage(void* buffer);
 }
\ No newline at end of file
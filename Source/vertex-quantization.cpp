@@ -0,0 +1,127 @@
+#include "vertex-quantization.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+
+static glm::vec2 encodeOctahedral(glm::vec3 n) {
+	n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+	glm::vec2 e{ n.x, n.y };
+	if (n.z < 0.0f) {
+		e.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		e.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return e;
+}
+
+static int16_t toSnorm16(float v) {
+	return (int16_t)std::round(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f);
+}
+
+static uint16_t toUnorm16(float v) {
+	return (uint16_t)std::round(std::min(std::max(v, 0.0f), 1.0f) * 65535.0f);
+}
+
+// Draws share no vertices unless they reference the same baseVertex, so the
+// sorted unique baseVertex values split the vertex array into ranges
+struct VertexRange {
+	uint32_t begin;
+	uint32_t end;
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+static std::vector<VertexRange> buildVertexRanges(const MeshGroup* meshGroup, uint32_t vertexCount) {
+	std::vector<uint32_t> bases;
+	for (auto& drawCommand : meshGroup->drawCommands)
+		bases.push_back(drawCommand.baseVertex_);
+	std::sort(bases.begin(), bases.end());
+	bases.erase(std::unique(bases.begin(), bases.end()), bases.end());
+
+	std::vector<VertexRange> ranges(bases.size());
+	for (uint32_t i = 0; i < bases.size(); ++i) {
+		ranges[i].begin = bases[i];
+		ranges[i].end = i + 1 < bases.size() ? bases[i + 1] : vertexCount;
+	}
+	return ranges;
+}
+
+void QuantizeMeshData(MeshGroup* meshGroup, MeshData* meshData)
+{
+	const Vertex* vertices = reinterpret_cast<const Vertex*>(meshData->vertices.data());
+	uint32_t vertexCount = (uint32_t)(meshData->vertices.size() / sizeof(Vertex));
+	const uint32_t* indices = reinterpret_cast<const uint32_t*>(meshData->indices.data());
+	uint32_t indexCount = (uint32_t)(meshData->indices.size() / sizeof(uint32_t));
+
+	std::vector<VertexRange> ranges = buildVertexRanges(meshGroup, vertexCount);
+	std::vector<uint8_t> quantizedVertices(vertexCount * sizeof(QuantizedVertex));
+	QuantizedVertex* dst = reinterpret_cast<QuantizedVertex*>(quantizedVertices.data());
+
+	for (auto& range : ranges) {
+		range.min = glm::vec3(FLT_MAX);
+		range.max = glm::vec3(-FLT_MAX);
+		for (uint32_t i = range.begin; i < range.end; ++i) {
+			range.min = glm::min(range.min, vertices[i].position);
+			range.max = glm::max(range.max, vertices[i].position);
+		}
+
+		glm::vec3 extent = range.max - range.min;
+		glm::vec3 invExtent;
+		for (int axis = 0; axis < 3; ++axis)
+			invExtent[axis] = extent[axis] > 0.0f ? 1.0f / extent[axis] : 0.0f;
+
+		for (uint32_t i = range.begin; i < range.end; ++i) {
+			const Vertex& vertex = vertices[i];
+			glm::vec3 p = (vertex.position - range.min) * invExtent;
+			dst[i].position[0] = toUnorm16(p.x);
+			dst[i].position[1] = toUnorm16(p.y);
+			dst[i].position[2] = toUnorm16(p.z);
+			dst[i].position[3] = 0;
+
+			glm::vec2 n = encodeOctahedral(vertex.normal);
+			dst[i].normal[0] = toSnorm16(n.x);
+			dst[i].normal[1] = toSnorm16(n.y);
+
+			dst[i].uv[0] = glm::packHalf1x16(vertex.uv.x);
+			dst[i].uv[1] = glm::packHalf1x16(vertex.uv.y);
+		}
+	}
+
+	meshGroup->dequantization.resize(meshGroup->drawCommands.size());
+	for (uint32_t drawIndex = 0; drawIndex < meshGroup->drawCommands.size(); ++drawIndex) {
+		uint32_t baseVertex = meshGroup->drawCommands[drawIndex].baseVertex_;
+		auto range = std::lower_bound(ranges.begin(), ranges.end(), baseVertex, [](const VertexRange& r, uint32_t base) { return r.begin < base; });
+		meshGroup->dequantization[drawIndex] = PositionDequantization{ glm::vec4(range->min, 0.0f), glm::vec4(range->max - range->min, 0.0f) };
+	}
+
+	// glTF indices are local to the primitive, baseVertex does the rest
+	uint32_t maxIndex = 0;
+	for (uint32_t i = 0; i < indexCount; ++i)
+		maxIndex = std::max(maxIndex, indices[i]);
+
+	uint64_t floatSize = meshData->vertices.size() + meshData->indices.size();
+	if (maxIndex <= 0xFFFF) {
+		std::vector<uint8_t> shortIndices(indexCount * sizeof(uint16_t));
+		uint16_t* dstIndices = reinterpret_cast<uint16_t*>(shortIndices.data());
+		for (uint32_t i = 0; i < indexCount; ++i)
+			dstIndices[i] = (uint16_t)indices[i];
+		meshData->indices = std::move(shortIndices);
+		meshGroup->indexType = GL_UNSIGNED_SHORT;
+	}
+	meshData->vertices = std::move(quantizedVertices);
+	meshGroup->vertexFormat = VertexFormat::Quantized;
+
+	uint64_t quantizedSize = meshData->vertices.size() + meshData->indices.size();
+	logger::Debug("Quantized " + std::to_string(vertexCount) + " vertices, " + std::string(meshGroup->indexType == GL_UNSIGNED_SHORT ? "16" : "32") +
+		"-bit indices: " + std::to_string(floatSize / 1024) + "KB -> " + std::to_string(quantizedSize / 1024) + "KB (" +
+		std::to_string(100 - (int)(quantizedSize * 100 / std::max<uint64_t>(floatSize, 1))) + "% saved)");
+}
+
+void InitializeIdentityDequantization(MeshGroup* meshGroup)
+{
+	PositionDequantization identity{ glm::vec4(0.0f), glm::vec4(1.0f, 1.0f, 1.0f, 0.0f) };
+	meshGroup->dequantization.assign(meshGroup->drawCommands.size(), identity);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "mesh.h"
+
+/*
+* Converts a group from the Float layout to QuantizedVertex in place. Positions
+* are stored relative to the bounds of the vertex range each draw references,
+* the matching dequantization is written to meshGroup->dequantization. Indices
+* are narrowed to 16 bits when every draw stays below 65536 local vertices.
+*/
+void QuantizeMeshData(MeshGroup* meshGroup, MeshData* meshData);
+
+// Identity dequantization for Float groups, so the vertex shaders can apply it unconditionally
+void InitializeIdentityDequantization(MeshGroup* meshGroup);
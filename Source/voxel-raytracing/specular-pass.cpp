@@ -0,0 +1,114 @@
+#include "specular-pass.h"
+
+#include "gl-utils.h"
+#include "camera.h"
+#include "imgui-service.h"
+#include "gpu-query.h"
+#include "voxelizer.h"
+
+static const uint32_t TILE_SIZE = 8;
+
+// Glossy and mirror tile classes
+static const uint32_t TILE_CLASS_COUNT = 2;
+static const DispatchIndirectCommand EMPTY_DISPATCH[TILE_CLASS_COUNT] = { { 0, 1, 1 }, { 0, 1, 1 } };
+
+void SpecularPass::Initialize(uint32_t width, uint32_t height)
+{
+	mWidth = width;
+	mHeight = height;
+	mTileCountX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	mTileCountY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	mClassifyProgram = std::make_unique<GLComputeProgram>();
+	mClassifyProgram->init(GLShader{ "Assets/Shaders/specular-classify.comp" });
+
+	mGlossyProgram = std::make_unique<GLComputeProgram>();
+	mGlossyProgram->init(GLShader{ "Assets/Shaders/specular-trace.comp" });
+
+	mMirrorProgram = std::make_unique<GLComputeProgram>();
+	mMirrorProgram->init(GLShader{ "Assets/Shaders/specular-trace.comp", { "MIRROR" } });
+
+	mDispatchBuffer = std::make_unique<GLBuffer>();
+	mDispatchBuffer->init((void*)EMPTY_DISPATCH, sizeof(EMPTY_DISPATCH), GL_DYNAMIC_STORAGE_BIT);
+
+	mTileBuffer = std::make_unique<GLBuffer>();
+	mTileBuffer->init(nullptr, TILE_CLASS_COUNT * mTileCountX * mTileCountY * sizeof(uint32_t), 0);
+
+	TextureCreateInfo createInfo{ width, height, 1, GL_RGBA, GL_RGBA16F, GL_TEXTURE_2D, GL_FLOAT };
+	mSpecularTexture = std::make_unique<GLTexture>();
+	mSpecularTexture->init(&createInfo);
+}
+
+void SpecularPass::Render(Camera* camera, Voxelizer* voxelizer, uint32_t depthTexture, uint32_t materialTexture)
+{
+	glm::vec2 screenSize{ (float)mWidth, (float)mHeight };
+	int maxTiles = (int)(mTileCountX * mTileCountY);
+
+	GpuProfiler::Begin("Specular Tile Classification");
+	glNamedBufferSubData(mDispatchBuffer->handle, 0, sizeof(EMPTY_DISPATCH), EMPTY_DISPATCH);
+	// Unclassified tiles are never written by the kernels
+	glClearTexImage(mSpecularTexture->handle, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+	mClassifyProgram->bind();
+	mClassifyProgram->setVec2("uScreenSize", &screenSize[0]);
+	mClassifyProgram->setFloat("uMirrorRoughness", mMirrorRoughness);
+	mClassifyProgram->setInt("uMaxTiles", maxTiles);
+	mClassifyProgram->setTexture("uMaterialTexture", 0, materialTexture);
+	mClassifyProgram->setTexture("uDepthTexture", 1, depthTexture);
+	mClassifyProgram->setBuffer(0, mDispatchBuffer->handle);
+	mClassifyProgram->setBuffer(1, mTileBuffer->handle);
+	mClassifyProgram->dispatch(mTileCountX, mTileCountY, 1);
+	mClassifyProgram->unbind();
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	GpuProfiler::End();
+
+	glm::mat4 invVP = glm::inverse(camera->GetViewProjectionMatrix());
+	glm::vec3 voxelDim{ (float)voxelizer->mVoxelDims, voxelizer->mUnitVoxelSize, voxelizer->mDebugMipInterpolation };
+	glm::vec3 cameraPosition = camera->GetPosition();
+
+	auto traceTiles = [&](GLComputeProgram* program, uint32_t tileClass) {
+		program->bind();
+		program->setMat4("uInvVP", &invVP[0][0]);
+		program->setVec3("uVoxelDims", &voxelDim[0]);
+		program->setVec3("uCameraPosition", &cameraPosition[0]);
+		program->setVec2("uScreenSize", &screenSize[0]);
+		program->setInt("uMaxTiles", maxTiles);
+		program->setTexture("uDepthTexture", 0, depthTexture);
+		program->setTexture("uMaterialTexture", 1, materialTexture);
+		program->setTexture("uVolumeTexture", 2, voxelizer->voxelTexture->handle, true);
+		program->setTexture(0, mSpecularTexture->handle, GL_WRITE_ONLY, mSpecularTexture->internalFormat);
+		program->setBuffer(1, mTileBuffer->handle);
+		program->dispatchIndirect(mDispatchBuffer->handle, tileClass * sizeof(DispatchIndirectCommand));
+		program->unbind();
+	};
+
+	GpuProfiler::Begin("Specular Glossy");
+	traceTiles(mGlossyProgram.get(), 0);
+	GpuProfiler::End();
+
+	GpuProfiler::Begin("Specular Mirror");
+	traceTiles(mMirrorProgram.get(), 1);
+	GpuProfiler::End();
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+uint32_t SpecularPass::GetSpecularTexture()
+{
+	return mSpecularTexture->handle;
+}
+
+void SpecularPass::AddUI()
+{
+	ImGui::SliderFloat("Mirror Roughness", &mMirrorRoughness, 0.0f, 1.0f);
+}
+
+void SpecularPass::Destroy()
+{
+	mClassifyProgram->destroy();
+	mGlossyProgram->destroy();
+	mMirrorProgram->destroy();
+	mDispatchBuffer->destroy();
+	mTileBuffer->destroy();
+	mSpecularTexture->destroy();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+class GLComputeProgram;
+class Camera;
+class Voxelizer;
+struct GLBuffer;
+struct GLTexture;
+
+/*
+* Screen space specular cone tracing. Tiles are classified by material into
+* no specular, glossy and mirror-like, and each class gets its own kernel
+* dispatched indirectly over the list of tiles that need it.
+*/
+class SpecularPass {
+
+public:
+	void Initialize(uint32_t width, uint32_t height);
+
+	void Render(Camera* camera, Voxelizer* voxelizer, uint32_t depthTexture, uint32_t materialTexture);
+
+	uint32_t GetSpecularTexture();
+
+	void AddUI();
+
+	void Destroy();
+
+private:
+	uint32_t mWidth, mHeight;
+	uint32_t mTileCountX, mTileCountY;
+	float mMirrorRoughness = 0.1f;
+
+	std::unique_ptr<GLComputeProgram> mClassifyProgram, mGlossyProgram, mMirrorProgram;
+	std::unique_ptr<GLBuffer> mDispatchBuffer, mTileBuffer;
+	std::unique_ptr<GLTexture> mSpecularTexture;
+};
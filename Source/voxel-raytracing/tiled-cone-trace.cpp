@@ -0,0 +1,76 @@
+#include "tiled-cone-trace.h"
+
+#include "gl-utils.h"
+#include "camera.h"
+#include "imgui-service.h"
+#include "gpu-query.h"
+#include "voxelizer.h"
+
+static const uint32_t TILE_SIZE = 8;
+
+void TiledConeTrace::Initialize(uint32_t width, uint32_t height)
+{
+	mWidth = width;
+	mHeight = height;
+
+	mProgram = std::make_unique<GLComputeProgram>();
+	mProgram->init(GLShader{ "Assets/Shaders/cone-trace-tiled.comp" });
+
+	mAmbientOcclusionProgram = std::make_unique<GLComputeProgram>();
+	mAmbientOcclusionProgram->init(GLShader{ "Assets/Shaders/cone-trace-tiled.comp", { "AMBIENT_OCCLUSION" } });
+
+	TextureCreateInfo createInfo{ width, height, 1, GL_RGBA, GL_RGBA16F, GL_TEXTURE_2D, GL_FLOAT };
+	mIndirectTexture = std::make_unique<GLTexture>();
+	mIndirectTexture->init(&createInfo);
+}
+
+void TiledConeTrace::Render(Camera* camera, Voxelizer* voxelizer, uint32_t depthTexture, uint32_t materialTexture)
+{
+	if (!enabled) return;
+
+	bool ambientOcclusion = voxelizer->giMode == GIMode::AmbientOcclusion;
+	GLComputeProgram* program = ambientOcclusion ? mAmbientOcclusionProgram.get() : mProgram.get();
+	GLTexture* volumeTexture = ambientOcclusion ? voxelizer->occupancyTexture.get() : voxelizer->voxelTexture.get();
+
+	GpuProfiler::Begin(std::string("Tiled Cone Trace (") + GetGIModeName(voxelizer->giMode) + ")");
+	program->bind();
+	glm::mat4 invVP = glm::inverse(camera->GetViewProjectionMatrix());
+	glm::vec3 voxelDim{ (float)voxelizer->mVoxelDims, voxelizer->mUnitVoxelSize, voxelizer->mDebugMipInterpolation };
+	glm::vec2 screenSize{ (float)mWidth, (float)mHeight };
+	program->setMat4("uInvVP", &invVP[0][0]);
+	program->setVec3("uVoxelDims", &voxelDim[0]);
+	program->setVec2("uScreenSize", &screenSize[0]);
+	program->setInt("uCacheMip", mCacheMipLevel);
+	program->setVec3("uAmbientColor", &voxelizer->ambientColor[0]);
+
+	program->setTexture("uDepthTexture", 0, depthTexture);
+	program->setTexture("uMaterialTexture", 1, materialTexture);
+	program->setTexture("uVolumeTexture", 2, volumeTexture->handle, true);
+	program->setTexture(0, mIndirectTexture->handle, GL_WRITE_ONLY, mIndirectTexture->internalFormat);
+
+	uint32_t workGroupX = (mWidth + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t workGroupY = (mHeight + TILE_SIZE - 1) / TILE_SIZE;
+	program->dispatch(workGroupX, workGroupY, 1);
+	program->unbind();
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	GpuProfiler::End();
+}
+
+uint32_t TiledConeTrace::GetIndirectTexture()
+{
+	return mIndirectTexture->handle;
+}
+
+void TiledConeTrace::AddUI()
+{
+	ImGui::Checkbox("Tiled Cone Trace", &enabled);
+	if (enabled)
+		ImGui::SliderInt("Cache MipLevel", &mCacheMipLevel, 0, 4);
+}
+
+void TiledConeTrace::Destroy()
+{
+	mProgram->destroy();
+	mAmbientOcclusionProgram->destroy();
+	mIndirectTexture->destroy();
+}
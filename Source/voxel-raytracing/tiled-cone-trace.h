@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+class GLComputeProgram;
+class Camera;
+class Voxelizer;
+struct GLTexture;
+
+/*
+* Screen space diffuse cone tracing. Each 8x8 tile preloads the part of the
+* voxel volume it is going to hit at the coarse mips into shared memory and
+* traces against it, instead of every pixel fetching the same voxels.
+*/
+class TiledConeTrace {
+
+public:
+	void Initialize(uint32_t width, uint32_t height);
+
+	void Render(Camera* camera, Voxelizer* voxelizer, uint32_t depthTexture, uint32_t materialTexture);
+
+	uint32_t GetIndirectTexture();
+
+	void AddUI();
+
+	void Destroy();
+
+	bool enabled = true;
+
+private:
+	uint32_t mWidth, mHeight;
+	int mCacheMipLevel = 2;
+
+	std::unique_ptr<GLComputeProgram> mProgram, mAmbientOcclusionProgram;
+	std::unique_ptr<GLTexture> mIndirectTexture;
+};
@@ -6,6 +6,23 @@
 #include "logger.h"
 #include "utils.h"
 #include "gpu-query.h"
+#include "point-shadow-map.h"
+#include "cluster-culler.h"
+#include "texture-cache.h"
+#include "scene-bvh.h"
+#include "scene-geometry.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+
+#ifndef GL_CONSERVATIVE_RASTERIZATION_NV
+#define GL_CONSERVATIVE_RASTERIZATION_NV 0x9346
+#endif
+#ifndef GL_CONSERVATIVE_RASTERIZATION_INTEL
+#define GL_CONSERVATIVE_RASTERIZATION_INTEL 0x83FE
+#endif
 
 void Voxelizer::Init(uint32_t voxelDims, float unitVoxelSize)
 {
@@ -19,6 +36,30 @@ void Voxelizer::Init(uint32_t voxelDims, float unitVoxelSize)
 		mProgram->init(vs, fs, gs);
 	}
 
+	{
+		GLint extensionCount = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+		for (GLint i = 0; i < extensionCount; ++i) {
+			const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (strcmp(extension, "GL_NV_conservative_raster") == 0)
+				mConservativeRasterCap = GL_CONSERVATIVE_RASTERIZATION_NV;
+			else if (strcmp(extension, "GL_INTEL_conservative_rasterization") == 0 && mConservativeRasterCap == 0)
+				mConservativeRasterCap = GL_CONSERVATIVE_RASTERIZATION_INTEL;
+		}
+
+		mConservativeProgram = std::make_unique<GLProgram>();
+		GLShader vs("Assets/Shaders/voxelizer.vert");
+		GLShader fs("Assets/Shaders/voxelizer.frag", { "CONSERVATIVE" });
+		GLShader gs("Assets/Shaders/voxelizer.geom", { "CONSERVATIVE", "EXPAND_TRIANGLES" });
+		mConservativeProgram->init(vs, fs, gs);
+
+		if (mConservativeRasterCap != 0) {
+			mHardwareConservativeProgram = std::make_unique<GLProgram>();
+			GLShader hardwareGs("Assets/Shaders/voxelizer.geom", { "CONSERVATIVE" });
+			mHardwareConservativeProgram->init(vs, fs, hardwareGs);
+		}
+	}
+
 	{
 		mClearTextureProgram = std::make_unique<GLComputeProgram>();
 		mClearTextureProgram->init(GLShader{ "Assets/Shaders/clear-texture.comp" });
@@ -30,6 +71,14 @@ void Voxelizer::Init(uint32_t voxelDims, float unitVoxelSize)
 		mDrawCallGeneratorProgram->init(GLShader{ "Assets/Shaders/draw-call.comp" });
 	}
 
+	for (int i = 0; i < 4; ++i) {
+		std::vector<std::string> defines{ "VOXELIZE_SMALL_TRIANGLES" };
+		if (i & 1) defines.push_back("QUANTIZED_POSITIONS");
+		if (i & 2) defines.push_back("INDEX_16");
+		mTriangleVoxelizerPrograms[i] = std::make_unique<GLComputeProgram>();
+		mTriangleVoxelizerPrograms[i]->init(GLShader{ "Assets/Shaders/triangle-cull.comp", defines });
+	}
+
 	mDrawCommandBuffer = std::make_unique<GLBuffer>();
 	// Support only 10'000 voxels
 	uint32_t bufferSize = sizeof(float) * 3 * MAX_VOXELS_ALLOCATED;
@@ -52,65 +101,375 @@ void Voxelizer::Init(uint32_t voxelDims, float unitVoxelSize)
 	voxelTexture = std::make_unique<GLTexture>();
 	voxelTexture->init(&volumeTextureCreateInfo);
 
+	TextureCreateInfo occupancyTextureCreateInfo = volumeTextureCreateInfo;
+	occupancyTextureCreateInfo.format = GL_RED;
+	occupancyTextureCreateInfo.internalFormat = GL_R8;
+	occupancyTexture = std::make_unique<GLTexture>();
+	occupancyTexture->init(&occupancyTextureCreateInfo);
+
+	// Only mip 0 of the static layer is ever sampled, by the copy into the composited volume
+	TextureCreateInfo staticTextureCreateInfo = volumeTextureCreateInfo;
+	staticTextureCreateInfo.mipLevels = 1;
+	staticTextureCreateInfo.minFilterType = GL_LINEAR;
+	mStaticVoxelTexture = std::make_unique<GLTexture>();
+	mStaticVoxelTexture->init(&staticTextureCreateInfo);
+	staticTextureCreateInfo.format = GL_RED;
+	staticTextureCreateInfo.internalFormat = GL_R8;
+	mStaticOccupancyTexture = std::make_unique<GLTexture>();
+	mStaticOccupancyTexture->init(&staticTextureCreateInfo);
+
 	mCubeMesh = std::make_unique<GLMesh>();
 	InitializeCubeMesh(mCubeMesh.get());
 }
 
-void Voxelizer::Generate(Scene* scene)
+void Voxelizer::Generate(Scene* scene, PointShadowMap* shadowMap, ClusterCuller* clusterCuller, const SceneBVH* bvh)
 {
-	if (mRegenerateVoxelData == false) return;
+	bool hybrid = false;
+	if (hybridVolumes) {
+		for (auto& meshGroup : scene->meshGroup)
+			hybrid |= meshGroup.isDynamic;
+	}
+	// The volume holding static geometry changes, or dynamic groups were written into it
+	if (hybrid != mHybridActive) {
+		mRegenerateVoxelData = true;
+		mHybridActive = hybrid;
+	}
+
+	bool fullRegenerate = mRegenerateVoxelData;
+	bool regionDirty = mHasDirtyRegion && !fullRegenerate;
+	bool staticDirty = fullRegenerate || regionDirty || !mPendingGroups.empty();
+	if (!staticDirty && !hybrid) return;
 	mRegenerateVoxelData = false;
+	mHasDirtyRegion = false;
+
+	// Static geometry gets its own layer when dynamic groups are composited on top every frame.
+	// It is lit without the dynamic casters, their shadows would otherwise stay baked into it
+	GLTexture* staticVoxelTexture = hybrid ? mStaticVoxelTexture.get() : voxelTexture.get();
+	GLTexture* staticOccupancyTexture = hybrid ? mStaticOccupancyTexture.get() : occupancyTexture.get();
+	uint32_t staticShadowMap = hybrid ? shadowMap->GetStaticShadowMap() : shadowMap->GetShadowMap();
+
+	if (staticDirty) {
+		if (fullRegenerate) {
+			GpuProfiler::Begin("Clear Voxel Texture");
+
+			mClearTextureProgram->bind();
+			mClearTextureProgram->setTexture(0, staticVoxelTexture->handle, GL_WRITE_ONLY, staticVoxelTexture->internalFormat, true);
+			uint32_t workGroupSize = (mVoxelDims + 7) / 8;
+			mClearTextureProgram->dispatch(workGroupSize, workGroupSize, workGroupSize);
+			mClearTextureProgram->unbind();
+			glClearTexImage(staticOccupancyTexture->handle, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			GpuProfiler::End();
+		}
+		else if (regionDirty) {
+			ClearRegion(mDirtyRegion, staticVoxelTexture, staticOccupancyTexture);
+		}
+
+		float halfExtent = mUnitVoxelSize * mVoxelDims * 0.5f;
+		glm::vec2 voxelDims{ mVoxelDims, mUnitVoxelSize };
+		// Incremental updates rasterize whole groups, the compute path would rewrite the full volume.
+		// It covers every draw of a pool, so it is left out while dynamic groups share the pools
+		if (computeVoxelization && fullRegenerate && !hybrid) {
+			GLComputeProgram* triangleVoxelizers[4];
+			for (int i = 0; i < 4; ++i) {
+				GLComputeProgram* program = mTriangleVoxelizerPrograms[i].get();
+				program->bind();
+				program->setVec2("uVoxelDims", &voxelDims[0]);
+				program->setVec3("uLightPosition", &scene->lightPosition[0]);
+				program->setTextureCube("uShadowMap", 0, staticShadowMap);
+				program->setFloat("uShadowFarPlane", shadowMap->GetFarPlane());
+				program->setInt("uSmallTriangleVoxels", smallTriangleVoxels);
+				program->unbind();
+				triangleVoxelizers[i] = program;
+			}
+			// Image units and buffer bindings are context state shared by all variants
+			triangleVoxelizers[0]->setTexture(0, staticVoxelTexture->handle, GL_WRITE_ONLY, staticVoxelTexture->internalFormat, true);
+			triangleVoxelizers[0]->setTexture(1, staticOccupancyTexture->handle, GL_WRITE_ONLY, staticOccupancyTexture->internalFormat, true);
+			triangleVoxelizers[0]->setBuffer(13, scene->textures->GetHandleBuffer());
+			clusterCuller->CullVoxelVolume(scene, halfExtent, mUnitVoxelSize, triangleVoxelizers);
+		}
+		else {
+			clusterCuller->CullVoxelVolume(scene, halfExtent, mUnitVoxelSize);
+		}
+
+		GpuProfiler::Begin("Voxelize Pass");
+		GLProgram* program = BeginRasterPass(scene, staticShadowMap, shadowMap->GetFarPlane(), staticVoxelTexture, staticOccupancyTexture);
+		if (fullRegenerate && !hybrid) {
+			clusterCuller->Draw(CullView::VoxelVolume, scene, program);
+		}
+		else if (fullRegenerate) {
+			for (uint32_t groupIndex = 0; groupIndex < scene->meshGroup.size(); ++groupIndex) {
+				if (!scene->meshGroup[groupIndex].isDynamic)
+					clusterCuller->DrawGroup(CullView::VoxelVolume, scene, groupIndex, program);
+			}
+		}
+		else {
+			for (uint32_t groupIndex : mPendingGroups) {
+				if (!hybrid || !scene->meshGroup[groupIndex].isDynamic)
+					clusterCuller->DrawGroup(CullView::VoxelVolume, scene, groupIndex, program);
+			}
+			if (regionDirty)
+				DrawRegion(scene, bvh, mDirtyRegion, program);
+		}
+		mPendingGroups.clear();
+		EndRasterPass(program);
+		GpuProfiler::End();
+	}
 
-	GpuProfiler::Begin("Clear Voxel Texture");
+	// Merge pass: the static layer is copied into the sampled volume and the
+	// dynamic groups are voxelized over it, so the per frame cost follows them
+	if (hybrid) {
+		GpuProfiler::Begin("Voxelize Dynamic Pass");
+		glCopyImageSubData(mStaticVoxelTexture->handle, GL_TEXTURE_3D, 0, 0, 0, 0,
+			voxelTexture->handle, GL_TEXTURE_3D, 0, 0, 0, 0, mVoxelDims, mVoxelDims, mVoxelDims);
+		glCopyImageSubData(mStaticOccupancyTexture->handle, GL_TEXTURE_3D, 0, 0, 0, 0,
+			occupancyTexture->handle, GL_TEXTURE_3D, 0, 0, 0, 0, mVoxelDims, mVoxelDims, mVoxelDims);
+		GLProgram* program = BeginRasterPass(scene, shadowMap->GetShadowMap(), shadowMap->GetFarPlane(), voxelTexture.get(), occupancyTexture.get());
+		for (auto& meshGroup : scene->meshGroup) {
+			if (meshGroup.isDynamic)
+				meshGroup.Draw(program);
+		}
+		EndRasterPass(program);
+		GpuProfiler::End();
+	}
 
-	mClearTextureProgram->bind();
-	mClearTextureProgram->setTexture(0, voxelTexture->handle, GL_WRITE_ONLY, voxelTexture->internalFormat, true);
-	uint32_t workGroupSize = (mVoxelDims + 7) / 8;
-	mClearTextureProgram->dispatch(workGroupSize, workGroupSize, workGroupSize);
-	mClearTextureProgram->unbind();
-	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	GpuProfiler::Begin("Texture Mipmap Generation");
+	glBindTexture(GL_TEXTURE_3D, voxelTexture->handle);
+	glGenerateMipmap(GL_TEXTURE_3D);
+	glBindTexture(GL_TEXTURE_3D, occupancyTexture->handle);
+	glGenerateMipmap(GL_TEXTURE_3D);
 	GpuProfiler::End();
 
+}
+
+GLProgram* Voxelizer::BeginRasterPass(Scene* scene, uint32_t shadowMap, float shadowFarPlane, GLTexture* color, GLTexture* occupancy)
+{
 	glDisable(GL_BLEND);
 	glDisable(GL_DEPTH_TEST);
 	glDisable(GL_CULL_FACE);
 	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-	GpuProfiler::Begin("Voxelize Pass");
 	framebuffer->bind();
 	framebuffer->setClearColor(0.2f, 0.2f, 0.2f, 1.0f);
 	framebuffer->setViewport(mVoxelDims, mVoxelDims);
 	framebuffer->clear();
 
-	Camera* camera = scene->camera;
+	GLProgram* program = mProgram.get();
+	if (conservativeVoxelization && hardwareConservativeRaster && mHardwareConservativeProgram) {
+		program = mHardwareConservativeProgram.get();
+		glEnable(mConservativeRasterCap);
+	}
+	else if (conservativeVoxelization) {
+		program = mConservativeProgram.get();
+	}
 
-	mProgram->bind();
-	glm::mat4 VP = camera->GetViewProjectionMatrix();
-	glm::mat4 V = camera->GetViewMatrix();
+	program->bind();
 	glm::vec2 voxelDims{ mVoxelDims, mUnitVoxelSize };
-	mProgram->setVec2("uVoxelDims", &voxelDims[0]);
-	mProgram->setVec3("uLightPosition", &scene->lightPosition[0]);
-	mProgram->setUAVTexture(0, voxelTexture->handle, GL_WRITE_ONLY,  voxelTexture->internalFormat, true);
-
-	for (auto& mesh : scene->meshGroup) {
-		mesh.Draw(mProgram.get());
-	}
+	program->setVec2("uVoxelDims", &voxelDims[0]);
+	program->setVec3("uLightPosition", &scene->lightPosition[0]);
+	program->setTextureCube("uShadowMap", 0, shadowMap);
+	program->setFloat("uShadowFarPlane", shadowFarPlane);
+	program->setBuffer(4, scene->textures->GetHandleBuffer());
+	program->setUAVTexture(0, color->handle, GL_WRITE_ONLY, color->internalFormat, true);
+	program->setUAVTexture(1, occupancy->handle, GL_WRITE_ONLY, occupancy->internalFormat, true);
+	return program;
+}
 
-	mProgram->unbind();
+void Voxelizer::EndRasterPass(GLProgram* program)
+{
+	program->unbind();
 	framebuffer->unbind();
+	if (program == mHardwareConservativeProgram.get())
+		glDisable(mConservativeRasterCap);
 
 	glEnable(GL_BLEND);
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-	GpuProfiler::End();
+}
 
-	GpuProfiler::Begin("Texture Mipmap Generation");
-	glBindTexture(GL_TEXTURE_3D, voxelTexture->handle);
-	glGenerateMipmap(GL_TEXTURE_3D);
+void Voxelizer::InvalidateBounds(const AABB& bounds)
+{
+	float halfExtent = mUnitVoxelSize * mVoxelDims * 0.5f;
+	bool overlaps = glm::all(glm::lessThanEqual(bounds.min, glm::vec3(halfExtent))) &&
+		glm::all(glm::greaterThanEqual(bounds.max, glm::vec3(-halfExtent)));
+	if (!overlaps) return;
+
+	AABB clipped{ glm::max(bounds.min, glm::vec3(-halfExtent)), glm::min(bounds.max, glm::vec3(halfExtent)) };
+	if (mHasDirtyRegion) {
+		mDirtyRegion.min = glm::min(mDirtyRegion.min, clipped.min);
+		mDirtyRegion.max = glm::max(mDirtyRegion.max, clipped.max);
+	}
+	else {
+		mDirtyRegion = clipped;
+		mHasDirtyRegion = true;
+	}
+}
+
+void Voxelizer::ClearRegion(const AABB& region, GLTexture* color, GLTexture* occupancy)
+{
+	GpuProfiler::Begin("Clear Voxel Region");
+	float halfExtent = mUnitVoxelSize * mVoxelDims * 0.5f;
+	glm::ivec3 maxVoxel{ (int)mVoxelDims - 1 };
+	glm::ivec3 first = glm::clamp(glm::ivec3(glm::floor((region.min + halfExtent) / mUnitVoxelSize)), glm::ivec3(0), maxVoxel);
+	glm::ivec3 last = glm::clamp(glm::ivec3(glm::floor((region.max + halfExtent) / mUnitVoxelSize)), glm::ivec3(0), maxVoxel);
+	glm::ivec3 size = last - first + 1;
+	glClearTexSubImage(color->handle, 0, first.x, first.y, first.z, size.x, size.y, size.z, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glClearTexSubImage(occupancy->handle, 0, first.x, first.y, first.z, size.x, size.y, size.z, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 	GpuProfiler::End();
+}
+
+void Voxelizer::DrawRegion(Scene* scene, const SceneBVH* bvh, const AABB& region, GLProgram* program)
+{
+	// Draws reaching into the cleared voxels rewrite them, voxels they cover
+	// outside the region are written again with the same values
+	std::vector<DrawRef> draws;
+	bvh->QueryOverlap(AABB{ region.min - mUnitVoxelSize, region.max + mUnitVoxelSize }, draws);
+	if (mHybridActive) {
+		draws.erase(std::remove_if(draws.begin(), draws.end(), [scene](const DrawRef& draw) {
+			return scene->meshGroup[draw.group].isDynamic;
+		}), draws.end());
+	}
+	if (draws.empty()) return;
+
+	// One command list sorted by pool, drawn with one call per pool
+	std::sort(draws.begin(), draws.end(), [scene](const DrawRef& a, const DrawRef& b) {
+		return scene->meshGroup[a.group].pool->index < scene->meshGroup[b.group].pool->index;
+	});
+	std::vector<DrawElementsIndirectCommand> drawCommands;
+	for (const DrawRef& draw : draws)
+		drawCommands.push_back(scene->meshGroup[draw.group].getPoolCommand(draw.draw));
+
+	uint32_t commandCount = (uint32_t)drawCommands.size();
+	if (mRegionCommandCapacity < commandCount) {
+		if (mRegionCommandBuffer)
+			mRegionCommandBuffer->destroy();
+		mRegionCommandCapacity = std::max(commandCount, mRegionCommandCapacity * 2);
+		mRegionCommandBuffer = std::make_unique<GLBuffer>();
+		mRegionCommandBuffer->init(nullptr, mRegionCommandCapacity * sizeof(DrawElementsIndirectCommand), GL_DYNAMIC_STORAGE_BIT);
+	}
+	glNamedBufferSubData(mRegionCommandBuffer->handle, 0, commandCount * sizeof(DrawElementsIndirectCommand), drawCommands.data());
+
+	uint32_t first = 0;
+	while (first < commandCount) {
+		GeometryPool* pool = scene->meshGroup[draws[first].group].pool;
+		uint32_t last = first;
+		while (last < commandCount && scene->meshGroup[draws[last].group].pool == pool)
+			++last;
+		pool->DrawIndirect(program, mRegionCommandBuffer->handle, first, last - first);
+		first = last;
+	}
+}
+
+// CPU version of voxelizer.geom and voxelizer.frag in voxel units, pixels are
+// voxels of the dominant axis plane and are covered when their center is inside
+static void RasterizeVoxels(const glm::vec3* triangle, int gridSize, bool conservative, std::vector<uint8_t>& voxels)
+{
+	glm::vec3 normal = glm::cross(triangle[1] - triangle[0], triangle[2] - triangle[0]);
+	int axis = std::abs(normal.y) > std::abs(normal.x) ? 1 : 0;
+	axis = std::abs(normal.z) > std::abs(normal[axis]) ? 2 : axis;
+	int u = (axis + 1) % 3, v = (axis + 2) % 3;
+
+	glm::vec2 p[3];
+	for (int i = 0; i < 3; ++i)
+		p[i] = glm::vec2(triangle[i][u], triangle[i][v]);
+	glm::vec2 e0 = p[1] - p[0], e1 = p[2] - p[0];
+	float area = e0.x * e1.y - e0.y * e1.x;
+	if (area == 0.0f) return;
+
+	glm::vec2 raster[3] = { p[0], p[1], p[2] };
+	glm::vec2 clipMin = glm::min(glm::min(p[0], p[1]), p[2]) - 0.5f;
+	glm::vec2 clipMax = glm::max(glm::max(p[0], p[1]), p[2]) + 0.5f;
+	if (conservative) {
+		// Same edge offset and corner intersection as ExpandTriangle
+		glm::vec3 edges[3];
+		for (int i = 0; i < 3; ++i) {
+			edges[i] = glm::cross(glm::vec3(p[i], 1.0f), glm::vec3(p[(i + 1) % 3], 1.0f)) * (area < 0.0f ? -1.0f : 1.0f);
+			edges[i].z += 0.5f * (std::abs(edges[i].x) + std::abs(edges[i].y));
+		}
+		for (int i = 0; i < 3; ++i) {
+			glm::vec3 corner = glm::cross(edges[(i + 2) % 3], edges[i]);
+			raster[i] = glm::vec2(corner) / corner.z;
+		}
+	}
+
+	glm::ivec2 first = glm::max(glm::ivec2(glm::floor(glm::min(glm::min(raster[0], raster[1]), raster[2]))), glm::ivec2(0));
+	glm::ivec2 last = glm::min(glm::ivec2(glm::floor(glm::max(glm::max(raster[0], raster[1]), raster[2]))), glm::ivec2(gridSize - 1));
+	float rasterArea = (raster[1].x - raster[0].x) * (raster[2].y - raster[0].y) - (raster[1].y - raster[0].y) * (raster[2].x - raster[0].x);
+	for (int y = first.y; y <= last.y; ++y) {
+		for (int x = first.x; x <= last.x; ++x) {
+			glm::vec2 c{ x + 0.5f, y + 0.5f };
+			bool inside = true;
+			for (int i = 0; i < 3 && inside; ++i) {
+				glm::vec2 a = raster[i], b = raster[(i + 1) % 3];
+				float edge = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+				inside = edge * rasterArea >= 0.0f;
+			}
+			if (!inside) continue;
+			if (conservative && (glm::any(glm::lessThan(c, clipMin)) || glm::any(glm::greaterThan(c, clipMax))))
+				continue;
+
+			float depth = (glm::dot(normal, triangle[0]) - normal[u] * c.x - normal[v] * c.y) / normal[axis];
+			for (int i = conservative ? -1 : 0; i <= (conservative ? 1 : 0); ++i) {
+				glm::ivec3 voxel;
+				voxel[u] = x;
+				voxel[v] = y;
+				voxel[axis] = (int)std::floor(depth) + i;
+				if (voxel[axis] < 0 || voxel[axis] >= gridSize) continue;
+				if (conservative && !Utils::TriangleBoxOverlap(triangle, glm::vec3(voxel) + 0.5f, glm::vec3(0.5f)))
+					continue;
+				voxels[(voxel.z * gridSize + voxel.y) * gridSize + voxel.x] = 1;
+			}
+		}
+	}
+}
+
+void Voxelizer::RunCoverageTest()
+{
+	const int gridSize = 32;
+	const uint32_t triangleCount = 2000;
+	std::mt19937 generator(1234);
+	std::uniform_real_distribution<float> position(6.0f, gridSize - 6.0f);
+	std::uniform_real_distribution<float> offset(-5.0f, 5.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	mCoverageTestVoxels = mStandardMissedVoxels = mConservativeMissedVoxels = 0;
+	uint32_t conservativeExtraVoxels = 0;
+	std::vector<uint8_t> exact(gridSize * gridSize * gridSize), standard(exact.size()), conservative(exact.size());
+	for (uint32_t t = 0; t < triangleCount; ++t) {
+		// Slivers: the third vertex stays within a fraction of a voxel of the first edge
+		glm::vec3 a{ position(generator), position(generator), position(generator) };
+		glm::vec3 b = a + glm::vec3{ offset(generator), offset(generator), offset(generator) };
+		glm::vec3 c = glm::mix(a, b, unit(generator)) + glm::vec3{ offset(generator), offset(generator), offset(generator) } * 0.05f;
+		glm::vec3 triangle[3] = { a, b, c };
+
+		std::fill(exact.begin(), exact.end(), (uint8_t)0);
+		std::fill(standard.begin(), standard.end(), (uint8_t)0);
+		std::fill(conservative.begin(), conservative.end(), (uint8_t)0);
+		glm::ivec3 first = glm::max(glm::ivec3(glm::floor(glm::min(glm::min(a, b), c))), glm::ivec3(0));
+		glm::ivec3 last = glm::min(glm::ivec3(glm::floor(glm::max(glm::max(a, b), c))), glm::ivec3(gridSize - 1));
+		for (int z = first.z; z <= last.z; ++z)
+			for (int y = first.y; y <= last.y; ++y)
+				for (int x = first.x; x <= last.x; ++x)
+					exact[(z * gridSize + y) * gridSize + x] = Utils::TriangleBoxOverlap(triangle, glm::vec3(x, y, z) + 0.5f, glm::vec3(0.5f)) ? 1 : 0;
+
+		RasterizeVoxels(triangle, gridSize, false, standard);
+		RasterizeVoxels(triangle, gridSize, true, conservative);
+		for (size_t i = 0; i < exact.size(); ++i) {
+			mCoverageTestVoxels += exact[i];
+			mStandardMissedVoxels += exact[i] & (standard[i] ^ 1);
+			mConservativeMissedVoxels += exact[i] & (conservative[i] ^ 1);
+			conservativeExtraVoxels += conservative[i] & (exact[i] ^ 1);
+		}
+	}
 
+	logger::Debug("Voxel coverage test: " + std::to_string(mCoverageTestVoxels) + " voxels, standard missed " + std::to_string(mStandardMissedVoxels) +
+		", conservative missed " + std::to_string(mConservativeMissedVoxels));
+	if (mConservativeMissedVoxels > 0 || conservativeExtraVoxels > 0)
+		logger::Warn("Conservative voxelization differs from the triangle/box test: " + std::to_string(mConservativeMissedVoxels) + " missed, " +
+			std::to_string(conservativeExtraVoxels) + " extra");
 }
 
 void Voxelizer::Visualize(Camera* camera)
@@ -170,12 +529,49 @@ void Voxelizer::AddUI()
 	if (ImGui::DragFloat("VoxelSize", &mUnitVoxelSize, 0.01f, 0.01f, 1.0f)) {
 		mRegenerateVoxelData = true;
 	}
+	if (ImGui::Checkbox("Compute Voxelization", &computeVoxelization))
+		mRegenerateVoxelData = true;
+	if (computeVoxelization && ImGui::SliderInt("Small Triangle Voxels", &smallTriangleVoxels, 1, 16))
+		mRegenerateVoxelData = true;
+	if (ImGui::Checkbox("Hybrid Static/Dynamic Volumes", &hybridVolumes))
+		mRegenerateVoxelData = true;
+	if (mHybridActive)
+		ImGui::Text("Dynamic groups are voxelized every frame");
+	if (ImGui::Checkbox("Conservative Voxelization", &conservativeVoxelization))
+		mRegenerateVoxelData = true;
+	if (conservativeVoxelization) {
+		if (mHardwareConservativeProgram) {
+			if (ImGui::Checkbox("Hardware Conservative Raster", &hardwareConservativeRaster))
+				mRegenerateVoxelData = true;
+		}
+		else {
+			ImGui::Text("No hardware conservative raster, expanding triangles");
+		}
+	}
+	if (ImGui::Button("Run Coverage Test"))
+		RunCoverageTest();
+	if (mCoverageTestVoxels > 0) {
+		ImGui::Text("Missed voxels: standard %.2f%%, conservative %.2f%%",
+			100.0f * mStandardMissedVoxels / mCoverageTestVoxels, 100.0f * mConservativeMissedVoxels / mCoverageTestVoxels);
+	}
 
 	ImGui::SliderInt("Debug MipLevel", &mDebugMipLevel, 0, 5);
 	ImGui::SliderFloat("Mip Interpolation", &mDebugMipInterpolation, 0.0f, 5.0f);
 
 	ImGui::Checkbox("Show Voxels", &enableDebugVoxel);
 
+	static const char* GI_MODES = "Radiance\0Ambient Occlusion\0";
+	ImGui::Combo("GI Mode", (int*)&giMode, GI_MODES);
+	if (giMode == GIMode::AmbientOcclusion)
+		ImGui::ColorEdit3("Ambient", &ambientColor[0]);
+
+	static const char* SHADOW_MODES = "None\0Hard (DDA)\0Soft (Cone)\0";
+	ImGui::Combo("Shadow Mode", (int*)&shadowMode, SHADOW_MODES);
+	if (shadowMode != VoxelShadowMode::None)
+		ImGui::SliderInt("Shadow Step Budget", &shadowMaxSteps, 8, 512);
+	if (shadowMode == VoxelShadowMode::Soft)
+		ImGui::SliderFloat("Shadow Cone Aperture", &shadowConeAperture, 0.01f, 0.5f);
+
 	static bool showTexture = false;
 	ImGui::Checkbox("Show Texture", &showTexture);
 	if (showTexture) {
@@ -188,10 +584,20 @@ void Voxelizer::Destroy()
 {
 	mDrawCommandBuffer->destroy();
 	mDrawCountBuffer->destroy();
+	if (mRegionCommandBuffer)
+		mRegionCommandBuffer->destroy();
 	mDrawCallGeneratorProgram->destroy();
 	mProgram->destroy();
+	mConservativeProgram->destroy();
+	if (mHardwareConservativeProgram)
+		mHardwareConservativeProgram->destroy();
 	mVisualizerProgram->destroy();
 	mClearTextureProgram->destroy();
+	for (auto& program : mTriangleVoxelizerPrograms)
+		program->destroy();
 	framebuffer->destroy();
 	voxelTexture->destroy();
+	occupancyTexture->destroy();
+	mStaticVoxelTexture->destroy();
+	mStaticOccupancyTexture->destroy();
 }
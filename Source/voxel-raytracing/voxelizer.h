@@ -9,13 +9,46 @@ class GLComputeProgram;
 struct GLMesh;
 struct GLFramebuffer;
 struct GLBuffer;
+class PointShadowMap;
+class ClusterCuller;
+class SceneBVH;
+
+enum class GIMode {
+	Radiance = 0,
+	// Opacity cones against the R8 occupancy volume with a constant ambient term
+	AmbientOcclusion = 1,
+};
+
+enum class VoxelShadowMode {
+	None = 0,
+	// DDA walk through the finest occupancy mip
+	Hard = 1,
+	// Narrow opacity cone through the occupancy mips
+	Soft = 2,
+};
+
+inline const char* GetGIModeName(GIMode mode) {
+	return mode == GIMode::AmbientOcclusion ? "AO" : "Radiance";
+}
 
 class Voxelizer {
 	
 public:
 	void Init(uint32_t voxelDims, float unitVoxelSize = 0.05f);
 
-	void Generate(Scene* scene);
+	// Full regeneration when mRegenerateVoxelData is set, otherwise only the
+	// groups queued with VoxelizeMeshGroup are added on top of the volume and
+	// the invalidated region is cleared and redrawn from the draws bvh finds in it.
+	// With hybridVolumes and dynamic groups in the scene these updates go to a
+	// static layer, which is copied into voxelTexture every frame before the
+	// dynamic groups are voxelized over it
+	void Generate(Scene* scene, PointShadowMap* shadowMap, ClusterCuller* clusterCuller, const SceneBVH* bvh);
+
+	// Queues a newly loaded group for incremental voxelization
+	void VoxelizeMeshGroup(uint32_t groupIndex) { mPendingGroups.push_back(groupIndex); }
+
+	// World bounds of geometry that moved, grows the region Generate revoxelizes
+	void InvalidateBounds(const AABB& bounds);
 
 	void Visualize(Camera* camera);
 
@@ -25,18 +58,63 @@ public:
 
 	std::unique_ptr<GLFramebuffer> framebuffer;
 	std::unique_ptr<GLTexture> voxelTexture;
+	std::unique_ptr<GLTexture> occupancyTexture;
 	bool enableDebugVoxel = false;
+	GIMode giMode = GIMode::Radiance;
+	glm::vec3 ambientColor{ 0.6f, 0.6f, 0.6f };
+	VoxelShadowMode shadowMode = VoxelShadowMode::None;
+	int shadowMaxSteps = 64;
+	float shadowConeAperture = 0.1f;
 	uint32_t mVoxelDims;
 	float mUnitVoxelSize;
 	float mDebugMipInterpolation = 0.0f;
 	bool mRegenerateVoxelData = true;
+	// Writes every voxel a triangle touches instead of the ones under pixel
+	// centers, with hardware conservative rasterization when available and
+	// hardwareConservativeRaster is set, triangle expansion otherwise
+	bool conservativeVoxelization = false;
+	// Dynamic groups are kept out of the static layer, see Generate
+	bool hybridVolumes = true;
+	bool hardwareConservativeRaster = true;
+	// Full regenerations write triangles spanning at most smallTriangleVoxels
+	// voxels per axis from the triangle culling pass, only larger ones are rasterized
+	bool computeVoxelization = false;
+	int smallTriangleVoxels = 4;
 private:
 	std::unique_ptr<GLProgram> mProgram, mVisualizerProgram;
+	std::unique_ptr<GLProgram> mConservativeProgram, mHardwareConservativeProgram;
+	// Enable cap of GL_NV_conservative_raster or GL_INTEL_conservative_rasterization, 0 without either
+	GLenum mConservativeRasterCap = 0;
+	// Voxelizing variants of triangle-cull.comp, indexed like the culling ones
+	std::unique_ptr<GLComputeProgram> mTriangleVoxelizerPrograms[4];
 	std::unique_ptr<GLComputeProgram> mClearTextureProgram, mDrawCallGeneratorProgram;
 	std::unique_ptr<GLBuffer> mDrawCommandBuffer, mDrawCountBuffer;
 
 	const uint32_t MAX_VOXELS_ALLOCATED = 1'000'000;
 	std::unique_ptr<GLMesh> mCubeMesh;
 	uint32_t mTotalVoxels = 0;
+	std::vector<uint32_t> mPendingGroups;
+	// Union of the invalidated bounds clipped to the volume
+	AABB mDirtyRegion;
+	bool mHasDirtyRegion = false;
+	std::unique_ptr<GLBuffer> mRegionCommandBuffer;
+	// Static geometry while dynamic groups are composited on top, mip 0 only
+	std::unique_ptr<GLTexture> mStaticVoxelTexture, mStaticOccupancyTexture;
+	bool mHybridActive = false;
+	uint32_t mRegionCommandCapacity = 0;
+
+	// Binds the raster voxelizer of the current mode writing into color and occupancy
+	GLProgram* BeginRasterPass(Scene* scene, uint32_t shadowMap, float shadowFarPlane, GLTexture* color, GLTexture* occupancy);
+	void EndRasterPass(GLProgram* program);
+
+	void ClearRegion(const AABB& region, GLTexture* color, GLTexture* occupancy);
+	void DrawRegion(Scene* scene, const SceneBVH* bvh, const AABB& region, GLProgram* program);
+
+	// Random sliver triangles rasterized on the CPU the way the voxelizer shaders
+	// do, with and without triangle expansion, against the exact triangle/box test
+	void RunCoverageTest();
+	uint32_t mCoverageTestVoxels = 0;
+	uint32_t mStandardMissedVoxels = 0;
+	uint32_t mConservativeMissedVoxels = 0;
 	int mDebugMipLevel = 0;
 };
\ No newline at end of file